@@ -241,6 +241,12 @@ void List::insert(std::size_t at, const Object &o)
         throw_exception();
 }
 
+void List::extend(const List &other)
+{
+    if (!DyList_Extend(d, other.get()))
+        throw_exception();
+}
+
 void List::clear()
 {
     if (!DyList_Clear(d))
@@ -279,22 +285,15 @@ void Dict::clear()
         throw_exception();
 }
 
-Dict::Iterator::Iterator(const Dict &dct) :
-    iter(reinterpret_cast<Dict::Iterator::Pair**>(DyDict_Iter(dct.get())))
+Dict::Iterator::Iterator(const Dict &dct)
 {
-    if (!iter)
+    if (!DyDict_IterInit(&it, dct.get()))
         throw_exception();
 }
 
 bool Dict::Iterator::next()
 {
-    return DyDict_IterNext(reinterpret_cast<DyDict_IterPair**>(iter));
-}
-
-Dict::Iterator::~Iterator()
-{
-    if (iter)
-        DyDict_IterFree(reinterpret_cast<DyDict_IterPair**>(iter));
+    return DyDict_IterNext(&it.entry);
 }
 
 // Userdata
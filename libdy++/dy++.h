@@ -21,6 +21,7 @@
 #include "util.h"
 
 #include <libdy/types.h>
+#include <libdy/collections.h>
 
 #include <exception>
 #include <initializer_list>
@@ -373,7 +374,7 @@ public:
      * @brief Extend this list with all elements of another
      * @param other The other list
      */
-    inline void extend(const List &other);
+    void extend(const List &other);
 
     /**
      * @brief Remove all items from the list
@@ -528,7 +529,7 @@ public:
     };
 
 private:
-    Pair **iter;
+    DyDict_Iterator it;
 
     Iterator();
     friend Iterator Dict::end();
@@ -539,7 +540,8 @@ public:
      * @param dct The dictionary
      */
     Iterator(const Dict &dct);
-    ~Iterator();
+    Iterator(const Iterator &other);
+    Iterator &operator =(const Iterator &other);
 
     /**
      * @brief Get the current key
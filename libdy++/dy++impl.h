@@ -71,12 +71,6 @@ inline SubscriptionRef Object::operator [](T key) const
 
 // -----------------------------------------------------------------------------
 // List
-inline void List::extend(const List &other)
-{
-    for (auto it : other)
-        append(it);
-}
-
 template <typename Item, typename... More>
 inline void List::appendMany(Item arg, More... args)
 {
@@ -135,17 +129,17 @@ inline List::Iterator List::end() const
 // Dict
 inline Object Dict::Iterator::key()
 {
-    return (*iter)->pkey;
+    return it.entry->key;
 }
 
 inline Object Dict::Iterator::value()
 {
-    return (*iter)->pvalue;
+    return it.entry->value;
 }
 
 inline bool Dict::Iterator::valid()
 {
-    return iter && *iter;
+    return it.entry;
 }
 
 inline Object Dict::Iterator::Pair::key()
@@ -160,12 +154,29 @@ inline Object Dict::Iterator::Pair::value()
 
 inline const Dict::Iterator::Pair &Dict::Iterator::operator *()
 {
-    return **iter;
+    return *reinterpret_cast<Pair *>(it.entry);
 }
 
-inline Dict::Iterator::Iterator() :
-    iter(nullptr)
-{}
+inline Dict::Iterator::Iterator()
+{
+    it.entry = nullptr;
+}
+
+inline Dict::Iterator::Iterator(const Dict::Iterator &other) :
+    it(other.it)
+{
+    // The entry may point into the iterator itself
+    if (other.it.entry == &other.it.pair)
+        it.entry = &it.pair;
+}
+
+inline Dict::Iterator &Dict::Iterator::operator =(const Dict::Iterator &other)
+{
+    it = other.it;
+    if (other.it.entry == &other.it.pair)
+        it.entry = &it.pair;
+    return *this;
+}
 
 inline Dict::Iterator &Dict::Iterator::operator++()
 {
@@ -175,8 +186,10 @@ inline Dict::Iterator &Dict::Iterator::operator++()
 
 inline bool Dict::Iterator::operator !=(const Dict::Iterator &other)
 {
-    // HAX: basically, if the validity or the pointed-to Pair differs.
-    return !!iter ? (!!other.iter ? *iter != *other.iter : !!*iter) : !!other.iter && !!*other.iter;
+    // Either the validity or the position differs
+    if (!it.entry || !other.it.entry)
+        return !it.entry != !other.it.entry;
+    return it.dict != other.it.dict || it.index != other.it.index;
 }
 
 inline Dict::Iterator Dict::iter()
@@ -131,7 +131,7 @@ template <typename Mapping>
 struct convert_generic_mapping {
     static inline DyObject *from_value(const Mapping &m)
     {
-        safe_dy_ptr dct = DyDict_New();
+        safe_dy_ptr dct = DyDict_NewEx(m.size());
         if (!dct)
             throw_exception();
 
@@ -157,20 +157,14 @@ struct convert_generic_mapping {
         if (!DyDict_Check(obj))
             format_exception(LIBDY_ERROR_CXX_TYPE_ERROR, "Cannot convert Dy::%s to Mapping", Dy_GetTypeName(Dy_Type(obj)));
 
-        util::safe_ptr<DyDict_IterPair*, DyDict_IterFree> iter = DyDict_Iter(obj);
-
-        if (!iter)
+        DyDict_Iterator iter;
+        if (!DyDict_IterInit(&iter, obj))
             throw_exception();
-        if (!*iter)
-            return Mapping();
 
         Mapping result;
-        do
-        {
-            result.insert(convert<typename Mapping::key_type>::to_value((*iter)->key),
-                convert<typename Mapping::mapped_type>::to_value((*iter)->value));
-        }
-        while (DyDict_IterNext(iter));
+        for (; iter.entry; DyDict_IterNext(&iter.entry))
+            result.insert(convert<typename Mapping::key_type>::to_value(iter.entry->key),
+                convert<typename Mapping::mapped_type>::to_value(iter.entry->value));
 
         return result;
     }
@@ -0,0 +1,918 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "array_p.h"
+#include "list_p.h"
+#include "region_p.h"
+#include "exceptions.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+static const char *const kind_names[] = {
+    "int64",
+    "double",
+    "bytes",
+};
+
+static inline bool check_kind(const char *fname, DyArrayKind kind)
+{
+    if (kind < DY_ARRAY_INT64 || kind > DY_ARRAY_BYTES)
+    {
+        DyErr_Format(DY_ERRID_ARGUMENT_TYPE, "%s(): Invalid array kind %d", fname, (int)kind);
+        return_error(false);
+    }
+    return true;
+}
+
+bool DyArray_Check(DyObject *self)
+{
+    return self->type == DY_ARRAY;
+}
+
+DyArrayObject *array_new(DyArrayKind kind, size_t size)
+{
+    if (size > (SIZE_MAX - sizeof(DyArrayObject)) / array_itemsize(kind))
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    DyArrayObject *self = object_malloc(sizeof(DyArrayObject) + size * array_itemsize(kind));
+    if (!self)
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    object_init((DyObject *)self, DY_ARRAY);
+    self->kind = kind;
+    self->size = size;
+    self->data = self->storage;
+    self->buffer = NULL;
+    self->destroy = NULL;
+    return self;
+}
+
+DyArrayObject *array_realloc(DyArrayObject *self, size_t size)
+{
+    assert(self->data == self->storage && (self->refcnt == 1 || region_owns((DyObject *)self)));
+
+    if (size > (SIZE_MAX - sizeof(DyArrayObject)) / array_itemsize(self->kind))
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    DyArrayObject *moved = object_realloc((DyObject *)self, self,
+                                          sizeof(DyArrayObject) + self->size * array_itemsize(self->kind),
+                                          sizeof(DyArrayObject) + size * array_itemsize(self->kind));
+    if (!moved)
+        return_null;
+
+    moved->data = moved->storage;
+    moved->size = size;
+    return moved;
+}
+
+void array_destroy(DyArrayObject *self)
+{
+    if (self->destroy)
+        self->destroy(self->buffer);
+}
+
+DyObject *DyArray_New(DyArrayKind kind, size_t size)
+{
+    if (!check_kind("DyArray_New", kind))
+        return_null;
+
+    DyArrayObject *self = array_new(kind, size);
+    if (!self)
+        return_null;
+
+    memset(self->data, 0, size * array_itemsize(kind));
+    return (DyObject *)self;
+}
+
+DyObject *DyArray_FromData(DyArrayKind kind, const void *data, size_t size)
+{
+    if (!check_kind("DyArray_FromData", kind))
+        return_null;
+
+    DyArrayObject *self = array_new(kind, size);
+    if (!self)
+        return_null;
+
+    if (size)
+        memcpy(self->data, data, size * array_itemsize(kind));
+    return (DyObject *)self;
+}
+
+DyObject *DyArray_FromBuffer(DyArrayKind kind, void *data, size_t size,
+                             void *buffer, DyDataDestructor destroy)
+{
+    DyArrayObject *self = NULL;
+    if (check_kind("DyArray_FromBuffer", kind))
+    {
+        self = object_malloc(sizeof(DyArrayObject));
+        if (!self)
+            DyErr_SetMemoryError();
+    }
+
+    if (!self)
+    {
+        if (destroy)
+            destroy(buffer);
+        return_null;
+    }
+
+    object_init((DyObject *)self, DY_ARRAY);
+    self->kind = kind;
+    self->size = size;
+    self->data = data;
+    self->buffer = buffer;
+    self->destroy = destroy;
+    return (DyObject *)self;
+}
+
+DyArrayKind DyArray_Kind(DyObject *self)
+{
+    if (DyErr_CheckArg("DyArray_Kind", 0, DY_ARRAY, self))
+        return_error(DY_ARRAY_INVALID);
+
+    return ((DyArrayObject *)self)->kind;
+}
+
+void *DyArray_Data(DyObject *self, size_t *size)
+{
+    if (DyErr_CheckArg("DyArray_Data", 0, DY_ARRAY, self))
+        return_null;
+
+    if (size)
+        *size = ((DyArrayObject *)self)->size;
+    return ((DyArrayObject *)self)->data;
+}
+
+
+// Elements --------------------------------------------------------------------
+static inline int64_t load_long(DyArrayObject *self, size_t i)
+{
+    switch (self->kind)
+    {
+    case DY_ARRAY_INT64:
+        return ((int64_t *)self->data)[i];
+    case DY_ARRAY_DOUBLE:
+        return (int64_t)((double *)self->data)[i];
+    default:
+        return ((uint8_t *)self->data)[i];
+    }
+}
+
+static inline double load_float(DyArrayObject *self, size_t i)
+{
+    switch (self->kind)
+    {
+    case DY_ARRAY_INT64:
+        return (double)((int64_t *)self->data)[i];
+    case DY_ARRAY_DOUBLE:
+        return ((double *)self->data)[i];
+    default:
+        return ((uint8_t *)self->data)[i];
+    }
+}
+
+static DyObject *load_item(DyArrayObject *self, size_t i)
+{
+    if (self->kind == DY_ARRAY_DOUBLE)
+        return DyFloat_New(((double *)self->data)[i]);
+    return DyLong_New(load_long(self, i));
+}
+
+// Convert a value to the element type, storing it at out
+static bool element_from_long(DyArrayKind kind, int64_t value, void *out)
+{
+    switch (kind)
+    {
+    case DY_ARRAY_INT64:
+        *(int64_t *)out = value;
+        return true;
+    case DY_ARRAY_DOUBLE:
+        *(double *)out = (double)value;
+        return true;
+    default:
+        if (value < 0 || value > UINT8_MAX)
+        {
+            DyErr_Format(DY_ERRID_VALUE_ERROR, "%lld doesn't fit in a bytes array", (long long)value);
+            return_error(false);
+        }
+        *(uint8_t *)out = (uint8_t)value;
+        return true;
+    }
+}
+
+static bool element_from_float(DyArrayKind kind, double value, void *out)
+{
+    if (kind == DY_ARRAY_DOUBLE)
+    {
+        *(double *)out = value;
+        return true;
+    }
+
+    // Also false for NaN
+    if (!(value >= -0x1p63 && value < 0x1p63) || value != (double)(int64_t)value)
+    {
+        DyErr_Format(DY_ERRID_VALUE_ERROR, "%f doesn't fit in a %s array", value, kind_names[kind]);
+        return_error(false);
+    }
+
+    return element_from_long(kind, (int64_t)value, out);
+}
+
+static bool element_from_object(DyArrayKind kind, DyObject *value, void *out)
+{
+    if (value->type == DY_LONG)
+        return element_from_long(kind, DyLong_Get(value), out);
+    if (value->type == DY_FLOAT && kind == DY_ARRAY_DOUBLE)
+        return element_from_float(kind, DyFloat_Get(value), out);
+
+    DyErr_Format(DY_ERRID_TYPE_ERROR, "%s arrays can't hold %s objects",
+                 kind_names[kind], Dy_GetTypeName(value->type));
+    return_error(false);
+}
+
+static inline void *element_at(DyArrayObject *self, size_t i)
+{
+    return (char *)self->data + i * array_itemsize(self->kind);
+}
+
+static inline bool array_index(DyArrayObject *self, ssize_t *index)
+{
+    if (*index < 0)
+        *index += self->size;
+
+    if (*index < 0 || (size_t)*index >= self->size)
+    {
+        DyErr_Set(DY_ERRID_INDEX_ERROR, "Array index out of range");
+        return_error(false);
+    }
+    return true;
+}
+
+bool DyArray_GetLong(DyObject *self, ssize_t index, int64_t *value)
+{
+    if (DyErr_CheckArg("DyArray_GetLong", 0, DY_ARRAY, self)
+     || !array_index((DyArrayObject *)self, &index))
+        return_error(false);
+
+    *value = load_long((DyArrayObject *)self, index);
+    return true;
+}
+
+bool DyArray_GetFloat(DyObject *self, ssize_t index, double *value)
+{
+    if (DyErr_CheckArg("DyArray_GetFloat", 0, DY_ARRAY, self)
+     || !array_index((DyArrayObject *)self, &index))
+        return_error(false);
+
+    *value = load_float((DyArrayObject *)self, index);
+    return true;
+}
+
+DyObject *DyArray_GetItem(DyObject *self, ssize_t index)
+{
+    if (DyErr_CheckArg("DyArray_GetItem", 0, DY_ARRAY, self)
+     || !array_index((DyArrayObject *)self, &index))
+        return_null;
+
+    return load_item((DyArrayObject *)self, index);
+}
+
+bool DyArray_SetLong(DyObject *self, ssize_t index, int64_t value)
+{
+    if (DyErr_CheckArg("DyArray_SetLong", 0, DY_ARRAY, self)
+     || !array_index((DyArrayObject *)self, &index))
+        return_error(false);
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    return element_from_long(array->kind, value, element_at(array, index));
+}
+
+bool DyArray_SetFloat(DyObject *self, ssize_t index, double value)
+{
+    if (DyErr_CheckArg("DyArray_SetFloat", 0, DY_ARRAY, self)
+     || !array_index((DyArrayObject *)self, &index))
+        return_error(false);
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    return element_from_float(array->kind, value, element_at(array, index));
+}
+
+
+// Conversion ------------------------------------------------------------------
+DyObject *DyArray_FromList(DyObject *list, DyArrayKind kind)
+{
+    if (DyErr_CheckArg("DyArray_FromList", 0, DY_LIST, list)
+     || !check_kind("DyArray_FromList", kind))
+        return_null;
+
+    DyListObject *lo = (DyListObject *)list;
+    DyArrayObject *self = array_new(kind, lo->size);
+    if (!self)
+        return_null;
+
+    for (size_t i = 0; i < lo->size; ++i)
+    {
+        if (!element_from_object(kind, lo->items[i], element_at(self, i)))
+        {
+            Dy_Release((DyObject *)self);
+            return_null;
+        }
+    }
+
+    return (DyObject *)self;
+}
+
+DyObject *DyArray_ToList(DyObject *self)
+{
+    if (DyErr_CheckArg("DyArray_ToList", 0, DY_ARRAY, self))
+        return_null;
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    DyObject *list = DyList_NewEx(array->size);
+    if (!list)
+        return_null;
+
+    for (size_t i = 0; i < array->size; ++i)
+    {
+        DyObject *item = load_item(array, i);
+        if (!item || !DyList_Append(list, item))
+        {
+            if (item)
+                Dy_Release(item);
+            Dy_Release(list);
+            return_null;
+        }
+        Dy_Release(item);
+    }
+
+    return list;
+}
+
+DyObject *DyArray_Copy(DyObject *self)
+{
+    if (DyErr_CheckArg("DyArray_Copy", 0, DY_ARRAY, self))
+        return_null;
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    return DyArray_FromData(array->kind, array->data, array->size);
+}
+
+
+// Reductions ------------------------------------------------------------------
+// The SSE2 kernels and their scalar fallbacks add up in the same lanes,
+// so the floating point results don't depend on the build.
+
+static int64_t sum_int64(const int64_t *a, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_epi64(acc0, _mm_loadu_si128((const __m128i *)(a + i)));
+        acc1 = _mm_add_epi64(acc1, _mm_loadu_si128((const __m128i *)(a + i + 2)));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; i < n; ++i)
+        sum += (uint64_t)a[i];
+    return (int64_t)sum;
+}
+
+static double sum_double(const double *a, size_t n)
+{
+    double lanes[4] = {0, 0, 0, 0};
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    _mm_storeu_pd(lanes, acc0);
+    _mm_storeu_pd(lanes + 2, acc1);
+#else
+    for (; i + 4 <= n; i += 4)
+        for (size_t l = 0; l < 4; ++l)
+            lanes[l] += a[i + l];
+#endif
+
+    double sum = (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+    for (; i < n; ++i)
+        sum += a[i];
+    return sum;
+}
+
+static int64_t sum_bytes(const uint8_t *a, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // The sum of absolute differences to 0 adds up 8 bytes at a time
+    __m128i zero = _mm_setzero_si128(), acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)), zero));
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; i < n; ++i)
+        sum += a[i];
+    return (int64_t)sum;
+}
+
+// SSE2 has no 64 bit integer comparison
+#define MINMAX_INT64(name, CMP) \
+static int64_t name(const int64_t *a, size_t n) \
+{ \
+    int64_t result = a[0]; \
+    for (size_t i = 1; i < n; ++i) \
+        if (a[i] CMP result) \
+            result = a[i]; \
+    return result; \
+}
+
+MINMAX_INT64(min_int64, <)
+MINMAX_INT64(max_int64, >)
+
+#ifdef __SSE2__
+#define MINMAX_DOUBLE_SSE2(vop) \
+    if (n >= 4) \
+    { \
+        __m128d acc0 = _mm_loadu_pd(a), acc1 = _mm_loadu_pd(a + 2); \
+        for (i = 4; i + 4 <= n; i += 4) \
+        { \
+            acc0 = vop(acc0, _mm_loadu_pd(a + i)); \
+            acc1 = vop(acc1, _mm_loadu_pd(a + i + 2)); \
+        } \
+        double lanes[2]; \
+        _mm_storeu_pd(lanes, vop(acc0, acc1)); \
+        result = _mm_cvtsd_f64(vop(_mm_set_sd(lanes[0]), _mm_set_sd(lanes[1]))); \
+    }
+#else
+#define MINMAX_DOUBLE_SSE2(vop)
+#endif
+
+#define MINMAX_DOUBLE(name, vop, CMP) \
+static double name(const double *a, size_t n) \
+{ \
+    double result = a[0]; \
+    size_t i = 1; \
+    MINMAX_DOUBLE_SSE2(vop) \
+    for (; i < n; ++i) \
+        if (a[i] CMP result) \
+            result = a[i]; \
+    return result; \
+}
+
+MINMAX_DOUBLE(min_double, _mm_min_pd, <)
+MINMAX_DOUBLE(max_double, _mm_max_pd, >)
+
+#ifdef __SSE2__
+#define MINMAX_BYTES_SSE2(vop) \
+    if (n >= 16) \
+    { \
+        __m128i acc = _mm_loadu_si128((const __m128i *)a); \
+        for (i = 16; i + 16 <= n; i += 16) \
+            acc = vop(acc, _mm_loadu_si128((const __m128i *)(a + i))); \
+        acc = vop(acc, _mm_srli_si128(acc, 8)); \
+        acc = vop(acc, _mm_srli_si128(acc, 4)); \
+        acc = vop(acc, _mm_srli_si128(acc, 2)); \
+        acc = vop(acc, _mm_srli_si128(acc, 1)); \
+        result = (uint8_t)_mm_cvtsi128_si32(acc); \
+    }
+#else
+#define MINMAX_BYTES_SSE2(vop)
+#endif
+
+#define MINMAX_BYTES(name, vop, CMP) \
+static int64_t name(const uint8_t *a, size_t n) \
+{ \
+    uint8_t result = a[0]; \
+    size_t i = 1; \
+    MINMAX_BYTES_SSE2(vop) \
+    for (; i < n; ++i) \
+        if (a[i] CMP result) \
+            result = a[i]; \
+    return result; \
+}
+
+MINMAX_BYTES(min_bytes, _mm_min_epu8, <)
+MINMAX_BYTES(max_bytes, _mm_max_epu8, >)
+
+static int64_t dot_int64(const int64_t *a, const int64_t *b, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += (uint64_t)a[i] * (uint64_t)b[i];
+    return (int64_t)sum;
+}
+
+static double dot_double(const double *a, const double *b, size_t n)
+{
+    double lanes[4] = {0, 0, 0, 0};
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    _mm_storeu_pd(lanes, acc0);
+    _mm_storeu_pd(lanes + 2, acc1);
+#else
+    for (; i + 4 <= n; i += 4)
+        for (size_t l = 0; l < 4; ++l)
+            lanes[l] += a[i + l] * b[i + l];
+#endif
+
+    double sum = (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+    for (; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static int64_t dot_bytes(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Widen to 16 bits and multiply-add pairs; each 32 bit lane stays below 2^18
+    __m128i zero = _mm_setzero_si128(), acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i s = _mm_add_epi32(
+            _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero)),
+            _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero)));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(s, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(s, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; i < n; ++i)
+        sum += (uint64_t)a[i] * b[i];
+    return (int64_t)sum;
+}
+
+DyObject *DyArray_Sum(DyObject *self)
+{
+    if (DyErr_CheckArg("DyArray_Sum", 0, DY_ARRAY, self))
+        return_null;
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    switch (array->kind)
+    {
+    case DY_ARRAY_INT64:
+        return DyLong_New(sum_int64(array->data, array->size));
+    case DY_ARRAY_DOUBLE:
+        return DyFloat_New(sum_double(array->data, array->size));
+    default:
+        return DyLong_New(sum_bytes(array->data, array->size));
+    }
+}
+
+static inline bool check_not_empty(const char *fname, DyArrayObject *self)
+{
+    if (!self->size)
+    {
+        DyErr_Format(DY_ERRID_VALUE_ERROR, "%s(): Empty array", fname);
+        return_error(false);
+    }
+    return true;
+}
+
+DyObject *DyArray_Min(DyObject *self)
+{
+    if (DyErr_CheckArg("DyArray_Min", 0, DY_ARRAY, self)
+     || !check_not_empty("DyArray_Min", (DyArrayObject *)self))
+        return_null;
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    switch (array->kind)
+    {
+    case DY_ARRAY_INT64:
+        return DyLong_New(min_int64(array->data, array->size));
+    case DY_ARRAY_DOUBLE:
+        return DyFloat_New(min_double(array->data, array->size));
+    default:
+        return DyLong_New(min_bytes(array->data, array->size));
+    }
+}
+
+DyObject *DyArray_Max(DyObject *self)
+{
+    if (DyErr_CheckArg("DyArray_Max", 0, DY_ARRAY, self)
+     || !check_not_empty("DyArray_Max", (DyArrayObject *)self))
+        return_null;
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    switch (array->kind)
+    {
+    case DY_ARRAY_INT64:
+        return DyLong_New(max_int64(array->data, array->size));
+    case DY_ARRAY_DOUBLE:
+        return DyFloat_New(max_double(array->data, array->size));
+    default:
+        return DyLong_New(max_bytes(array->data, array->size));
+    }
+}
+
+// Both arguments must be arrays of the same kind and size
+static bool check_operands(const char *fname, DyObject *self, DyObject *other)
+{
+    if (DyErr_CheckArg(fname, 0, DY_ARRAY, self)
+     || DyErr_CheckArg(fname, 1, DY_ARRAY, other))
+        return_error(false);
+
+    DyArrayObject *a = (DyArrayObject *)self, *b = (DyArrayObject *)other;
+    if (a->kind != b->kind)
+    {
+        DyErr_Format(DY_ERRID_TYPE_ERROR, "%s(): Can't combine %s and %s arrays",
+                     fname, kind_names[a->kind], kind_names[b->kind]);
+        return_error(false);
+    }
+
+    if (a->size != b->size)
+    {
+        DyErr_Format(DY_ERRID_VALUE_ERROR, "%s(): Array sizes differ (%zu and %zu)",
+                     fname, a->size, b->size);
+        return_error(false);
+    }
+
+    return true;
+}
+
+DyObject *DyArray_Dot(DyObject *self, DyObject *other)
+{
+    if (!check_operands("DyArray_Dot", self, other))
+        return_null;
+
+    DyArrayObject *a = (DyArrayObject *)self, *b = (DyArrayObject *)other;
+    switch (a->kind)
+    {
+    case DY_ARRAY_INT64:
+        return DyLong_New(dot_int64(a->data, b->data, a->size));
+    case DY_ARRAY_DOUBLE:
+        return DyFloat_New(dot_double(a->data, b->data, a->size));
+    default:
+        return DyLong_New(dot_bytes(a->data, b->data, a->size));
+    }
+}
+
+
+// Element-wise operations -----------------------------------------------------
+// The second operand is either an array (step 1) or a single value (step 0).
+
+#ifdef __SSE2__
+#define APPLY_SSE2(width, load, store, vop) \
+    for (; i + width <= n; i += width) \
+        store(a + i, vop(load(a + i), step ? load(b + i) : value));
+#endif
+
+#define APPLY_SCALAR(T, U, OP) \
+    for (; i < n; ++i) \
+        a[i] = (T)((U)a[i] OP (U)b[i * step]);
+
+static void apply_double(double *a, const double *b, size_t step, size_t n, DyArrayOp op)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    if (n >= 2)
+    {
+        __m128d value = _mm_set1_pd(*b);
+        switch (op)
+        {
+        case DY_ARRAY_ADD: APPLY_SSE2(2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd) break;
+        case DY_ARRAY_SUB: APPLY_SSE2(2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd) break;
+        case DY_ARRAY_MUL: APPLY_SSE2(2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd) break;
+        case DY_ARRAY_DIV: APPLY_SSE2(2, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd) break;
+        }
+    }
+#endif
+
+    switch (op)
+    {
+    case DY_ARRAY_ADD: APPLY_SCALAR(double, double, +) break;
+    case DY_ARRAY_SUB: APPLY_SCALAR(double, double, -) break;
+    case DY_ARRAY_MUL: APPLY_SCALAR(double, double, *) break;
+    case DY_ARRAY_DIV: APPLY_SCALAR(double, double, /) break;
+    }
+}
+
+#ifdef __SSE2__
+#define load_si128(p) _mm_loadu_si128((const __m128i *)(p))
+#define store_si128(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#endif
+
+// Integers wrap around, so they're computed unsigned.
+// Division by zero was ruled out before.
+static void apply_int64(int64_t *a, const int64_t *b, size_t step, size_t n, DyArrayOp op)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    if (n >= 2)
+    {
+        __m128i value = _mm_set1_epi64x(*b);
+        switch (op)
+        {
+        case DY_ARRAY_ADD: APPLY_SSE2(2, load_si128, store_si128, _mm_add_epi64) break;
+        case DY_ARRAY_SUB: APPLY_SSE2(2, load_si128, store_si128, _mm_sub_epi64) break;
+        default: break;
+        }
+    }
+#endif
+
+    switch (op)
+    {
+    case DY_ARRAY_ADD: APPLY_SCALAR(int64_t, uint64_t, +) break;
+    case DY_ARRAY_SUB: APPLY_SCALAR(int64_t, uint64_t, -) break;
+    case DY_ARRAY_MUL: APPLY_SCALAR(int64_t, uint64_t, *) break;
+    case DY_ARRAY_DIV:
+        // INT64_MIN / -1 overflows
+        for (; i < n; ++i)
+            a[i] = b[i * step] == -1 ? (int64_t)(0 - (uint64_t)a[i]) : a[i] / b[i * step];
+        break;
+    }
+}
+
+static void apply_bytes(uint8_t *a, const uint8_t *b, size_t step, size_t n, DyArrayOp op)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    if (n >= 16)
+    {
+        __m128i value = _mm_set1_epi8((char)*b);
+        switch (op)
+        {
+        case DY_ARRAY_ADD: APPLY_SSE2(16, load_si128, store_si128, _mm_add_epi8) break;
+        case DY_ARRAY_SUB: APPLY_SSE2(16, load_si128, store_si128, _mm_sub_epi8) break;
+        default: break;
+        }
+    }
+#endif
+
+    switch (op)
+    {
+    case DY_ARRAY_ADD: APPLY_SCALAR(uint8_t, unsigned, +) break;
+    case DY_ARRAY_SUB: APPLY_SCALAR(uint8_t, unsigned, -) break;
+    case DY_ARRAY_MUL: APPLY_SCALAR(uint8_t, unsigned, *) break;
+    case DY_ARRAY_DIV: APPLY_SCALAR(uint8_t, unsigned, /) break;
+    }
+}
+
+static bool apply(const char *fname, DyArrayObject *self, DyArrayOp op, const void *b, size_t step)
+{
+    if (op < DY_ARRAY_ADD || op > DY_ARRAY_DIV)
+    {
+        DyErr_Format(DY_ERRID_ARGUMENT_TYPE, "%s(): Invalid array operation %d", fname, (int)op);
+        return_error(false);
+    }
+
+    // Check the divisors before touching anything
+    size_t count = step ? self->size : self->size != 0;
+    if (op == DY_ARRAY_DIV && self->kind != DY_ARRAY_DOUBLE)
+    {
+        bool zero = false;
+        if (self->kind == DY_ARRAY_BYTES)
+            zero = count && memchr(b, 0, count);
+        else
+            for (size_t i = 0; i < count && !zero; ++i)
+                zero = ((const int64_t *)b)[i] == 0;
+
+        if (zero)
+        {
+            DyErr_Format(DY_ERRID_VALUE_ERROR, "%s(): Integer division by zero", fname);
+            return_error(false);
+        }
+    }
+
+    switch (self->kind)
+    {
+    case DY_ARRAY_INT64:
+        apply_int64(self->data, b, step, self->size, op);
+        break;
+    case DY_ARRAY_DOUBLE:
+        apply_double(self->data, b, step, self->size, op);
+        break;
+    default:
+        apply_bytes(self->data, b, step, self->size, op);
+        break;
+    }
+    return true;
+}
+
+bool DyArray_Apply(DyObject *self, DyArrayOp op, DyObject *other)
+{
+    if (!check_operands("DyArray_Apply", self, other))
+        return_error(false);
+
+    return apply("DyArray_Apply", (DyArrayObject *)self, op, ((DyArrayObject *)other)->data, 1);
+}
+
+bool DyArray_ApplyScalar(DyObject *self, DyArrayOp op, DyObject *value)
+{
+    if (DyErr_CheckArg("DyArray_ApplyScalar", 0, DY_ARRAY, self))
+        return_error(false);
+
+    DyArrayObject *array = (DyArrayObject *)self;
+    union { int64_t l; double d; uint8_t b; } element;
+    if (!element_from_object(array->kind, value, &element))
+        return_error(false);
+
+    return apply("DyArray_ApplyScalar", array, op, &element, 0);
+}
+
+
+// Comparison and repr ---------------------------------------------------------
+bool array_equals(DyArrayObject *a, DyArrayObject *b)
+{
+    if (a->kind != b->kind || a->size != b->size)
+        return false;
+
+    if (a->kind != DY_ARRAY_DOUBLE)
+        return !a->size || !memcmp(a->data, b->data, a->size * array_itemsize(a->kind));
+
+    // 0.0 == -0.0 and NaN != NaN
+    const double *x = a->data, *y = b->data;
+    for (size_t i = 0; i < a->size; ++i)
+        if (x[i] != y[i])
+            return false;
+    return true;
+}
+
+#include "stringbuilder.h"
+
+bool array_sbrepr(DyStringBuilder *sb, DyArrayObject *self)
+{
+    if (!DyStringBuilder_Printf(sb, "<Array %s [", kind_names[self->kind]))
+        return_error(false);
+
+    for (size_t i = 0; i < (self->size < 20 ? self->size : 20); ++i)
+    {
+        if (i && !DyStringBuilder_Append(sb, ", ", 2))
+            return_error(false);
+
+        bool ok = self->kind == DY_ARRAY_DOUBLE
+            ? DyStringBuilder_AppendFloat(sb, ((double *)self->data)[i])
+            : DyStringBuilder_AppendLong(sb, load_long(self, i));
+        if (!ok)
+            return_error(false);
+    }
+
+    if (self->size > 20 && !DyStringBuilder_Append(sb, ", ...", 5))
+        return_error(false);
+
+    return DyStringBuilder_Append(sb, "]>", 2);
+}
@@ -0,0 +1,238 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file libdy/array.h
+ * @brief Typed arrays
+ *
+ * Arrays hold numbers of one kind packed in a contiguous buffer instead of
+ * boxing each one in its own object like lists do. Reductions and
+ * element-wise operations run over the raw buffer.
+ */
+
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h> // ssize_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/// Element types of arrays
+typedef enum _DyArrayKind
+{
+    DY_ARRAY_INVALID = -1,
+    DY_ARRAY_INT64,     ///< int64_t
+    DY_ARRAY_DOUBLE,    ///< double
+    DY_ARRAY_BYTES,     ///< uint8_t
+} DyArrayKind;
+
+/// Element-wise operations
+typedef enum _DyArrayOp
+{
+    DY_ARRAY_ADD,
+    DY_ARRAY_SUB,
+    DY_ARRAY_MUL,
+    DY_ARRAY_DIV,       ///< Integer arrays raise on division by zero
+} DyArrayOp;
+
+
+// ----------------------------------------------------------------------------
+///@{
+///@name Arrays
+LIBDY_API bool DyArray_Check(DyObject *obj);
+
+/**
+ * @brief Create a zero-filled array
+ * @param kind The element type
+ * @param size The number of elements
+ * @return New reference to an array object
+ */
+LIBDY_API DyObject *DyArray_New(DyArrayKind kind, size_t size);
+
+/**
+ * @brief Create an array from a copy of a C array
+ * @param kind The element type
+ * @param data The elements
+ * @param size The number of elements
+ * @return New reference to an array object
+ */
+LIBDY_API DyObject *DyArray_FromData(DyArrayKind kind, const void *data, size_t size);
+
+/**
+ * @brief Create an array using a C array in place
+ * @param kind The element type
+ * @param data The elements. Operations modifying the array write to it.
+ * @param size The number of elements
+ * @param buffer Passed to @p destroy
+ * @param destroy Called with @p buffer once the array is destroyed.
+ *        If NULL, data must stay valid for as long as the array is used.
+ * @return New reference to an array object. If it can't be created,
+ *         @p buffer is destroyed right away.
+ */
+LIBDY_API DyObject *DyArray_FromBuffer(DyArrayKind kind, void *data, size_t size,
+                                       void *buffer, DyDataDestructor destroy);
+
+/**
+ * @brief Create an array from the numbers in a list
+ * @param list The list object
+ * @param kind The element type. Double arrays take integers and floats,
+ *        the others only take integers that fit.
+ * @return New reference to an array object
+ */
+LIBDY_API DyObject *DyArray_FromList(DyObject *list, DyArrayKind kind);
+
+/**
+ * @brief Create a list holding the elements of an array
+ * @param self The array object
+ * @return New reference to a list object
+ */
+LIBDY_API DyObject *DyArray_ToList(DyObject *self);
+
+/**
+ * @brief Copy an array into a new buffer
+ * @param self The array object
+ * @return New reference to an array object
+ */
+LIBDY_API DyObject *DyArray_Copy(DyObject *self);
+
+/**
+ * @brief Get the element type of an array
+ * @return The element type or DY_ARRAY_INVALID if @p self is not an array
+ */
+LIBDY_API DyArrayKind DyArray_Kind(DyObject *self);
+
+/**
+ * @brief Get the elements of an array
+ * @param self The array object
+ * @param size Variable to store the number of elements in
+ * @return The element buffer, NULL if @p self is not an array
+ */
+LIBDY_API void *DyArray_Data(DyObject *self, size_t *size);
+
+/**
+ * @brief Get an element as an integer
+ * @param self The array object
+ * @param index The element index; negative indices count from the end
+ * @param value Variable to store the value in. Doubles are truncated.
+ * @return Whether the index was in range
+ */
+LIBDY_API bool DyArray_GetLong(DyObject *self, ssize_t index, int64_t *value);
+
+/**
+ * @brief Get an element as a floating point number
+ * @sa DyArray_GetLong
+ */
+LIBDY_API bool DyArray_GetFloat(DyObject *self, ssize_t index, double *value);
+
+/**
+ * @brief Get an element as an object
+ * @param self The array object
+ * @param index The element index; negative indices count from the end
+ * @return New reference to an integer or float object
+ */
+LIBDY_API DyObject *DyArray_GetItem(DyObject *self, ssize_t index);
+
+/**
+ * @brief Set an element
+ * @param self The array object
+ * @param index The element index; negative indices count from the end
+ * @param value The new value; it must fit byte arrays
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool DyArray_SetLong(DyObject *self, ssize_t index, int64_t value);
+
+/**
+ * @brief Set an element
+ * @param self The array object
+ * @param index The element index; negative indices count from the end
+ * @param value The new value; integer arrays only take integral values
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool DyArray_SetFloat(DyObject *self, ssize_t index, double value);
+
+///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name Array Operations
+///@brief The reductions return integers for integer and byte arrays and
+/// floats for double arrays. Integer sums wrap around on overflow.
+/// Floating point sums are added up in several lanes, so their rounding
+/// may differ from a sequential loop.
+/**
+ * @brief Add up the elements of an array
+ * @param self The array object
+ * @return New reference to a number object
+ */
+LIBDY_API DyObject *DyArray_Sum(DyObject *self);
+
+/**
+ * @brief Find the smallest element of a non-empty array
+ * @return New reference to a number object
+ * @note The result is unspecified if a double array contains NaN
+ */
+LIBDY_API DyObject *DyArray_Min(DyObject *self);
+
+/**
+ * @brief Find the largest element of a non-empty array
+ * @return New reference to a number object
+ * @note The result is unspecified if a double array contains NaN
+ */
+LIBDY_API DyObject *DyArray_Max(DyObject *self);
+
+/**
+ * @brief Compute the dot product of two arrays
+ * @param self The first array object
+ * @param other An array of the same kind and size
+ * @return New reference to a number object
+ */
+LIBDY_API DyObject *DyArray_Dot(DyObject *self, DyObject *other);
+
+/**
+ * @brief Combine an array with another one in place
+ * @param self The array object, which receives the results
+ * @param op The operation
+ * @param other An array of the same kind and size
+ * @return Whether the operation succeeded
+ *
+ * Integer operations wrap around. Integer division truncates.
+ */
+LIBDY_API bool DyArray_Apply(DyObject *self, DyArrayOp op, DyObject *other);
+
+/**
+ * @brief Combine each element of an array with a number in place
+ * @param self The array object, which receives the results
+ * @param op The operation
+ * @param value An integer or float object; integer arrays only take integers
+ * @return Whether the operation succeeded
+ * @sa DyArray_Apply
+ */
+LIBDY_API bool DyArray_ApplyScalar(DyObject *self, DyArrayOp op, DyObject *value);
+
+///@}
+
+#ifdef __cplusplus
+}
+#endif
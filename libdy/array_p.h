@@ -0,0 +1,54 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "array.h"
+#include "dy_p.h"
+
+/**
+ * @file array_p.h
+ * @brief Typed array implementation header
+ */
+
+typedef struct _DyArrayObject {
+    DyObject_HEAD
+    DyArrayKind kind;
+    size_t size;
+    void *data;             // storage, or a buffer from DyArray_FromBuffer
+    void *buffer;
+    DyDataDestructor destroy;
+    int64_t storage[];      // Elements owned by the array
+} DyArrayObject;
+
+static inline size_t array_itemsize(DyArrayKind kind)
+{
+    return kind == DY_ARRAY_BYTES ? 1 : 8;
+}
+
+DyArrayObject *array_new(DyArrayKind kind, size_t size);
+
+// Resize an array created by array_new() that nobody else refers to yet.
+// The object moves, its contents are kept.
+DyArrayObject *array_realloc(DyArrayObject *self, size_t size);
+
+void array_destroy(DyArrayObject *self);
+
+bool array_equals(DyArrayObject *a, DyArrayObject *b);
+
+bool array_sbrepr(struct DyStringBuilder *sb, DyArrayObject *self);
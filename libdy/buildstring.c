@@ -186,6 +186,30 @@ dy_buildstring_t *dy_buildstring_append2(dy_buildstring_t *bs, DyObject *str)
 
     DyStringObject *so = (DyStringObject *)str;
 
+    // The part can't lead back to a view, so views are copied
+    if (so->flags & DYSTRING_VIEW)
+    {
+        char *copy = dy_malloc(so->size);
+        if (!copy)
+        {
+            DyErr_SetMemoryError();
+            return_null;
+        }
+        memcpy(copy, string_data(so), so->size);
+
+        dy_buildstring_t *nbs = dy_buildstring_new(copy, so->size);
+        if (!nbs)
+        {
+            dy_free(copy);
+            DyErr_SetMemoryError();
+            return_null;
+        }
+
+        nbs->free_part = (dy_buildstring_part_free_fn) dy_free;
+        bs_add(bs, nbs);
+        return nbs;
+    }
+
     dy_buildstring_t *nbs = dy_buildstring_new(so->data, so->size);
     if (!nbs)
     {
@@ -203,5 +227,11 @@ dy_buildstring_t *dy_buildstring_append2(dy_buildstring_t *bs, DyObject *str)
 
 dy_buildstring_t *dy_buildstring_repr(dy_buildstring_t *bs, DyObject *s)
 {
-    return bsrepr(bs, s);
+    DyObject *repr = Dy_Repr(s);
+    if (!repr)
+        return_null;
+
+    dy_buildstring_t *nbs = dy_buildstring_append2(bs, repr);
+    Dy_Release(repr);
+    return nbs;
 }
@@ -18,9 +18,10 @@
 
 /**
  * @file collections.h
- * @brief Item collections (list, dict)
+ * @brief Item collections (list, dict, deque)
  *
- * libdy provides 2 types of collections: lists and dictionaries (mappings)
+ * libdy provides 3 types of collections: lists, dictionaries (mappings)
+ * and double-ended queues
  */
 
 #pragma once
@@ -29,6 +30,7 @@
 #include "config.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h> // ssize_t; TODO: find portable solution
 
 #ifdef __cplusplus
@@ -79,6 +81,185 @@ LIBDY_API bool      DyList_Insert(DyObject *self, ssize_t where, DyObject *value
  */
 LIBDY_API bool      DyList_Append(DyObject *self, DyObject *value);
 
+/**
+ * @brief Append all items of another list
+ * @param self The list object
+ * @param other The list to take the items from; may be @p self
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyList_Extend(DyObject *self, DyObject *other);
+
+/**
+ * @brief Copy a range of items into a new list
+ * @param self The list object
+ * @param start The first index; negative indices count from the end
+ * @param stop The index after the last; bounds are clamped like in Python
+ * @return A new list object
+ */
+LIBDY_API DyObject *DyList_GetSlice(DyObject *self, ssize_t start, ssize_t stop);
+
+/**
+ * @brief Replace a range of items by the items of another list
+ * @param self The list object
+ * @param start The first index
+ * @param stop The index after the last
+ * @param items The list holding the new items; may be @p self
+ * @return Whether the operation succeeded
+ * @sa DyList_GetSlice
+ */
+LIBDY_API bool      DyList_SetSlice(DyObject *self, ssize_t start, ssize_t stop, DyObject *items);
+
+/**
+ * @brief Remove a range of items
+ * @param self The list object
+ * @param start The first index
+ * @param stop The index after the last
+ * @return Whether the operation succeeded
+ * @sa DyList_GetSlice
+ */
+LIBDY_API bool      DyList_DelSlice(DyObject *self, ssize_t start, ssize_t stop);
+
+/**
+ * @brief Remove an item and return it
+ * @param self The list object
+ * @param index The item index; -1 for the last one
+ * @return The list's reference to the item, which now belongs to the caller
+ */
+LIBDY_API DyObject *DyList_Pop(DyObject *self, ssize_t index);
+
+/**
+ * @brief Remove the first item that equals a value
+ * @param self The list object
+ * @param value The value
+ * @return Whether an item was removed
+ * @sa Dy_Equals
+ */
+LIBDY_API bool      DyList_Remove(DyObject *self, DyObject *value);
+
+/**
+ * @brief Reverse the order of the items in place
+ * @param self The list object
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyList_Reverse(DyObject *self);
+
+/**
+ * @brief Compare two items (or their keys) for sorting
+ * @return Less than 0 if @p a goes first, more than 0 if @p b goes first,
+ *         0 if they are equal
+ *
+ * Comparators are called from several threads at once when sorting long
+ * lists, and they can't raise errors.
+ * @sa DyHost_SetSortThreads
+ */
+typedef int (*DyList_CompareFn)(DyObject *a, DyObject *b, void *data);
+
+/**
+ * @brief Get the key an item is sorted by
+ * @return New reference to the key, NULL on error
+ */
+typedef DyObject *(*DyList_KeyFn)(DyObject *item, void *data);
+
+/**
+ * @brief Sort a list in place
+ * @param self The list object
+ * @param key Function getting the key of an item, called once per item.
+ *        If NULL, items are their own keys.
+ * @param compare Function comparing two keys. If NULL, the keys must be all
+ *        strings, which are compared byte by byte, or all numbers.
+ * @param data Passed to @p key and @p compare
+ * @return Whether the operation succeeded. On errors, the list is left alone.
+ *
+ * The sort is stable. It takes advantage of items that are already in order.
+ * Long lists are sorted on several threads.
+ */
+LIBDY_API bool      DyList_Sort(DyObject *self, DyList_KeyFn key, DyList_CompareFn compare, void *data);
+
+///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name Deques
+///
+/// Deques keep their items in a ring buffer, adding and removing them at
+/// either end takes constant time. They are indexed like lists, so
+/// Dy_Length() and Dy_GetItemLong() walk them front to back.
+LIBDY_API bool      DyDeque_Check(DyObject *obj);
+
+/**
+ * @brief Create a new deque object
+ * @return A new libdy deque object
+ */
+LIBDY_API DyObject *DyDeque_New();
+
+/**
+ * @brief Create a new deque object holding at most a number of items
+ * @param maxlen The maximum number of items; 0 for no limit
+ * @return A new libdy deque object
+ *
+ * Once a bounded deque is full, pushing an item drops one from the
+ * other end.
+ */
+LIBDY_API DyObject *DyDeque_NewBounded(size_t maxlen);
+
+/**
+ * @brief Get the maximum number of items of a deque
+ * @return The limit, or 0 if the deque is unbounded
+ */
+LIBDY_API size_t    DyDeque_MaxLen(DyObject *self);
+
+/**
+ * @brief Add an item at the back
+ * @param self The deque object
+ * @param value The item
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyDeque_Push(DyObject *self, DyObject *value);
+
+/**
+ * @brief Add an item at the front
+ * @param self The deque object
+ * @param value The item
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyDeque_PushFront(DyObject *self, DyObject *value);
+
+/**
+ * @brief Remove the item at the back and return it
+ * @param self The deque object
+ * @return The deque's reference to the item, which now belongs to the caller
+ */
+LIBDY_API DyObject *DyDeque_Pop(DyObject *self);
+
+/**
+ * @brief Remove the item at the front and return it
+ * @param self The deque object
+ * @return The deque's reference to the item, which now belongs to the caller
+ */
+LIBDY_API DyObject *DyDeque_PopFront(DyObject *self);
+
+/**
+ * @brief Push all items of a list at the back
+ * @param self The deque object
+ * @param list The list to take the items from
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyDeque_Extend(DyObject *self, DyObject *list);
+
+/**
+ * @brief Move items from the front into a new list
+ * @param self The deque object
+ * @param max The maximum number of items to move; SIZE_MAX for all of them
+ * @return A new list object holding the items in order
+ */
+LIBDY_API DyObject *DyDeque_Drain(DyObject *self, size_t max);
+
+/**
+ * @brief Remove all items
+ * @param self The deque object
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyDeque_Clear(DyObject *self);
+
 ///@}
 // ----------------------------------------------------------------------------
 ///@{
@@ -99,6 +280,169 @@ LIBDY_API DyObject *DyDict_New();
  */
 LIBDY_API DyObject *DyDict_NewWithParent(DyObject *parent);
 
+/**
+ * @brief Create a new libdy dictionary that shares its key table
+ *
+ * Dictionaries created this way that receive the same string keys in the
+ * same order share a single key table and only store their values, which
+ * saves a lot of memory on collections of similar records.
+ * They are transparently converted to regular dictionaries when an item is
+ * deleted or a key that isn't a string is used.
+ * Inside a region, this creates a regular dictionary.
+ * @return A new libdy dictionary object
+ */
+LIBDY_API DyObject *DyDict_NewShared();
+
+/**
+ * @brief Intern string keys when they are inserted
+ *
+ * Dictionaries that only contain interned string keys can look up interned
+ * strings by comparing pointers. This makes sure string keys are interned.
+ * Dictionaries in a region don't intern their keys.
+ * @param self The dictionary
+ * @param enable Whether to intern new keys
+ * @return Whether the operation succeeded
+ * @sa DyString_Intern
+ */
+LIBDY_API bool      DyDict_SetInternKeys(DyObject *self, bool enable);
+
+/**
+ * @brief Create a new libdy dictionary with room for a number of items
+ * @param capacity The number of items to pre-allocate for
+ * @return A new libdy dictionary object
+ * @sa DyDict_New
+ */
+LIBDY_API DyObject *DyDict_NewEx(size_t capacity);
+
+/**
+ * @brief Create a new libdy dictionary from parallel arrays of keys and values
+ * @param keys The keys
+ * @param values The values
+ * @param n The number of items
+ * @return A new libdy dictionary object
+ * @note If a key occurs more than once, the last value wins.
+ */
+LIBDY_API DyObject *DyDict_FromArrays(DyObject **keys, DyObject **values, size_t n);
+
+/**
+ * @brief Copy all items of a dictionary into another one
+ * @param self The dictionary to update
+ * @param other The dictionary to take the items from
+ * @return Whether the operation succeeded
+ * @note Items @p other inherits from its parents are not copied.
+ */
+LIBDY_API bool      DyDict_Update(DyObject *self, DyObject *other);
+
+/**
+ * @brief Get an item, inserting a default value if it doesn't exist
+ * @param self The dictionary
+ * @param key The key
+ * @param def The value to insert if @p key doesn't exist
+ * @return A borrowed reference to the item
+ * @note Only looks at items the dictionary contains itself, not inherited ones.
+ */
+LIBDY_API DyObject *DyDict_SetDefault(DyObject *self, DyObject *key, DyObject *def);
+
+/**
+ * @brief Remove an item and return it
+ * @param self The dictionary
+ * @param key The key
+ * @param def The value to return if @p key doesn't exist, or NULL
+ * @return A new reference to the removed item or @p def
+ * @throw [dy.KeyError] when @p key doesn't exist and @p def is NULL
+ */
+LIBDY_API DyObject *DyDict_Pop(DyObject *self, DyObject *key, DyObject *def);
+
+/**
+ * @brief Callback computing the new value for DyDict_Upsert
+ * @param key The key
+ * @param value The current value (borrowed) or NULL if @p key doesn't exist
+ * @param data User data
+ * @return A new reference to the new value, or NULL with an exception set
+ */
+typedef DyObject *(*DyDict_UpsertFn)(DyObject *key, DyObject *value, void *data);
+
+/**
+ * @brief Insert or update an item based on its current value
+ *
+ * Looks up @p key once, passes the current value to @p fn and stores the
+ * result in the same place.
+ * @param self The dictionary
+ * @param key The key
+ * @param fn Computes the new value
+ * @param data User data passed to @p fn
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyDict_Upsert(DyObject *self, DyObject *key, DyDict_UpsertFn fn, void *data);
+
+/**
+ * @brief Call-site cache for DyDict_CachedGet
+ *
+ * Remembers where a key was found the last time. Initialize with
+ * DY_DICT_CACHE_INIT; the contents are private.
+ */
+typedef struct DyDict_Cache {
+    DyObject *dict;
+    DyObject *key;
+    uint64_t version;
+    size_t index;
+} DyDict_Cache;
+
+/// @brief Static initializer for a DyDict_Cache
+#define DY_DICT_CACHE_INIT { NULL, NULL, 0, 0 }
+
+/**
+ * @brief Look up a key, remembering where it was found
+ *
+ * If the same dictionary is asked for the same key object again and it
+ * wasn't modified in the meantime, the item is returned without hashing or
+ * probing. Works best with long-lived key objects such as DyKey strings.
+ * @param self The dictionary
+ * @param key The key to look up
+ * @param cache The cache for this call site
+ * @return A borrowed reference to the item || Dy_Undefined
+ * @note Only items the dictionary contains itself are cached, not inherited ones.
+ */
+LIBDY_API DyObject *DyDict_CachedGet(DyObject *self, DyObject *key, DyDict_Cache *cache);
+
+/**
+ * @brief Statistics of a dictionary lookup cache
+ * @sa DyDict_EnableLookupCache
+ */
+typedef struct DyDict_LookupCacheStats {
+    /// Inherited lookups answered by an up-to-date view
+    size_t hits;
+    /// Inherited lookups that had to rebuild the view first
+    size_t misses;
+    /// Items currently held by the view
+    size_t size;
+} DyDict_LookupCacheStats;
+
+/**
+ * @brief Resolve inherited items through a flattened view of all parents
+ *
+ * Normally, looking up a key that a dictionary doesn't contain itself
+ * probes every parent in turn. With the lookup cache enabled, the items of
+ * all parents are merged into a single table instead, so each lookup takes
+ * at most two probes. The view is rebuilt lazily whenever any parent was
+ * modified since it was last built.
+ * @param self The dictionary
+ * @return Whether the operation succeeded
+ * @warning Lookups on a dictionary with a cache modify the cache, so they
+ *          must not run concurrently with other lookups on the same dict.
+ * @note The view keeps references to the parents' keys and values until
+ *       it is rebuilt or the dictionary is destroyed.
+ */
+LIBDY_API bool      DyDict_EnableLookupCache(DyObject *self);
+
+/**
+ * @brief Get statistics about the lookup cache of a dictionary
+ * @param self The dictionary
+ * @param stats Where to store the statistics
+ * @return Whether the operation succeeded; FALSE if there is no cache
+ */
+LIBDY_API bool      DyDict_GetLookupCacheStats(DyObject *self, DyDict_LookupCacheStats *stats);
+
 /**
  * @brief Clear all items from a dictionary
  * @param self The dictionary
@@ -114,10 +458,62 @@ typedef struct DyDict_IterPair {
     DyObject *value;
 } DyDict_IterPair;
 
+/**
+ * @brief A dictionary iterator that doesn't need to be allocated
+ *
+ * Can live on the stack. Only @c entry is public.
+ * @code
+ * DyDict_Iterator it;
+ * if (!DyDict_IterInit(&it, dict))
+ *     return false;
+ * for (; it.entry; DyDict_IterNext(&it.entry))
+ *     do_something(it.entry->key, it.entry->value);
+ * @endcode
+ */
+typedef struct DyDict_Iterator {
+    /// The current item, or NULL when the iterator is finished
+    DyDict_IterPair *entry;
+
+    DyObject *dict;
+    size_t index;
+    DyDict_IterPair pair;
+} DyDict_Iterator;
+
+/**
+ * @brief Initialize a dictionary iterator
+ * @param it The iterator
+ * @param self The dictionary
+ * @return Whether the operation succeeded
+ * @note The iterator doesn't need to be freed; advance it with DyDict_IterNext(&it->entry).
+ * @warning Copying an iterator while it points to an item may leave the copy
+ *          referring to the original's storage.
+ */
+LIBDY_API bool DyDict_IterInit(DyDict_Iterator *it, DyObject *self);
+
+/**
+ * @brief Callback for DyDict_ForEach
+ * @param key The key (borrowed)
+ * @param value The value (borrowed)
+ * @param data User data
+ * @return FALSE to stop iterating
+ */
+typedef bool (*DyDict_ForEachFn)(DyObject *key, DyObject *value, void *data);
+
+/**
+ * @brief Call a function for every item in a dictionary
+ * @param self The dictionary
+ * @param fn The function
+ * @param data User data passed to @p fn
+ * @return FALSE if @p fn stopped the iteration or @p self isn't a dictionary
+ * @warning Modifying the dictionary from @p fn results in undefined behaviour!
+ */
+LIBDY_API bool DyDict_ForEach(DyObject *self, DyDict_ForEachFn fn, void *data);
+
 /**
  * @brief Create a dictionary iterator
  * @param self The dictionary
  * @note Returns a pointer to NULL if dictionary is empty!
+ * @sa DyDict_IterInit for an iterator that doesn't need to be allocated
  */
 LIBDY_API DyDict_IterPair **DyDict_Iter(DyObject *self);
 
@@ -201,6 +597,67 @@ LIBDY_API bool      Dy_Contains(DyObject *self, DyObject *key);
 LIBDY_API bool      Dy_ContainsString(DyObject *self, const char *key);
 LIBDY_API bool      Dy_ContainsLong(DyObject *self, long key);
 
+///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name Key Handles
+///@brief Pre-resolved string keys for fast repeated lookups
+/**
+ * @brief A string key that is resolved once and then reused
+ *
+ * Looking up a C string key means creating or finding the interned string
+ * object and hashing it on every call. A DyKey does this once, the first
+ * time it is used, and keeps the interned string and its hash, so every
+ * further lookup is a single probe that usually ends in a pointer comparison.
+ * @code
+ * static DyKey k_name = DY_KEY("name");
+ * DyObject *name = Dy_GetItemKeyU(record, &k_name);
+ * @endcode
+ */
+typedef struct DyKey {
+    /// The key text
+    const char *cstr;
+    /// The interned string; NULL until resolved
+    DyObject *str;
+    /// The hash of str
+    DyHash hash;
+} DyKey;
+
+/**
+ * @brief Static initializer for a DyKey
+ * @param cstr The key text. Must stay valid as long as the key is used.
+ */
+#define DY_KEY(cstr) { (cstr), NULL, 0 }
+
+/**
+ * @brief Initialize and resolve a DyKey
+ * @param key The key handle
+ * @param cstr The key text. Must stay valid as long as the key is used.
+ * @return Whether the operation succeeded
+ */
+LIBDY_API bool      DyKey_Init(DyKey *key, const char *cstr);
+
+/**
+ * @brief Drop the string held by a resolved DyKey
+ * @param key The key handle
+ * @note The key is resolved again on next use.
+ */
+LIBDY_API void      DyKey_Clear(DyKey *key);
+
+/**
+ * @brief Retrieve an item from a dictionary using a key handle
+ * @sa Dy_GetItem, Dy_GetItemD, Dy_GetItemU
+ */
+LIBDY_API DyObject *Dy_GetItemKey(DyObject *self, DyKey *key);
+LIBDY_API DyObject *Dy_GetItemKeyD(DyObject *self, DyKey *key, DyObject *def);
+LIBDY_API DyObject *Dy_GetItemKeyU(DyObject *self, DyKey *key);
+
+/**
+ * @brief Set an item in a dictionary using a key handle
+ * @sa Dy_SetItem
+ */
+LIBDY_API bool      Dy_SetItemKey(DyObject *self, DyKey *key, DyObject *value);
+
 ///@}
 
 #ifdef __cplusplus
@@ -0,0 +1,353 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "deque_p.h"
+#include "list_p.h"
+#include "region_p.h"
+#include "exceptions.h"
+#include "stringbuilder.h"
+
+#include <string.h>
+
+
+// Slots allocated at first
+#define DEQUE_MIN_SLOTS 8
+
+
+bool DyDeque_Check(DyObject *self)
+{
+    return self->type == DY_DEQUE;
+}
+
+DyObject *DyDeque_New()
+{
+    return DyDeque_NewBounded(0);
+}
+
+DyObject *DyDeque_NewBounded(size_t maxlen)
+{
+    DyDequeObject *self = object_malloc(sizeof(DyDequeObject));
+    if (!self)
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    object_init((DyObject *)self, DY_DEQUE);
+    self->head = 0;
+    self->size = 0;
+    self->mask = 0;
+    self->maxlen = maxlen;
+    self->items = NULL;
+
+    return (DyObject *)self;
+}
+
+// Move the items into a buffer of the given number of slots, which must be
+// a power of two that fits them
+static bool deque_realloc(DyDequeObject *self, size_t slots)
+{
+    DyObject **items = object_buffer((DyObject *)self, sizeof(DyObject *) * slots);
+    if (!items)
+        return_error(false);
+
+    // The items may wrap around the end of the old buffer
+    if (self->size)
+    {
+        size_t first = self->mask + 1 - self->head;
+        if (first > self->size)
+            first = self->size;
+
+        memcpy(items, self->items + self->head, sizeof(DyObject *) * first);
+        memcpy(items + first, self->items, sizeof(DyObject *) * (self->size - first));
+    }
+
+    object_free((DyObject *)self, self->items);
+    self->items = items;
+    self->head = 0;
+    self->mask = slots - 1;
+    return true;
+}
+
+inline static bool deque_grow(DyDequeObject *self)
+{
+    if (!self->items)
+        return deque_realloc(self, DEQUE_MIN_SLOTS);
+
+    if (self->size <= self->mask)
+        return true;
+
+    if (self->size > SIZE_MAX / (2 * sizeof(DyObject *)))
+    {
+        DyErr_SetMemoryError();
+        return_error(false);
+    }
+
+    return deque_realloc(self, 2 * (self->mask + 1));
+}
+
+// Give back memory once a quarter of the slots is in use.
+// Failing to do so is harmless.
+inline static void deque_shrink(DyDequeObject *self)
+{
+    size_t slots = self->mask + 1;
+    if (slots > DEQUE_MIN_SLOTS && self->size < slots / 4)
+    {
+        if (!deque_realloc(self, slots / 2))
+            DyErr_Clear();
+    }
+}
+
+inline static DyObject *deque_take_back(DyDequeObject *self)
+{
+    return *deque_slot(self, --self->size);
+}
+
+inline static DyObject *deque_take_front(DyDequeObject *self)
+{
+    DyObject *item = self->items[self->head];
+    self->head = (self->head + 1) & self->mask;
+    --self->size;
+    return item;
+}
+
+bool DyDeque_Push(DyObject *self, DyObject *value)
+{
+    if (DyErr_CheckArg("DyDeque_Push", 0, DY_DEQUE, self))
+        return_error(false);
+
+    DyDequeObject *dq = (DyDequeObject *)self;
+    DyObject *evicted = NULL;
+
+    if (dq->maxlen && dq->size == dq->maxlen)
+        evicted = deque_take_front(dq);
+    else if (!deque_grow(dq))
+        return_error(false);
+
+    *deque_slot(dq, dq->size++) = Dy_Retain(value);
+
+    if (evicted)
+        Dy_Release(evicted);
+    return true;
+}
+
+bool DyDeque_PushFront(DyObject *self, DyObject *value)
+{
+    if (DyErr_CheckArg("DyDeque_PushFront", 0, DY_DEQUE, self))
+        return_error(false);
+
+    DyDequeObject *dq = (DyDequeObject *)self;
+    DyObject *evicted = NULL;
+
+    if (dq->maxlen && dq->size == dq->maxlen)
+        evicted = deque_take_back(dq);
+    else if (!deque_grow(dq))
+        return_error(false);
+
+    dq->head = (dq->head - 1) & dq->mask;
+    dq->items[dq->head] = Dy_Retain(value);
+    ++dq->size;
+
+    if (evicted)
+        Dy_Release(evicted);
+    return true;
+}
+
+DyObject *DyDeque_Pop(DyObject *self)
+{
+    if (DyErr_CheckArg("DyDeque_Pop", 0, DY_DEQUE, self))
+        return_null;
+
+    DyDequeObject *dq = (DyDequeObject *)self;
+    if (!dq->size)
+    {
+        DyErr_Set(DY_ERRID_INDEX_ERROR, "Pop from empty deque");
+        return_null;
+    }
+
+    DyObject *item = deque_take_back(dq);
+    deque_shrink(dq);
+    return item;
+}
+
+DyObject *DyDeque_PopFront(DyObject *self)
+{
+    if (DyErr_CheckArg("DyDeque_PopFront", 0, DY_DEQUE, self))
+        return_null;
+
+    DyDequeObject *dq = (DyDequeObject *)self;
+    if (!dq->size)
+    {
+        DyErr_Set(DY_ERRID_INDEX_ERROR, "Pop from empty deque");
+        return_null;
+    }
+
+    DyObject *item = deque_take_front(dq);
+    deque_shrink(dq);
+    return item;
+}
+
+DyObject *DyDeque_Drain(DyObject *self, size_t max)
+{
+    if (DyErr_CheckArg("DyDeque_Drain", 0, DY_DEQUE, self))
+        return_null;
+
+    DyDequeObject *dq = (DyDequeObject *)self;
+    size_t n = max < dq->size ? max : dq->size;
+
+    DyListObject *list = (DyListObject *)DyList_NewEx(n);
+    if (!list || (n && !list->items))
+    {
+        if (list)
+        {
+            Dy_Release((DyObject *)list);
+            DyErr_SetMemoryError();
+        }
+        return_null;
+    }
+
+    // The references move over as they are
+    size_t first = dq->mask + 1 - dq->head;
+    if (first > n)
+        first = n;
+
+    if (n)
+    {
+        memcpy(list->items, dq->items + dq->head, sizeof(DyObject *) * first);
+        memcpy(list->items + first, dq->items, sizeof(DyObject *) * (n - first));
+    }
+    list->size = n;
+
+    dq->head = (dq->head + n) & dq->mask;
+    dq->size -= n;
+    deque_shrink(dq);
+
+    return (DyObject *)list;
+}
+
+bool DyDeque_Extend(DyObject *self, DyObject *list)
+{
+    if (DyErr_CheckArg("DyDeque_Extend", 0, DY_DEQUE, self)
+     || DyErr_CheckArg("DyDeque_Extend", 1, DY_LIST, list))
+        return_error(false);
+
+    DyListObject *lo = (DyListObject *)list;
+    for (size_t i = 0; i < lo->size; ++i)
+        if (!DyDeque_Push(self, lo->items[i]))
+            return_error(false);
+
+    return true;
+}
+
+bool DyDeque_Clear(DyObject *self)
+{
+    if (DyErr_CheckArg("DyDeque_Clear", 0, DY_DEQUE, self))
+        return_error(false);
+
+    DyDequeObject *dq = (DyDequeObject *)self;
+    DyObject **items = dq->items;
+    size_t head = dq->head, size = dq->size, mask = dq->mask;
+
+    dq->items = NULL;
+    dq->head = dq->size = dq->mask = 0;
+
+    for (size_t i = 0; i < size; ++i)
+        Dy_Release(items[(head + i) & mask]);
+    object_free(self, items);
+    return true;
+}
+
+size_t DyDeque_MaxLen(DyObject *self)
+{
+    if (DyErr_CheckArg("DyDeque_MaxLen", 0, DY_DEQUE, self))
+        return_error(0);
+
+    return ((DyDequeObject *)self)->maxlen;
+}
+
+void deque_destroy(DyDequeObject *self)
+{
+    for (size_t i = 0; i < self->size; ++i)
+        Dy_Release(*deque_slot(self, i));
+    dy_free(self->items);
+}
+
+
+// Indexing like lists ---------------------------------------------------------
+DyObject *deque_getitem(DyDequeObject *self, ssize_t key)
+{
+    if (key < 0)
+        key += self->size;
+
+    if (key < 0 || (size_t)key >= self->size)
+    {
+        DyErr_Set(DY_ERRID_INDEX_ERROR, "Deque index out of range");
+        return_null;
+    }
+
+    return *deque_slot(self, key);
+}
+
+DyObject *deque_getitemu(DyDequeObject *self, ssize_t key)
+{
+    if (key < 0)
+        key += self->size;
+
+    if (key < 0 || (size_t)key >= self->size)
+        return Dy_Undefined;
+
+    return *deque_slot(self, key);
+}
+
+bool deque_setitem(DyDequeObject *self, ssize_t key, DyObject *value)
+{
+    if (key < 0)
+        key += self->size;
+
+    if (key < 0 || (size_t)key >= self->size)
+    {
+        DyErr_Set(DY_ERRID_INDEX_ERROR, "Deque assignment out of range");
+        return_error(false);
+    }
+
+    DyObject **slot = deque_slot(self, key);
+    DyObject *old = *slot;
+    *slot = Dy_Retain(value);
+    Dy_Release(old);
+    return true;
+}
+
+bool deque_sbrepr(DyStringBuilder *sb, DyDequeObject *self)
+{
+    if (!DyStringBuilder_Append(sb, "<Deque [", 8))
+        return_error(false);
+
+    for (size_t i = 0; i < (self->size < 20 ? self->size : 20); ++i)
+    {
+        if (i && !DyStringBuilder_Append(sb, ", ", 2))
+            return_error(false);
+
+        if (!sbrepr(sb, *deque_slot(self, i)))
+            return_error(false);
+    }
+
+    if (self->size > 20 && !DyStringBuilder_Append(sb, ", ...", 5))
+        return_error(false);
+
+    return DyStringBuilder_Append(sb, "]>", 2);
+}
@@ -0,0 +1,50 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "dy_p.h"
+
+/**
+ * @file deque_p.h
+ * @brief Deque implementation header
+ */
+
+// Items live in a ring buffer of a power of two slots.
+// Item i is at items[(head + i) & mask].
+typedef struct _DyDequeObject {
+    DyObject_HEAD
+    size_t head;
+    size_t size;
+    size_t mask;        // Slots - 1, or 0 while nothing is allocated
+    size_t maxlen;      // 0 if unbounded
+    DyObject **items;
+} DyDequeObject;
+
+static inline DyObject **deque_slot(DyDequeObject *self, size_t i)
+{
+    return &self->items[(self->head + i) & self->mask];
+}
+
+void deque_destroy(DyDequeObject *self);
+
+DyObject *deque_getitem(DyDequeObject *self, ssize_t key);
+DyObject *deque_getitemu(DyDequeObject *self, ssize_t key);
+bool deque_setitem(DyDequeObject *self, ssize_t key, DyObject *value);
+
+bool deque_sbrepr(struct DyStringBuilder *sb, DyDequeObject *self);
@@ -21,10 +21,17 @@
 #include "exceptions.h"
 #include "dystring.h"
 #include "host_p.h"
+#include "pool_p.h"
+#include "region_p.h"
 #include "string_p.h"
 
 #include <stdio.h>
 #include <stddef.h>
+#include <stdatomic.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 bool DyDict_Check(DyObject *self)
@@ -33,393 +40,1360 @@ bool DyDict_Check(DyObject *self)
 }
 
 // Prototypes
-static bucket_t *find_bucket(DyDictObject *, DyObject *key, DyHash hash);
-static bucket_t *find_or_create_bucket(DyDictObject *, DyObject *key, DyHash hash);
+static dict_entry_t *find_entry(DyDictObject *, DyObject *key, DyHash hash);
+
+// Control bytes ---------------------------------------------------------------
+typedef uint32_t ctrl_mask_t;
+
+// Bitmask of the slots in the group starting at g whose control byte is h2
+static inline ctrl_mask_t ctrl_match(const uint8_t *g, uint8_t h2)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+    return (ctrl_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+#else
+    ctrl_mask_t mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; ++i)
+        mask |= (ctrl_mask_t)(g[i] == h2) << i;
+    return mask;
+#endif
+}
+
+// Bitmask of the empty slots in the group starting at g
+static inline ctrl_mask_t ctrl_match_empty(const uint8_t *g)
+{
+#ifdef __SSE2__
+    return (ctrl_mask_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+#else
+    ctrl_mask_t mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; ++i)
+        mask |= (ctrl_mask_t)(g[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+// Spread the key hash so that both the slot index and the control byte
+// get well-distributed bits, even for integer keys (which hash to themselves)
+static inline uint64_t dict_mix(DyHash hash)
+{
+    uint64_t h = (uint64_t)hash * UINT64_C(0x9E3779B97F4A7C15);
+    return h ^ (h >> 32);
+}
+
+// Keyed replacement for dict_mix, for tables under collision attack
+static uint64_t dict_keyed_mix(DyObject *key, DyHash hash)
+{
+    if (key->type == DY_STRING)
+        return Dy_hash_siphash13(string_data((DyStringObject *)key), ((DyStringObject *)key)->size);
+
+    // Integers hash to their value, so this mixes the key itself. They're the
+    // only other hashable type; a type whose hash loses information would
+    // need its own case here to be protected.
+    return Dy_hash_siphash13((const char *)&hash, sizeof(hash));
+}
+
+#define H1(mixed, mask) (((mixed) >> 7) & (mask))
+#define H2(mixed) ((uint8_t)((mixed) & 0x7F))
+
+// Key comparison
+static inline bool is_interned(DyObject *key)
+{
+    return key->type == DY_STRING && string_flags((DyStringObject *)key) & DYSTRING_INTERNED;
+}
+
+static inline bool key_equals(DyObject *a, DyObject *b)
+{
+    if (a == b)
+        return true;
+
+    // Interned strings are unique, two different ones can't be equal
+    if (a->type == DY_STRING && b->type == DY_STRING &&
+        string_flags((DyStringObject *)a) & string_flags((DyStringObject *)b) & DYSTRING_INTERNED)
+        return false;
+
+    return Dy_Equals(a, b);
+}
+
+// The mixed hash of a key, as the table wants it
+static inline uint64_t table_mix(dict_table_t *t, DyObject *key, DyHash hash)
+{
+    return t->keyed ? dict_keyed_mix(key, hash) : dict_mix(hash);
+}
+
+// Set a control byte, keeping the mirrored group at the end of the array intact
+static inline void set_ctrl(dict_table_t *t, size_t i, uint8_t c)
+{
+    size_t size = t->mask + 1;
+
+    t->ctrl[i] = c;
+    for (size_t m = i + size; m < size + DICT_GROUP_WIDTH; m += size)
+        t->ctrl[m] = c;
+}
+
+static inline bool slot_full(dict_table_t *t, size_t i)
+{
+    return !(t->ctrl[i] & DICT_CTRL_EMPTY);
+}
+
+// Versions
+// Each thread takes a block of versions from the global counter at a time,
+// so dict writes don't all contend on a single cache line.
+#define DICT_VERSION_BLOCK 1024
+
+static _Atomic(uint64_t) dict_version_counter = 0;
+static _Thread_local uint64_t dict_version_next, dict_version_end;
+
+static inline uint64_t dict_new_version(void)
+{
+    if (dict_version_next == dict_version_end)
+    {
+        dict_version_next = atomic_fetch_add_explicit(&dict_version_counter, DICT_VERSION_BLOCK, memory_order_relaxed) + 1;
+        dict_version_end = dict_version_next + DICT_VERSION_BLOCK;
+    }
+    return dict_version_next++;
+}
+
+// Mark a dict as modified
+static inline void dict_touch(DyDictObject *o)
+{
+    o->version = dict_new_version();
+}
 
 // Implementation
 static inline void dict_init(DyDictObject *o)
 {
     o->parent = NULL;
-    o->blocks = NULL;
-    memset(o->table, 0, sizeof(bucket_t) * DY_TABLE_SIZE);
+    o->flags &= ~DICT_INTERN_KEYS;
+    o->used = 0;
+    o->table = NULL;
+    o->shape = NULL;
+    o->values = NULL;
+    o->values_size = 0;
+    o->cache = NULL;
+    dict_touch(o);
+}
+
+static dict_shape_t shape_root = { .refcnt = 1 };
+
+DyObject *DyDict_New()
+{
+    DyDictObject *self = (DyDictObject *)pool_new(DY_DICT, sizeof(DyDictObject));
+    if (!self)
+        return_null;
+
+    dict_init(self);
+
+    return (DyObject *)self;
+}
+
+DyObject *DyDict_NewWithParent(DyObject *parent)
+{
+    if (DyErr_CheckArg("DyDict_NewWithParent", 1, DY_DICT, parent))
+        return_null;
+
+    DyDictObject *self = (DyDictObject *)pool_new(DY_DICT, sizeof(DyDictObject));
+    if (!self)
+        return_null;
+
+    dict_init(self);
+
+    self->parent = (DyDictObject*)Dy_Retain(parent);
+
+    return (DyObject *)self;
+}
+
+bool DyDict_SetInternKeys(DyObject *self, bool enable)
+{
+    if (DyErr_CheckArg("DyDict_SetInternKeys", 0, DY_DICT, self))
+        return_error(false);
+
+    DyDictObject *o = (DyDictObject *)self;
+    if (enable)
+        o->flags |= DICT_INTERN_KEYS;
+    else
+        o->flags &= ~DICT_INTERN_KEYS;
+
+    return true;
+}
+
+DyObject *DyDict_NewShared()
+{
+    DyDictObject *self = (DyDictObject *)DyDict_New();
+    if (!self)
+        return_null;
+
+    // Shapes are global, a dict in a region would never let go of its shape
+    if (!dy_region)
+        self->shape = &shape_root;
+
+    return (DyObject *)self;
+}
+
+// Table management ------------------------------------------------------------
+static inline size_t round_size(size_t size)
+{
+    size_t n = DICT_MIN_SIZE;
+    while (n < size)
+        n <<= 1;
+    return n;
+}
+
+static inline void reset_table(dict_table_t *t)
+{
+    t->nentries = 0;
+    t->interned = true;
+    t->keyed = false;
+    t->flooded = false;
+    memset(t->ctrl, DICT_CTRL_EMPTY, t->mask + 1 + DICT_GROUP_WIDTH);
+}
+
+// Allocate a table for a dict, or for a shape if owner is NULL
+static dict_table_t *alloc_table(DyDictObject *owner, size_t size)
+{
+    // Entry numbers are stored as 32 bit
+    if (size > UINT32_MAX)
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    size_t usable = DICT_USABLE(size);
+    size_t bytes = sizeof(dict_table_t) +
+                   sizeof(dict_entry_t) * usable +
+                   sizeof(uint32_t) * size +
+                   size + DICT_GROUP_WIDTH;
+    dict_table_t *t = owner ? object_buffer((DyObject *)owner, bytes) : dy_malloc(bytes);
+    if (!t)
+    {
+        if (!owner)
+            DyErr_SetMemoryError();
+        return_null;
+    }
+
+    t->mask = size - 1;
+    t->usable = usable;
+    t->index = (uint32_t *)(t->entries + usable);
+    t->ctrl = (uint8_t *)(t->index + size);
+    reset_table(t);
+
+    return t;
+}
+
+// Index size giving room for at least twice the number of items
+static inline size_t table_size_for(size_t used)
+{
+    size_t size = DICT_MIN_SIZE;
+
+    while (DICT_USABLE(size) < used * 2)
+        size <<= 1;
+
+    return size;
+}
+
+// Find the first empty index slot in the probe sequence
+static inline size_t find_empty_slot(dict_table_t *t, uint64_t mixed)
+{
+    size_t pos = H1(mixed, t->mask);
+
+    for (size_t groups = 1;; ++groups)
+    {
+        ctrl_mask_t empty = ctrl_match_empty(t->ctrl + pos);
+        if (empty)
+            return (pos + __builtin_ctz(empty)) & t->mask;
+        pos = (pos + DICT_GROUP_WIDTH) & t->mask;
+        if (groups == DICT_FLOOD_GROUPS)
+            t->flooded = true;
+    }
+}
+
+// Record a key being stored in the table
+static inline void table_note_key(dict_table_t *t, DyObject *key)
+{
+    if (!is_interned(key))
+        t->interned = false;
+}
+
+// Append an entry for a key that is known not to be in the table yet.
+// The table must have room for it. The key is not stored.
+static dict_entry_t *table_append(dict_table_t *t, DyObject *key, DyHash hash)
+{
+    uint64_t mixed = table_mix(t, key, hash);
+    size_t i = find_empty_slot(t, mixed);
+    t->index[i] = (uint32_t)t->nentries;
+    set_ctrl(t, i, H2(mixed));
+
+    dict_entry_t *entry = &t->entries[t->nentries++];
+    entry->hash = hash;
+    return entry;
+}
+
+// Rebuild the table with a new index size, squeezing out the holes left
+// behind by deletions. A flooded table comes out keyed.
+static bool dict_rebuild(DyDictObject *o, size_t size)
+{
+    dict_table_t *old = o->table;
+    dict_table_t *t = alloc_table(o, size);
+    if (!t)
+        return_error(false);
+
+    if (old)
+        t->keyed = old->keyed || old->flooded;
+
+    // Re-insert in order. Keys are known to be unique, no need to compare.
+    for (size_t i = 0; old && i < old->nentries; ++i)
+        if (old->entries[i].key)
+        {
+            *table_append(t, old->entries[i].key, old->entries[i].hash) = old->entries[i];
+            table_note_key(t, old->entries[i].key);
+        }
+
+    if (old)
+        object_free((DyObject *)o, old);
+    o->table = t;
+
+    return true;
+}
+
+// Make room for at least twice the live items
+static inline bool dict_resize(DyDictObject *o)
+{
+    return dict_rebuild(o, table_size_for(o->used));
+}
+
+// Make sure a combined table can take n items in total without growing
+static bool dict_reserve(DyDictObject *o, size_t n)
+{
+    dict_table_t *t = o->table;
+    if (t && t->usable - t->nentries + o->used >= n)
+        return true;
+
+    size_t size = round_size(DyHost.dict_table_size);
+    while (DICT_USABLE(size) < n)
+        size <<= 1;
+
+    return dict_rebuild(o, size);
+}
+
+// Shapes ----------------------------------------------------------------------
+// Protects the transition lists and shape reference counts
+static atomic_flag shape_lock = ATOMIC_FLAG_INIT;
+
+static inline void shape_lock_acquire()
+{
+    while (atomic_flag_test_and_set_explicit(&shape_lock, memory_order_acquire));
+}
+
+static inline void shape_lock_release()
+{
+    atomic_flag_clear_explicit(&shape_lock, memory_order_release);
+}
+
+static void shape_release(dict_shape_t *shape)
+{
+    while (shape != &shape_root)
+    {
+        shape_lock_acquire();
+        if (--shape->refcnt)
+        {
+            shape_lock_release();
+            return;
+        }
+
+        // Unlink from the parent's transitions
+        dict_shape_t **link = &shape->parent->children;
+        while (*link != shape)
+            link = &(*link)->sibling;
+        *link = shape->sibling;
+        shape_lock_release();
+
+        for (size_t i = 0; i < shape->table->nentries; ++i)
+            Dy_Release(shape->table->entries[i].key);
+
+        dict_shape_t *parent = shape->parent;
+        dy_free(shape->table);
+        dy_free(shape);
+        shape = parent;
+    }
+}
+
+// Look for the transition adding key. Must hold the lock.
+static dict_shape_t *shape_find_child(dict_shape_t *shape, DyObject *key, DyHash hash, size_t *count)
+{
+    *count = 0;
+
+    for (dict_shape_t *child = shape->children; child; child = child->sibling, ++*count)
+    {
+        dict_entry_t *last = &child->table->entries[child->table->nentries - 1];
+        if (last->hash == hash && key_equals(key, last->key))
+            return child;
+    }
+
+    return NULL;
+}
+
+// Get a new reference to the shape derived from shape by adding key.
+// *result is set to NULL if shape cannot take any more transitions.
+static bool shape_transition(dict_shape_t *shape, DyObject *key, DyHash hash, dict_shape_t **result)
+{
+    size_t count;
+
+    shape_lock_acquire();
+    dict_shape_t *child = shape_find_child(shape, key, hash, &count);
+    if (child)
+        ++child->refcnt;
+    shape_lock_release();
+
+    *result = child;
+    if (child || count >= DICT_SHAPE_MAX_CHILDREN)
+        return true;
+
+    // Shapes outlive regions, their keys can't come from one
+    if (region_owns(key))
+        return true;
+
+    // Build a new one outside the lock
+    size_t nkeys = shape->table ? shape->table->nentries : 0;
+
+    child = dy_malloc(sizeof(dict_shape_t));
+    if (!child)
+    {
+        DyErr_SetMemoryError();
+        return_error(false);
+    }
+
+    child->table = alloc_table(NULL, table_size_for(nkeys + 1));
+    if (!child->table)
+    {
+        dy_free(child);
+        return_error(false);
+    }
+
+    for (size_t i = 0; i < nkeys; ++i)
+    {
+        dict_entry_t *e = &shape->table->entries[i];
+        table_append(child->table, e->key, e->hash)->key = Dy_Retain(e->key);
+    }
+
+    table_append(child->table, key, hash)->key = Dy_Retain(key);
+    child->table->interned = shape->table ? shape->table->interned : true;
+    table_note_key(child->table, key);
+
+    child->refcnt = 1;
+    child->parent = shape;
+    child->children = NULL;
+
+    // Someone else may have been faster
+    shape_lock_acquire();
+    dict_shape_t *other = shape_find_child(shape, key, hash, &count);
+    if (other)
+        ++other->refcnt;
+    else
+    {
+        ++shape->refcnt;
+        child->sibling = shape->children;
+        shape->children = child;
+    }
+    shape_lock_release();
+
+    if (other)
+    {
+        for (size_t i = 0; i <= nkeys; ++i)
+            Dy_Release(child->table->entries[i].key);
+        dy_free(child->table);
+        dy_free(child);
+        child = other;
+    }
+
+    *result = child;
+    return true;
+}
+
+// Make sure the value vector of a split dict has room for n items
+static bool shared_reserve(DyDictObject *o, size_t n)
+{
+    if (o->values_size >= n)
+        return true;
+
+    size_t size = 4;
+    while (size < n)
+        size <<= 1;
+
+    DyObject **values = object_realloc((DyObject *)o, o->values,
+                                       sizeof(DyObject *) * o->values_size,
+                                       sizeof(DyObject *) * size);
+    if (!values)
+        return_error(false);
+
+    o->values = values;
+    o->values_size = size;
+    return true;
+}
+
+// Convert a dict in split mode to a combined table
+static bool dict_unshare(DyDictObject *o)
+{
+    dict_table_t *keys = o->table;
+    dict_table_t *t = NULL;
+
+    if (o->used)
+    {
+        t = alloc_table(o, table_size_for(o->used));
+        if (!t)
+            return_error(false);
+
+        for (size_t i = 0; i < keys->nentries; ++i)
+        {
+            dict_entry_t *e = table_append(t, keys->entries[i].key, keys->entries[i].hash);
+            e->key = Dy_Retain(keys->entries[i].key);
+            e->value = o->values[i];
+        }
+        t->interned = keys->interned;
+    }
+
+    shape_release(o->shape);
+    object_free((DyObject *)o, o->values);
+
+    o->shape = NULL;
+    o->values = NULL;
+    o->values_size = 0;
+    o->table = t;
+
+    return true;
+}
+
+// Release all items of a dict in split mode, going back to the root shape
+static void shared_clean(DyDictObject *o)
+{
+    for (size_t i = 0; i < o->used; ++i)
+        Dy_Release(o->values[i]);
+
+    shape_release(o->shape);
+    object_free((DyObject *)o, o->values);
+
+    o->shape = &shape_root;
+    o->values = NULL;
+    o->values_size = 0;
+    o->table = NULL;
+    o->used = 0;
+}
+
+bool dict_clean(DyDictObject *self)
+{
+    dict_touch(self);
+
+    if (self->shape)
+    {
+        shared_clean(self);
+        return true;
+    }
+
+    dict_table_t *t = self->table;
+    if (!t)
+        return true;
+
+    // Release items
+    for (size_t i = 0; i < t->nentries; ++i)
+        if (t->entries[i].key)
+        {
+            Dy_Release(t->entries[i].key);
+            Dy_Release(t->entries[i].value);
+        }
+
+    self->used = 0;
+
+    // Keep small tables around for reuse
+    if (t->mask + 1 <= DyHost.dict_block_size)
+        reset_table(t);
+    else
+    {
+        object_free((DyObject *)self, t);
+        self->table = NULL;
+    }
+
+    return true;
+}
+
+bool DyDict_Clear(DyObject *self)
+{
+    if (!DyDict_Check(self))
+    {
+        DyErr_SetArgumentTypeError("DyDict_Clear", 0, "Dict", Dy_GetTypeName(Dy_Type(self)));
+        return_error(false);
+    }
+
+    return dict_clean((DyDictObject*)self);
+}
+
+void dict_destroy(DyDictObject *o)
+{
+    // Clean refs
+    dict_clean(o);
+
+    if (o->cache)
+    {
+        Dy_Release((DyObject *)o->cache->flat);
+        dy_free(o->cache);
+    }
+
+    if (o->table)
+        dy_free(o->table);
+
+    if (o->parent)
+        Dy_Release((DyObject*)o->parent);
 }
 
-DyObject *DyDict_New()
-{
-    DyDictObject *self = dy_malloc(sizeof(DyDictObject));
-    if (!self)
+// Lookup ----------------------------------------------------------------------
+// Find the index slot referring to key, or -1.
+// With identity set, keys are only compared by pointer.
+static inline ssize_t find_slot_ex(dict_table_t *t, DyObject *key, DyHash hash, const bool identity)
+{
+    uint64_t mixed = table_mix(t, key, hash);
+    uint8_t h2 = H2(mixed);
+    size_t pos = H1(mixed, t->mask);
+
+    for (size_t groups = 1;; ++groups)
+    {
+        const uint8_t *group = t->ctrl + pos;
+        ctrl_mask_t empty = ctrl_match_empty(group);
+        ctrl_mask_t match = ctrl_match(group, h2);
+
+        // The key can only be in front of the first empty slot
+        if (empty)
+            match &= (empty & -empty) - 1;
+
+        while (match)
+        {
+            size_t slot = (pos + __builtin_ctz(match)) & t->mask;
+            dict_entry_t *entry = &t->entries[t->index[slot]];
+            if (identity ? entry->key == key
+                         : entry->hash == hash && key_equals(key, entry->key))
+                return slot;
+            match &= match - 1;
+        }
+
+        if (empty)
+            return -1;
+
+        pos = (pos + DICT_GROUP_WIDTH) & t->mask;
+        if (groups == DICT_FLOOD_GROUPS)
+            t->flooded = true;
+    }
+}
+
+static ssize_t find_slot(dict_table_t *t, DyObject *key, DyHash hash)
+{
+    // An interned string can only be equal to itself
+    if (t->interned && is_interned(key))
+        return find_slot_ex(t, key, hash, true);
+
+    return find_slot_ex(t, key, hash, false);
+}
+
+static dict_entry_t *find_entry(DyDictObject *o, DyObject *key, DyHash hash)
+{
+    if (!o->used)
+        return NULL;
+
+    ssize_t slot = find_slot(o->table, key, hash);
+    if (slot < 0)
+        return NULL;
+
+    return &o->table->entries[o->table->index[slot]];
+}
+
+// Where the value of an entry is stored
+static inline DyObject **entry_value(DyDictObject *o, dict_entry_t *entry)
+{
+    return o->shape ? &o->values[entry - o->table->entries] : &entry->value;
+}
+
+// Append an entry for a key that isn't in the dict. The key and value are
+// left NULL for the caller to fill in.
+static dict_entry_t *create_entry(DyDictObject *o, DyObject *key, DyHash hash)
+{
+    dict_entry_t *entry;
+
+    // Make room
+    if (!o->table)
+    {
+        o->table = alloc_table(o, round_size(DyHost.dict_table_size));
+        if (!o->table)
+            return_null;
+    }
+    else if (o->table->nentries >= o->table->usable ||
+             (o->table->flooded && !o->table->keyed))
+    {
+        if (!dict_resize(o))
+            return_null;
+    }
+
+    ++o->used;
+
+    entry = table_append(o->table, key, hash);
+    entry->key = NULL;
+    entry->value = NULL;
+
+    return entry;
+}
+
+// The key object to store for key. Dicts with DICT_INTERN_KEYS store interned
+// strings, except in a region, which would hold on to the interned key for good.
+// Returns a borrowed reference.
+static inline DyObject *dict_store_key(DyDictObject *o, DyObject *key)
+{
+    if (o->flags & DICT_INTERN_KEYS && key->type == DY_STRING && !region_owns((DyObject *)o))
+        return DyString_Intern(key);
+    return key;
+}
+
+// Add an entry for a key that isn't in the dict, storing the key.
+// The value is left NULL for the caller to fill in.
+static dict_entry_t *insert_entry(DyDictObject *o, DyObject *key, DyHash hash)
+{
+    key = dict_store_key(o, key);
+    if (!key)
+        return_null;
+
+    dict_entry_t *entry = create_entry(o, key, hash);
+    if (!entry)
+        return_null;
+
+    entry->key = Dy_Retain(key);
+    table_note_key(o->table, key);
+    return entry;
+}
+
+// Empty index slot i, moving following slots back so no probe sequence gets broken
+static void free_slot(dict_table_t *t, size_t i)
+{
+    size_t j = i;
+
+    while (true)
+    {
+        j = (j + 1) & t->mask;
+        if (!slot_full(t, j))
+            break;
+
+        // Slots may only move back as far as their home position
+        dict_entry_t *e = &t->entries[t->index[j]];
+        size_t home = H1(table_mix(t, e->key, e->hash), t->mask);
+        if (((j - home) & t->mask) >= ((j - i) & t->mask))
+        {
+            t->index[i] = t->index[j];
+            set_ctrl(t, i, t->ctrl[j]);
+            i = j;
+        }
+    }
+
+    set_ctrl(t, i, DICT_CTRL_EMPTY);
+}
+
+// Remove the entry referred to by an index slot of a combined table.
+// The references held by the entry are handed to the caller.
+static void remove_slot(DyDictObject *o, size_t slot, DyObject **k, DyObject **v)
+{
+    dict_table_t *t = o->table;
+    dict_entry_t *entry = &t->entries[t->index[slot]];
+    *k = entry->key;
+    *v = entry->value;
+
+    // Leave a hole in the entries
+    free_slot(t, slot);
+    entry->key = NULL;
+    entry->value = NULL;
+    --o->used;
+
+    // Trailing holes can be reused right away
+    while (t->nentries && !t->entries[t->nentries - 1].key)
+        --t->nentries;
+}
+
+static void find_and_remove_entry(DyDictObject *o, DyObject *key, DyHash hash)
+{
+    if (!o->used)
+        return;
+
+    ssize_t slot = find_slot(o->table, key, hash);
+    if (slot < 0)
+        return;
+
+    DyObject *k, *v;
+    remove_slot(o, slot, &k, &v);
+
+    // Release Objects
+    Dy_Release(k);
+    Dy_Release(v);
+}
+
+static inline void TE__unhashable(DyObject *o)
+{
+    DyErr_Set(DY_ERRID_NOT_HASHABLE, "Cannot use unhashable type as object key.");
+}
+
+static inline void __KeyError(DyObject *key)
+{
+    DyObject *kr = Dy_Repr(key);
+    DyErr_Set(DY_ERRID_KEY_ERROR, DyString_AsString(kr));
+    Dy_Release(kr);
+}
+
+// Set an item on a dict in split mode.
+// Returns -1 if the dict has to be converted to a combined table first.
+static int shared_setitem(DyDictObject *o, DyObject *key, DyHash hash, DyObject *value)
+{
+    dict_entry_t *e = find_entry(o, key, hash);
+    if (e)
+    {
+        DyObject **slot = entry_value(o, e);
+        Dy_Retain(value);
+        Dy_Release(*slot);
+        *slot = value;
+        return 1;
+    }
+
+    if (o->used >= DICT_SHAPE_MAX_KEYS)
+        return -1;
+
+    dict_shape_t *child;
+    if (!shape_transition(o->shape, key, hash, &child))
+        return_error(0);
+    if (!child)
+        return -1;
+
+    if (!shared_reserve(o, o->used + 1))
+    {
+        shape_release(child);
+        return_error(0);
+    }
+
+    o->values[o->used++] = Dy_Retain(value);
+
+    shape_release(o->shape);
+    o->shape = child;
+    o->table = child->table;
+
+    return 1;
+}
+
+bool dict_setitem(DyDictObject *o, DyObject *key, DyObject *value)
+{
+    DyHash hash;
+
+    if (!Dy_HashEx(key, &hash))
+    {
+        TE__unhashable(key);
+        return_error(false);
+    }
+
+    return dict_setitem_hashed(o, key, hash, value);
+}
+
+bool dict_setitem_hashed(DyDictObject *o, DyObject *key, DyHash hash, DyObject *value)
+{
+    dict_entry_t *e;
+
+    if (value)
+    {
+        key = dict_store_key(o, key);
+        if (!key)
+            return_error(false);
+    }
+
+    dict_touch(o);
+
+    // Shapes only hold string keys and cannot lose any
+    if (o->shape)
+    {
+        if (value && key->type == DY_STRING)
+        {
+            int res = shared_setitem(o, key, hash, value);
+            if (res > 0)
+                return true;
+            else if (!res)
+                return_error(false);
+        }
+        else if (!value && !find_entry(o, key, hash))
+            return true;
+
+        if (!dict_unshare(o))
+            return_error(false);
+    }
+
+    // Delete
+    if (!value)
+    {
+    	find_and_remove_entry(o, key, hash);
+    	
+    	return true;
+    }
+
+    // Set
+    else
+    {
+    	e = find_entry(o, key, hash);
+    	if (e)
+    		Dy_Release(e->value);
+    	else if (!(e = insert_entry(o, key, hash)))
+    		return_error(false);
+
+    	e->value = Dy_Retain(value);
+    	
+    	return true;
+    }
+}
+
+// Get key
+DyObject *dict_get(DyDictObject *self, DyObject *key, DyHash hash)
+{
+    dict_entry_t *e = find_entry(self, key, hash);
+    if (e)
+        return *entry_value(self, e);
+    else
+        return Dy_Undefined;
+}
+
+// Lookup cache ----------------------------------------------------------------
+bool DyDict_EnableLookupCache(DyObject *self)
+{
+    if (DyErr_CheckArg("DyDict_EnableLookupCache", 0, DY_DICT, self))
+        return_error(false);
+
+    DyDictObject *o = (DyDictObject *)self;
+    if (o->cache)
+        return true;
+
+    size_t depth = 0;
+    for (DyDictObject *cur = o->parent; cur; cur = cur->parent)
+        ++depth;
+
+    dict_lookup_cache_t *c = object_buffer(self, sizeof(dict_lookup_cache_t) +
+                                           (sizeof(uint64_t) + sizeof(DyDictObject *)) * depth);
+    if (!c)
+        return_error(false);
+
+    // The flat dict goes where the cache goes
+    DyRegion *region = region_suspend();
+    if (region_owns(self))
+        dy_region = region_of(self);
+    c->flat = (DyDictObject *)DyDict_New();
+    region_resume(region);
+    if (!c->flat)
+    {
+        object_free(self, c);
+        return_error(false);
+    }
+
+    // Parents can't change, so the chain is fixed. Our reference to the
+    // parent keeps all of them alive.
+    c->depth = depth;
+    c->chain = (DyDictObject **)(c->versions + depth);
+    depth = 0;
+    for (DyDictObject *cur = o->parent; cur; cur = cur->parent)
     {
-        DyErr_SetMemoryError();
-        return_null;
+        c->chain[depth] = cur;
+        c->versions[depth++] = 0; // Never a valid version
     }
 
-    Dy_InitObject((DyObject *)self, DY_DICT);
-    dict_init(self);
+    c->stats.hits = 0;
+    c->stats.misses = 0;
+    c->stats.size = 0;
 
-    return (DyObject *)self;
+    o->cache = c;
+    return true;
 }
 
-DyObject *DyDict_NewWithParent(DyObject *parent)
+bool DyDict_GetLookupCacheStats(DyObject *self, DyDict_LookupCacheStats *stats)
 {
-    if (DyErr_CheckArg("DyDict_NewWithParent", 1, DY_DICT, parent))
-        return_null;
-
-    DyDictObject *self = dy_malloc(sizeof(DyDictObject));
-    if (!self)
-    {
-        DyErr_SetMemoryError();
-        return_null;
-    }
-
-    Dy_InitObject((DyObject *)self, DY_DICT);
-    dict_init(self);
+    if (DyErr_CheckArg("DyDict_GetLookupCacheStats", 0, DY_DICT, self))
+        return_error(false);
 
-    self->parent = (DyDictObject*)Dy_Retain(parent);
+    dict_lookup_cache_t *c = ((DyDictObject *)self)->cache;
+    if (!c)
+        return false;
 
-    return (DyObject *)self;
+    *stats = c->stats;
+    stats->size = c->flat->used;
+    return true;
 }
 
-bool dict_clean(DyDictObject *self)
+// Make sure the flattened view reflects the current state of all ancestors.
+// Only their own versions matter, changes to other dicts don't get in the way.
+static bool cache_validate(dict_lookup_cache_t *c)
 {
-    // Release items
-    for (int i = 0; i < DY_TABLE_SIZE; ++i)
+    size_t i = 0;
+    while (i < c->depth && c->chain[i]->version == c->versions[i])
+        ++i;
+
+    if (i < c->depth)
     {
-        for (bucket_t *b = &self->table[i]; b; b = b->next)
+        ++c->stats.misses;
+
+        // Rebuild, starting with the most distant ancestor so nearer ones win
+        dict_clean(c->flat);
+        for (i = c->depth; i--;)
         {
-            if (b->key)
-            {
-                Dy_Release(b->key);
-                Dy_Release(b->value);
-            }
+            DyDictObject *anc = c->chain[i];
+            dict_table_t *t = anc->table;
+
+            for (size_t j = 0; t && j < t->nentries; ++j)
+                if (t->entries[j].key &&
+                    !dict_setitem_hashed(c->flat, t->entries[j].key, t->entries[j].hash,
+                                         *entry_value(anc, &t->entries[j])))
+                {
+                    // Make sure the next lookup tries again
+                    c->versions[0] = 0;
+                    return_error(false);
+                }
+
+            c->versions[i] = anc->version;
         }
-    	self->table[i].key = NULL;
-    	self->table[i].next = NULL;
     }
+    else
+        ++c->stats.hits;
 
-    // Free blocks
-    bucket_block_t *block = self->blocks, *last = NULL;
-
-    while(block)
-    {
-        block = (last = block)->next;
-        dy_free(last);
-    }
-    
     return true;
 }
 
-bool DyDict_Clear(DyObject *self)
+// Look a key up in a dict and its ancestors
+DyObject *dict_get_inherited(DyDictObject *self, DyObject *key, DyHash hash)
 {
-    if (!DyDict_Check(self))
+    DyObject *result = dict_get(self, key, hash);
+    if (result != Dy_Undefined || !self->parent)
+        return result;
+
+    if (self->cache)
     {
-        DyErr_SetArgumentTypeError("DyDict_Clear", 0, "Dict", Dy_GetTypeName(Dy_Type(self)));
-        return_error(false);
+        if (!cache_validate(self->cache))
+            return_null;
+        return dict_get(self->cache->flat, key, hash);
     }
 
-    return dict_clean((DyDictObject*)self);
+    for (DyDictObject *cur = self->parent; cur && result == Dy_Undefined; cur = cur->parent)
+        result = dict_get(cur, key, hash);
+
+    return result;
 }
 
-void dict_destroy(DyDictObject *o)
+bool dict_contains(DyDictObject *o, DyObject *key)
 {
-    // Clean refs
-    dict_clean(o);
+    DyHash hash;
+    if (!Dy_HashEx(key, &hash))
+        return false;
 
-    if (o->parent)
-        Dy_Release((DyObject*)o->parent);
+    DyObject *result = dict_get_inherited(o, key, hash);
+    return result && result != Dy_Undefined;
 }
 
-static bucket_t *find_bucket(DyDictObject *o, DyObject *key, DyHash hash)
+DyObject *DyDict_CachedGet(DyObject *self, DyObject *key, DyDict_Cache *cache)
 {
-    bucket_t *bucket = &o->table[hash % DY_TABLE_SIZE];
+    if (DyErr_CheckArg("DyDict_CachedGet", 0, DY_DICT, self))
+        return_null;
 
-    if (!bucket->key)
-        return NULL;
+    DyDictObject *o = (DyDictObject *)self;
+    dict_entry_t *e;
+
+    // Unchanged since last time. Versions are never reused, so this also
+    // can't be fooled by a new dict at the same address. The key might be,
+    // so check that, which usually is a pointer comparison.
+    if (cache->dict == self && cache->version == o->version && cache->key == key)
+    {
+        e = &o->table->entries[cache->index];
+        if (key_equals(key, e->key))
+            return *entry_value(o, e);
+    }
 
-    // Find in chain
-    do if ((!bucket->hash || hash == bucket->hash) && Dy_Equals(key, bucket->key))
-            return bucket;
-    while ((bucket = bucket->next));
+    DyHash hash;
+    if (!Dy_HashEx(key, &hash))
+    {
+        TE__unhashable(key);
+        return_null;
+    }
 
-    return NULL;
+    e = find_entry(o, key, hash);
+    if (e)
+    {
+        cache->dict = self;
+        cache->key = key;
+        cache->version = o->version;
+        cache->index = e - o->table->entries;
+        return *entry_value(o, e);
+    }
+
+    cache->dict = NULL;
+
+    if (!o->parent)
+        return Dy_Undefined;
+
+    return dict_get_inherited(o, key, hash);
 }
 
-static bucket_block_t *create_block(size_t bucket_count)
+DyObject *dict_getitemu(DyDictObject *self, DyObject *key)
 {
-    bucket_block_t *block = dy_malloc(sizeof(bucket_block_t) + sizeof(bucket_t) * bucket_count);
+    DyHash hash;
 
-    block->size = bucket_count;
-    block->next = NULL;
-    
-    freelist_init(&block->freelist, sizeof(bucket_t), bucket_count);
+    if (!Dy_HashEx(key, &hash))
+    {
+        TE__unhashable(key);
+        return_null;
+    }
     
-    return block;
+    return dict_get_inherited(self, key, hash);
 }
 
-static bucket_t *find_or_create_bucket(DyDictObject *o, DyObject *key, DyHash hash)
+DyObject *dict_getitem(DyDictObject *self, DyObject *key)
 {
-    bucket_t *first = &o->table[hash % DY_TABLE_SIZE];
-    bucket_t *bucket = first;
+    DyObject *result = dict_getitemu(self, key);
+    if (result == Dy_Undefined)
+    {
+    	__KeyError(key);
+    	return_null;
+    }
+    else
+    	return result;
+}
 
-    if (!bucket->key)
-        return bucket;
+DyObject *dict_getitem_hashed(DyDictObject *self, DyObject *key, DyHash hash)
+{
+    DyObject *result = dict_get_inherited(self, key, hash);
+    if (result == Dy_Undefined)
+    {
+    	__KeyError(key);
+    	return_null;
+    }
+    else
+    	return result;
+}
 
-    // Find in chain
-    do if (hash == bucket->hash && Dy_Equals(key, bucket->key))
-            return bucket;
-    while ((bucket = bucket->next));
+// Bulk and single-probe operations -------------------------------------------
+DyObject *DyDict_NewEx(size_t capacity)
+{
+    DyDictObject *self = (DyDictObject *)DyDict_New();
+    if (!self)
+        return_null;
 
-    // Create in chain
-    if (!o->blocks || freelist_empty2(o->blocks))
+    if (capacity && !dict_reserve(self, capacity))
     {
-    	size_t block_size = o->blocks ? o->blocks->size * 2 : DY_BLOCK_SIZE;
+        Dy_Release((DyObject *)self);
+        return_null;
+    }
+
+    return (DyObject *)self;
+}
 
-        // Create new block
-        bucket_block_t *block = create_block(block_size);
+DyObject *dict_from_arrays(DyObject **keys, DyObject **values, size_t n, bool shared)
+{
+    DyDictObject *self;
 
-        // Add block to list
-        block->next = o->blocks;
-        o->blocks = block;
+    if (shared && n <= DICT_SHAPE_MAX_KEYS)
+    {
+        self = (DyDictObject *)DyDict_NewShared();
+        if (self && self->shape && n && !shared_reserve(self, n))
+            goto error;
     }
+    else
+        self = (DyDictObject *)DyDict_NewEx(n);
 
-    // Grab a bucket from the last block
-    bucket = freelist_pop2(o->blocks);
+    if (!self)
+        return_null;
 
-    // clear data (would cause issues with Dy_Release)
-    bucket->key = NULL;
-    bucket->value = NULL;
+    for (size_t i = 0; i < n; ++i)
+        if (!dict_setitem(self, keys[i], values[i]))
+            goto error;
 
-    // Add it to the chain for the table slot
-    bucket->next = first->next;
-    first->next = bucket;
+    return (DyObject *)self;
 
-    return bucket;
+error:
+    Dy_Release((DyObject *)self);
+    return_null;
 }
 
-inline static void free_bucket(DyDictObject *o, bucket_t *bucket)
+DyObject *DyDict_FromArrays(DyObject **keys, DyObject **values, size_t n)
 {
-    // Find block the bucket belongs to
-    for (bucket_block_t *block = o->blocks; block; block = block->next)
-    	// Check if it lies in the memory region
-    	if (block->buckets <= bucket && bucket < (block->buckets + block->size))
-    	{
-    		//printf("Free bucket at %p from block %p\n", bucket, block);
-    		// Free the memory
-    		freelist_push2(block, bucket);
-    		break;
-    	}
+    return dict_from_arrays(keys, values, n, false);
 }
 
-static void find_and_remove_bucket(DyDictObject *o, DyObject *key, DyHash hash)
+bool DyDict_Update(DyObject *self, DyObject *other)
 {
-    bucket_t *bucket = &o->table[hash % DY_TABLE_SIZE];
-    bucket_t *tbucket = bucket;
-    bucket_t *prev;
+    if (DyErr_CheckArg("DyDict_Update", 0, DY_DICT, self) ||
+        DyErr_CheckArg("DyDict_Update", 1, DY_DICT, other))
+        return_error(false);
 
-    // Find in chain
-    do if (Dy_Equals(key, bucket->key))
-    {
-    	// Keep references to release the objects
-    	DyObject *key = bucket->key;
-    	DyObject *val = bucket->value;
+    DyDictObject *o = (DyDictObject *)self;
+    DyDictObject *src = (DyDictObject *)other;
+    dict_table_t *t = src->table;
 
-    	// If it's in the table, we can't free it
-        if (bucket == tbucket)
-    	{
-    		// We might need to pull in the next one
-            if (tbucket->next)
-    		{
-    			bucket = tbucket->next;
-    			memcpy(tbucket, bucket, sizeof(bucket_t)); 	// Copy the bucket into the table
-    			free_bucket(o, bucket);						// Free the now obsolete bucket
-    		}
-    		// Otherwise, we can simply invalidate it.
-    		else
-    			tbucket->key = NULL;
-    	}
-        else
-        {
-    		// Pull bucket out
-            prev->next = bucket->next;
-    		
-    		// Free the bucket
-    		free_bucket(o, bucket);
-        }
-    	
-    	// Release Objects
-    	Dy_Release(key);
-    	Dy_Release(val);
-    	
-    	// We're done
-    	break;
-    }
-    while ((bucket = (prev = bucket)->next));
-}
+    if (o == src || !src->used)
+        return true;
 
-static inline void TE__unhashable(DyObject *o)
-{
-    DyErr_Set(DY_ERRID_NOT_HASHABLE, "Cannot use unhashable type as object key.");
-}
+    if (!o->shape && !dict_reserve(o, o->used + src->used))
+        return_error(false);
 
-static inline void __KeyError(DyObject *key)
-{
-    DyObject *kr = Dy_Repr(key);
-    DyErr_Set(DY_ERRID_KEY_ERROR, DyString_AsString(kr));
-    Dy_Release(kr);
+    for (size_t i = 0; i < t->nentries; ++i)
+        if (t->entries[i].key &&
+            !dict_setitem_hashed(o, t->entries[i].key, t->entries[i].hash, *entry_value(src, &t->entries[i])))
+            return_error(false);
+
+    return true;
 }
 
-bool dict_setitem(DyDictObject *o, DyObject *key, DyObject *value)
+DyObject *DyDict_SetDefault(DyObject *self, DyObject *key, DyObject *def)
 {
-    bucket_t *b;
+    if (DyErr_CheckArg("DyDict_SetDefault", 0, DY_DICT, self))
+        return_null;
+
+    DyDictObject *o = (DyDictObject *)self;
     DyHash hash;
 
     if (!Dy_HashEx(key, &hash))
     {
         TE__unhashable(key);
-        return_error(false);
-    }
-    
-    // Delete
-    if (!value)
-    {
-    	find_and_remove_bucket(o, key, hash);
-    	
-    	return true;
+        return_null;
     }
 
-    // Set
-    else
+    if (o->shape)
     {
-    	b = find_or_create_bucket(o, key, hash);
-    	b->hash = hash;
-
-    	/*DyObject *s = Dy_Str(key);
-    	printf("Insert Key: %s\n", DyString_AsString(s));
-    	Dy_Release(s);*/
-
-    	Dy_Retain(key);
-    	Dy_Retain(value);
-    	
-    	if (b->key)
-    		Dy_Release(b->key);
-    	if (b->value)
-    		Dy_Release(b->value);
-
-    	b->key = key;
-    	b->value = value;
-    	
-    	return true;
+        dict_entry_t *e = find_entry(o, key, hash);
+        if (e)
+            return *entry_value(o, e);
+        if (!dict_setitem_hashed(o, key, hash, def))
+            return_null;
+        return def;
     }
-}
 
-bool dict_contains(DyDictObject *o, DyObject *key)
-{
-    DyHash hash;
-    return Dy_HashEx(key, &hash) && (find_bucket(o, key, hash) != NULL || (o->parent && dict_contains(o->parent, key)));
-}
+    dict_entry_t *e = find_entry(o, key, hash);
+    if (e)
+        return e->value;
 
-// Get key
-DyObject *dict_get(DyDictObject *self, DyObject *key, DyHash hash)
-{
-    bucket_t *b;
+    e = insert_entry(o, key, hash);
+    if (!e)
+        return_null;
 
-    b = find_bucket(self, key, hash);
-    if (b)
-        return b->value;
-    else
-        return Dy_Undefined;
+    e->value = Dy_Retain(def);
+    dict_touch(o);
+    return def;
 }
 
-DyObject *dict_getitemu(DyDictObject *self, DyObject *key)
+DyObject *DyDict_Pop(DyObject *self, DyObject *key, DyObject *def)
 {
+    if (DyErr_CheckArg("DyDict_Pop", 0, DY_DICT, self))
+        return_null;
+
+    DyDictObject *o = (DyDictObject *)self;
     DyHash hash;
+    ssize_t slot = -1;
 
     if (!Dy_HashEx(key, &hash))
     {
         TE__unhashable(key);
         return_null;
     }
-    
-    DyDictObject *cur = self;
-    DyObject *result = Dy_Undefined;
-    
-    while (cur && result == Dy_Undefined)
+
+    if (o->used)
+        slot = find_slot(o->table, key, hash);
+
+    if (slot < 0)
     {
-    	result = dict_get(cur, key, hash);
-    	cur = cur->parent;
+        if (!def)
+        {
+            __KeyError(key);
+            return_null;
+        }
+        return Dy_Retain(def);
     }
-    
-    return result;
-}
 
-DyObject *dict_getitem(DyDictObject *self, DyObject *key)
-{
-    DyObject *result = dict_getitemu(self, key);
-    if (result == Dy_Undefined)
+    // Split dicts can't lose keys
+    if (o->shape)
     {
-    	__KeyError(key);
-    	return_null;
+        if (!dict_unshare(o))
+            return_null;
+        slot = find_slot(o->table, key, hash);
     }
-    else
-    	return result;
-}
 
-// Repr ------------------------------------------------------------------------
-#include "buildstring.h"
+    DyObject *k, *v;
+    remove_slot(o, slot, &k, &v);
+    dict_touch(o);
+
+    Dy_Release(k);
+    return v;
+}
 
-dy_buildstring_t *dict_bsrepr(dy_buildstring_t *bs, DyDictObject *self)
+bool DyDict_Upsert(DyObject *self, DyObject *key, DyDict_UpsertFn fn, void *data)
 {
-    dy_buildstring_t *lbs = bs = dy_buildstring_append(bs, "{", 1);
-    if (!lbs)
+    if (DyErr_CheckArg("DyDict_Upsert", 0, DY_DICT, self))
+        return_error(false);
+
+    DyDictObject *o = (DyDictObject *)self;
+    DyHash hash;
+
+    if (!Dy_HashEx(key, &hash))
     {
-        DyErr_SetMemoryError();
-        return_null;
+        TE__unhashable(key);
+        return_error(false);
     }
 
-    for (int i = 0; i < DY_TABLE_SIZE; ++i)
-        for (bucket_t *b = &self->table[i]; b; b = b->next)
-        {
-            if (!b->key)
-                continue;
+    dict_entry_t *e = find_entry(o, key, hash);
+    uint64_t version = o->version;
 
-            // KEY
-            lbs = bsrepr(lbs, b->key);
-            if (!lbs)
-                return_null;
+    DyObject *value = fn(key, e ? *entry_value(o, e) : NULL, data);
+    if (!value)
+        return_error(false);
 
-            // SEPARATOR
-            lbs = dy_buildstring_append(lbs, ": ", 2);
-            if (!lbs)
-            {
-                DyErr_SetMemoryError();
-                return_null;
-            }
+    bool res = true;
 
-            // VALUE
-            lbs = bsrepr(lbs, b->value);
-            if (!lbs)
-                return_null;
+    // If the callback didn't touch the dict, the probe result is still good
+    if (o->version == version && (e || !o->shape))
+    {
+        if (e)
+            Dy_Release(*entry_value(o, e));
+        else
+            e = insert_entry(o, key, hash);
 
-            // SEPARATOR
-            lbs = dy_buildstring_append(lbs, ", ", 2);
-            if (!lbs)
-            {
-                DyErr_SetMemoryError();
-                return_null;
-            }
+        if (e)
+        {
+            *entry_value(o, e) = value;
+            dict_touch(o);
+            return true;
         }
-
-    if (bs != lbs)
-    {
-        lbs->part = "}";
-        lbs->part_size = 1;
+        else
+            res = false;
     }
     else
+        res = dict_setitem_hashed(o, key, hash, value);
+
+    Dy_Release(value);
+
+    if (!res)
+        return_error(false);
+    return true;
+}
+
+// Repr ------------------------------------------------------------------------
+#include "stringbuilder.h"
+
+bool dict_sbrepr(DyStringBuilder *sb, DyDictObject *self)
+{
+    if (!DyStringBuilder_AppendChar(sb, '{'))
+        return_error(false);
+
+    bool first = true;
+    dict_table_t *t = self->table;
+    for (size_t i = 0; t && i < t->nentries; ++i)
     {
-        lbs->part = "{}";
-        lbs->part_size = 2;
+        dict_entry_t *b = &t->entries[i];
+        if (!b->key)
+            continue;
+
+        if (!first && !DyStringBuilder_Append(sb, ", ", 2))
+            return_error(false);
+        first = false;
+
+        if (!sbrepr(sb, b->key)
+         || !DyStringBuilder_Append(sb, ": ", 2)
+         || !sbrepr(sb, *entry_value(self, b)))
+            return_error(false);
     }
 
-    return lbs;
+    return DyStringBuilder_AppendChar(sb, '}');
 }
 
 // Get pointer to containing structure from member pointer
@@ -429,22 +1403,31 @@ dy_buildstring_t *dict_bsrepr(dy_buildstring_t *bs, DyDictObject *self)
 })
 
 // Iteration -------------------------------------------------------------------
-inline static bool _find_next_table_block(DyDictIterator *it)
+// Position the iterator at the first live entry at or after index
+inline static bool _find_next_slot(DyDictIterator *it, size_t index)
 {
-    do // skip empty slots
-    {
-        ++it->table_block;
-        int x = it->table_block - it->dict->table;
-        if (it->table_block - it->dict->table >= DY_TABLE_SIZE) // stop after table ends
+    DyDictObject *d = (DyDictObject *)it->dict;
+    dict_table_t *t = d->table;
+    size_t size = t ? t->nentries : 0;
+
+    for (; index < size; ++index)
+        if (t->entries[index].key)
         {
-            it->table_block = NULL;
-            it->entry = NULL;
-            return false;
+            it->index = index;
+            if (d->shape)
+            {
+                it->pair.key = t->entries[index].key;
+                it->pair.value = d->values[index];
+                it->entry = &it->pair;
+            }
+            else
+                it->entry = (DyDict_IterPair *) &t->entries[index].key;
+            return true;
         }
-    }
-    while (!it->table_block->key);
-    it->entry = (DyDict_IterPair *) &it->table_block->key;
-    return true;
+
+    it->index = size;
+    it->entry = NULL;
+    return false;
 }
 
 DyDict_IterPair **DyDict_Iter(DyObject *self)
@@ -454,28 +1437,63 @@ DyDict_IterPair **DyDict_Iter(DyObject *self)
 
     DyDictIterator *it = dy_malloc(sizeof(DyDictIterator));
     if (!it)
+    {
         DyErr_SetMemoryError();
+        return_null;
+    }
 
-    it->dict = (DyDictObject *) self;
-    it->table_block = it->dict->table - 1;
+    it->dict = self;
 
-    _find_next_table_block(it);
+    _find_next_slot(it, 0);
     return &it->entry;
 }
 
+bool DyDict_IterInit(DyDict_Iterator *it, DyObject *self)
+{
+    if (DyErr_CheckArg("DyDict_IterInit", 1, DY_DICT, self))
+    {
+        it->entry = NULL;
+        return_error(false);
+    }
+
+    it->dict = self;
+
+    _find_next_slot(it, 0);
+    return true;
+}
+
+bool DyDict_ForEach(DyObject *self, DyDict_ForEachFn fn, void *data)
+{
+    if (DyErr_CheckArg("DyDict_ForEach", 0, DY_DICT, self))
+        return_error(false);
+
+    DyDictObject *d = (DyDictObject *)self;
+    dict_table_t *t = d->table;
+    size_t n = t ? t->nentries : 0;
+
+    if (d->shape)
+    {
+        for (size_t i = 0; i < n; ++i)
+            if (!fn(t->entries[i].key, d->values[i], data))
+                return false;
+    }
+    else
+    {
+        for (size_t i = 0; i < n; ++i)
+            if (t->entries[i].key && !fn(t->entries[i].key, t->entries[i].value, data))
+                return false;
+    }
+
+    return true;
+}
+
 bool DyDict_IterNext(DyDict_IterPair** itp)
 {
     DyDictIterator *it = container_of(itp, DyDictIterator, entry);
-    if (!it->table_block)
+    if (!it->entry)
         return false;
 
-    bucket_t *bucket = container_of(it->entry, bucket_t, key);
-    if (bucket->next)
-    {
-        it->entry = (DyDict_IterPair *) &bucket->next->key;
-        return true;
-    }
-    return _find_next_table_block(it);
+    return _find_next_slot(it, it->index + 1);
 }
 
 void DyDict_IterFree(DyDict_IterPair **itp)
@@ -19,29 +19,123 @@
 #pragma once
 
 #include "dy_p.h"
-#include "freelist_p.h"
-
-#define DY_BLOCK_SIZE 8
-#define DY_TABLE_SIZE 1
 
 /**
  * @file dict_p.h
  * @brief Dictionary implementation header
+ *
+ * Dictionaries keep their items in a dense array of entries, in insertion
+ * order, plus a separate open-addressing index that maps hashes to positions
+ * in that array (the same layout CPython uses since 3.6).
+ *
+ * The index uses linear probing. Every index slot has a control byte holding
+ * either DICT_CTRL_EMPTY or the low 7 bits of the (mixed) key hash. Lookups
+ * compare a whole group of DICT_GROUP_WIDTH control bytes at once and only
+ * touch the entries whose control byte matches. Deletion shifts the following
+ * index slots back instead of leaving tombstones, so a probe always ends at
+ * the first empty slot. The entry itself becomes a hole (key == NULL) that is
+ * squeezed out the next time the table is rebuilt.
+ *
+ * Dicts created with DyDict_NewShared start out in split mode: the keys live
+ * in a table owned by a shape that is shared by all dicts which received the
+ * same string keys in the same order, and the dict itself only stores a
+ * vector of values, indexed by entry number. Adding a key moves the dict to
+ * the child shape for that key (the transition is created on first use).
+ * Anything a shape cannot express (deleting, non-string keys, too many keys)
+ * converts the dict to a regular combined table.
+ *
+ * A combined table whose probe sequences grow past DICT_FLOOD_GROUPS (a sign
+ * of deliberately colliding keys) is rebuilt in keyed mode: index positions
+ * then come from Dy_hash_siphash13() of the key instead of the key's hash.
  */
-// A bucket
-typedef struct bucket_t {
-    DyHash hash;
+
+// Number of control bytes compared per probe step
+#define DICT_GROUP_WIDTH 16
+
+// Control byte values
+#define DICT_CTRL_EMPTY 0x80
+
+// Probe length (in groups) after which a table switches to keyed mode
+#define DICT_FLOOD_GROUPS 8
+
+// Maximum load factor of the index (DICT_LOAD_NUM / DICT_LOAD_DEN)
+#define DICT_LOAD_NUM 3
+#define DICT_LOAD_DEN 4
+
+// Number of entries that fit a table with an index of the given size
+#define DICT_USABLE(size) ((size) * DICT_LOAD_NUM / DICT_LOAD_DEN)
+
+// Smallest index ever allocated
+#define DICT_MIN_SIZE 8
+
+// Dict flags (in the object header)
+#define DICT_INTERN_KEYS 1
+
+// An entry. key and value must stay adjacent, they double as DyDict_IterPair
+typedef struct dict_entry_t {
     struct _DyObject *key;
     struct _DyObject *value;
-    struct bucket_t *next;
-} bucket_t;
+    DyHash hash;
+} dict_entry_t;
+
+// A table. Allocated in one piece: the header, the entries, the index and the
+// control bytes, with the first DICT_GROUP_WIDTH control bytes mirrored at the end.
+typedef struct dict_table_t {
+    // Index size - 1; the index size is always a power of 2
+    size_t mask;
+
+    // Capacity of the entry array
+    size_t usable;
 
-// Linked List to store the blocks
-typedef struct bucket_block_t {
-    struct bucket_block_t *next;
-    size_t size;
-    freelist_struct(bucket_t, buckets);
-} bucket_block_t;
+    // Entries used so far, including holes
+    size_t nentries;
+
+    // Whether all keys ever stored are interned strings.
+    // Lookups with an interned key then only need to compare pointers.
+    bool interned;
+
+    // Whether index positions are derived from the keyed hash, and whether
+    // a probe sequence exceeding DICT_FLOOD_GROUPS was seen
+    bool keyed;
+    bool flooded;
+
+    uint8_t *ctrl;
+    uint32_t *index;
+
+    dict_entry_t entries[];
+} dict_table_t;
+
+// Limits for shared key tables; dicts exceeding them are converted
+#define DICT_SHAPE_MAX_KEYS 32
+#define DICT_SHAPE_MAX_CHILDREN 64
+
+// A shape. Immutable once created, except for the list of children
+typedef struct dict_shape_t {
+    size_t refcnt;
+
+    // The shape this one was derived from, by adding the last key in table
+    struct dict_shape_t *parent;
+
+    // Transitions, as a linked list of the shapes derived from this one
+    struct dict_shape_t *children;
+    struct dict_shape_t *sibling;
+
+    // The keys; NULL for the root shape. Never contains holes
+    struct dict_table_t *table;
+} dict_shape_t;
+
+// Flattened view of all ancestors of a dict, see DyDict_EnableLookupCache
+typedef struct dict_lookup_cache_t {
+    // A plain dict holding the merged items of all ancestors
+    struct _DyDictObject *flat;
+
+    DyDict_LookupCacheStats stats;
+
+    // The ancestors, nearest first, and their versions when flat was built
+    size_t depth;
+    struct _DyDictObject **chain;
+    uint64_t versions[];
+} dict_lookup_cache_t;
 
 // The actual object structure
 typedef struct _DyDictObject {
@@ -50,29 +144,45 @@ typedef struct _DyDictObject {
     // Simple Inheritance
     struct _DyDictObject *parent;
 
-    // Bucket Blocks
-    struct bucket_block_t *blocks;
+    // Number of items
+    size_t used;
 
-    // The embedded table
-    struct bucket_t table[DY_TABLE_SIZE];
-} DyDictObject;
+    // The table; NULL until the first item is inserted.
+    // In split mode this is borrowed from the shape.
+    struct dict_table_t *table;
 
-typedef struct _DyDictIterator {
-    struct DyDict_IterPair *entry; // is bucket_t.key
+    // Split mode only: the shape and the values, in entry order
+    struct dict_shape_t *shape;
+    struct _DyObject **values;
+    size_t values_size;
 
-    struct _DyDictObject *dict;
-    struct bucket_t *table_block;
-} DyDictIterator;
+    // Changes on every modification. Taken from per-thread blocks of a
+    // global counter, so versions are never reused, not even by another dict.
+    // They only increase within a thread, not across threads.
+    uint64_t version;
+
+    // Optional flattened view of the ancestors
+    struct dict_lookup_cache_t *cache;
+} DyDictObject;
+
+// DyDict_Iterator.entry points either at dict_entry_t.key or, in split mode,
+// where keys and values aren't adjacent, at DyDict_Iterator.pair
+typedef DyDict_Iterator DyDictIterator;
 
 // Prototypes
 void dict_destroy(DyDictObject *self);
 bool dict_clean(DyDictObject *self);
 
-struct dy_buildstring_t *dict_bsrepr(struct dy_buildstring_t *bs, DyDictObject *self);
+DyObject *dict_from_arrays(DyObject **keys, DyObject **values, size_t n, bool shared);
+
+bool dict_sbrepr(struct DyStringBuilder *sb, DyDictObject *self);
 
 DyObject *dict_get(DyDictObject *o, DyObject *key, DyHash hash);
+DyObject *dict_get_inherited(DyDictObject *o, DyObject *key, DyHash hash);
 
 DyObject *dict_getitem(DyDictObject *self, DyObject *key);
 DyObject *dict_getitemu(DyDictObject *self, DyObject *key);
+DyObject *dict_getitem_hashed(DyDictObject *self, DyObject *key, DyHash hash);
 
 bool dict_setitem(DyDictObject *self, DyObject *key, DyObject *value);
+bool dict_setitem_hashed(DyDictObject *self, DyObject *key, DyHash hash, DyObject *value);
@@ -20,10 +20,13 @@
 #include "string_p.h"
 #include "dict_p.h"
 #include "list_p.h"
+#include "array_p.h"
+#include "deque_p.h"
+#include "pool_p.h"
 #include "userdata_p.h"
 #include "exceptions.h"
 #include "dystring.h"
-#include "buildstring.h"
+#include "stringbuilder.h"
 #include "dy.h"
 
 #include <stdlib.h>
@@ -38,23 +41,24 @@ void Dy_InitObject(DyObject *o, DyObjectType t)
 {
     o->refcnt = 1;
     o->type = t;
+    o->flags = 0;
 }
 
 // Constants
-DyObject _dy_undefined = { .type = DY_NONE, .refcnt = 1 };
+DyObject _dy_undefined = { .type = DY_NONE, .flags = DY_IMMORTAL, .refcnt = 1 };
 DyObject *Dy_Undefined = &_dy_undefined;
 
 bool      DyUndefined_Check(DyObject *obj);
 
-DyObject _dy_none = { .type = DY_NONE, .refcnt = 1 };
+DyObject _dy_none = { .type = DY_NONE, .flags = DY_IMMORTAL, .refcnt = 1 };
 DyObject *Dy_None = &_dy_none;
 
 bool      DyNone_Check(DyObject *obj);
 
-DyObject _dy_true = { .type = DY_BOOL, .refcnt = 1 };
+DyObject _dy_true = { .type = DY_BOOL, .flags = DY_IMMORTAL, .refcnt = 1 };
 DyObject *Dy_True = &_dy_true;
 
-DyObject _dy_false = { .type = DY_BOOL, .refcnt = 1 };
+DyObject _dy_false = { .type = DY_BOOL, .flags = DY_IMMORTAL, .refcnt = 1 };
 DyObject *Dy_False = &_dy_false;
 
 bool      DyBool_Check(DyObject *obj);
@@ -71,16 +75,39 @@ bool DyLong_Check(DyObject *self)
     return self->type == DY_LONG;
 }
 
-DyObject *DyLong_New(int64_t value)
+// Small integers are preallocated, most numbers in real data are
+#define SMALL_INT_MIN -5
+#define SMALL_INT_MAX 1024
+
+static DyIntegral_Object small_ints[SMALL_INT_MAX - SMALL_INT_MIN + 1];
+static bool small_ints_ready = false;
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void init_small_ints(void)
 {
-    DyObject *o = NEW(DyIntegral_Object);
-    if (!o)
+    for (int64_t i = SMALL_INT_MIN; i <= SMALL_INT_MAX; ++i)
     {
-        DyErr_SetMemoryError();
-        return_null;
+        DyIntegral_Object *o = &small_ints[i - SMALL_INT_MIN];
+        Dy_InitObject((DyObject*)o, DY_LONG);
+        o->flags = DY_IMMORTAL;
+        o->value = i;
     }
+    small_ints_ready = true;
+}
+#endif
+
+// An integer key that only lives for one lookup
+#define LONG_TEMP(v) ((DyIntegral_Object){ .type = DY_LONG, .flags = DY_IMMORTAL, .refcnt = 1, .value = (v) })
+
+DyObject *DyLong_New(int64_t value)
+{
+    if (small_ints_ready && SMALL_INT_MIN <= value && value <= SMALL_INT_MAX)
+        return (DyObject*)&small_ints[value - SMALL_INT_MIN];
 
-    Dy_InitObject(o, DY_LONG);
+    DyObject *o = pool_new(DY_LONG, sizeof(DyIntegral_Object));
+    if (!o)
+        return_null;
 
     ((DyIntegral_Object*)o)->value = value;
 
@@ -109,14 +136,9 @@ bool DyFloat_Check(DyObject *self)
 
 DyObject *DyFloat_New(double value)
 {
-    DyObject *o = NEW(DyFloating_Object);
+    DyObject *o = pool_new(DY_FLOAT, sizeof(DyFloating_Object));
     if (!o)
-    {
-        DyErr_SetMemoryError();
         return_null;
-    }
-
-    Dy_InitObject(o, DY_FLOAT);
 
     ((DyFloating_Object*)o)->value = value;
 
@@ -139,7 +161,8 @@ DyObject *Dy_Retain(DyObject *self)
 {
     //if (Dy_Type(self) != DY_STRING)
     //    printf("Retain %s %d\n", Dy_AsRepr(self), self->refcnt);
-    ++self->refcnt;
+    if (!(object_flags(self) & DY_IMMORTAL))
+        ++self->refcnt;
     return self;
 }
 
@@ -147,13 +170,14 @@ void Dy_Release(DyObject *self)
 {
     //if (Dy_Type(self) != DY_STRING)
     //    printf("Release 0x%p %s %d\n", self, Dy_AsRepr(self), self->refcnt);
-    if (!--self->refcnt)
+    if (!(object_flags(self) & DY_IMMORTAL) && !--self->refcnt)
         Dy_FreeObject(self);
 }
 
 DyObject *Dy_Pass(DyObject *self)
 {
-    --self->refcnt;
+    if (!(object_flags(self) & DY_IMMORTAL))
+        --self->refcnt;
     return self;
 }
 
@@ -179,8 +203,31 @@ void Dy_FreeObject(DyObject *o)
         exception_destroy(o);
     else if (o->type == DY_USERDATA)
         userdata_destroy(o);
+    else if (o->type == DY_ARRAY)
+        array_destroy((DyArrayObject *) o);
+    else if (o->type == DY_DEQUE)
+        deque_destroy((DyDequeObject *) o);
 
-    dy_free(o);
+    switch (o->type)
+    {
+    case DY_LONG:
+        pool_free(o, sizeof(DyIntegral_Object));
+        break;
+    case DY_FLOAT:
+        pool_free(o, sizeof(DyFloating_Object));
+        break;
+    case DY_LIST:
+        pool_free(o, sizeof(DyListObject));
+        break;
+    case DY_DICT:
+        pool_free(o, sizeof(DyDictObject));
+        break;
+    case DY_USERDATA:
+        pool_free(o, sizeof(DyUserdataObject));
+        break;
+    default:
+        dy_free(o);
+    }
 }
 
 
@@ -231,101 +278,69 @@ bool Dy_Equals(DyObject *a, DyObject *b)
         return ((DyFloating_Object*)a)->value == ((DyFloating_Object*)b)->value;
     case DY_STRING:
         return DyString_Equals(((DyStringObject *)a), ((DyStringObject *)b));
+    case DY_ARRAY:
+        return array_equals((DyArrayObject *)a, (DyArrayObject *)b);
     default:
         return false; // FIXME: other types
     }
 }
 
-static bool has_repr = false;
-static DyObject *none_repr;
-static DyObject *true_repr;
-static DyObject *false_repr;
-
 DyObject *Dy_Repr(DyObject *obj)
 {
-    dy_buildstring_t *bs = dy_buildstring_new("", 0);
-    dy_buildstring_t *lbs = bsrepr(bs, obj);
-    DyObject *result = NULL;
+    DyStringBuilder sb;
+    DyStringBuilder_Init(&sb);
 
-    if (lbs)
-        result = dy_buildstring_build(bs);
-    else
-        assert(DyErr_Occurred());
-
-    dy_buildstring_free(bs);
-
-    return result;
-}
-
-
-#define bs_printf(bs, fmt, ...) \
-({ \
-    nbs = dy_buildstring_printf(bs, fmt, __VA_ARGS__); \
-    if (!nbs) \
-    { \
-        DyErr_SetMemoryError(); \
-        return_null; \
-    } \
-    nbs; \
-})
-
-dy_buildstring_t *bsrepr(dy_buildstring_t *bs, DyObject *self)
-{
-    if (!has_repr)
+    if (!sbrepr(&sb, obj))
     {
-        has_repr = true;
-        none_repr = DyString_InternStringFromString("None");
-        true_repr = DyString_InternStringFromString("True");
-        false_repr = DyString_InternStringFromString("False");
+        DyStringBuilder_Discard(&sb);
+        return_null;
     }
 
-    dy_buildstring_t *nbs;
+    return DyStringBuilder_Finish(&sb);
+}
 
+bool sbrepr(DyStringBuilder *sb, DyObject *self)
+{
     switch(self->type)
     {
     case DY_NONE:
-        return dy_buildstring_append2(bs, none_repr);
+        return DyStringBuilder_Append(sb, "None", 4);
     case DY_BOOL:
-        return dy_buildstring_append2(bs, self == Dy_True ? true_repr : false_repr);
+        if (self == Dy_True)
+            return DyStringBuilder_Append(sb, "True", 4);
+        return DyStringBuilder_Append(sb, "False", 5);
     case DY_LONG:
-        return bs_printf(bs, "%" PRId64, ((DyIntegral_Object*)self)->value);
+        return DyStringBuilder_AppendLong(sb, ((DyIntegral_Object*)self)->value);
     case DY_FLOAT:
-        return bs_printf(bs, "%f", ((DyFloating_Object*)self)->value);
+        return DyStringBuilder_AppendFloat(sb, ((DyFloating_Object*)self)->value);
     case DY_STRING:
-        return string_bsrepr(bs, (DyStringObject *)self);
+        return string_sbrepr(sb, (DyStringObject *)self);
     case DY_DICT:
-        return dict_bsrepr(bs, (DyDictObject *)self);
+        return dict_sbrepr(sb, (DyDictObject *)self);
     case DY_LIST:
-    	return list_bsrepr(bs, (DyListObject *)self);
+    	return list_sbrepr(sb, (DyListObject *)self);
     case DY_USERDATA:
-        nbs = dy_buildstring_append(bs, "<Userdata ", 10);
-        if (!nbs)
-        {
-            DyErr_SetMemoryError();
-            return_null;
-        }
-        if (((DyUserdataObject*)self)->name)
-            nbs = bs_printf(bs, "'%s' ", ((DyUserdataObject*)self)->name);
-        return bs_printf(bs, "[%p:%p] (%02x)>",
+        if (!DyStringBuilder_Append(sb, "<Userdata ", 10))
+            return_error(false);
+        if (((DyUserdataObject*)self)->name
+         && !DyStringBuilder_Printf(sb, "'%s' ", ((DyUserdataObject*)self)->name))
+            return_error(false);
+        return DyStringBuilder_Printf(sb, "[%p:%p] (%02x)>",
             ((DyUserdataObject*)self)->data,
-            ((DyUserdataObject*)self)->call_fn,
-            ((DyUserdataObject*)self)->flags
+            (void*)((DyUserdataObject*)self)->call_fn,
+            ((DyUserdataObject*)self)->flags & ~DY_POOLED
         );
+    case DY_ARRAY:
+        return array_sbrepr(sb, (DyArrayObject *)self);
+    case DY_DEQUE:
+        return deque_sbrepr(sb, (DyDequeObject *)self);
     case DY_EXCEPTION:
-        return bs_printf(bs, "<Exception %s: %s>", DyErr_ErrId(self), DyErr_Message(self));
+        return DyStringBuilder_Printf(sb, "<Exception %s: %s>", DyErr_ErrId(self), DyErr_Message(self));
     default:
-        nbs = dy_buildstring_append(bs, "<<NotImplemented>>", 18);
-        if (!nbs)
-        {
-            DyErr_SetMemoryError();
-            return_null;
-        }
-        return nbs;
+        return DyStringBuilder_Append(sb, "<<NotImplemented>>", 18);
     }
 }
 
-#undef bs_printf
-
 
 DyObject *Dy_Str(DyObject *obj)
 {
@@ -399,6 +414,13 @@ DyObject *Dy_GetItem(DyObject *self, DyObject *key)
     		return_null;
     	}
     	return list_getitem((DyListObject *)self, DyLong_Get(key));
+    case DY_DEQUE:
+    	if (key->type != DY_LONG)
+    	{
+    		TE__listindex(Dy_GetTypeName(Dy_Type(key)));
+    		return_null;
+    	}
+    	return deque_getitem((DyDequeObject *)self, DyLong_Get(key));
     default:
     	TE__notsubscriptable(self);
     	return_null;
@@ -436,18 +458,13 @@ DyObject *Dy_GetItemLong(DyObject *self, long key)
     {
     case DY_DICT:
     {
-    	DyObject *k = DyLong_New(key);
-        if (!k)
-            return_null;
-
-    	DyObject *r = dict_getitem((DyDictObject *)self, k);
-
-    	Dy_Release(k);
-
-    	return r;
+    	DyIntegral_Object k = LONG_TEMP(key);
+    	return dict_getitem((DyDictObject *)self, (DyObject *)&k);
     }
     case DY_LIST:
     	return list_getitem((DyListObject *)self, key);
+    case DY_DEQUE:
+    	return deque_getitem((DyDequeObject *)self, key);
     default:
     	TE__notsubscriptable(self);
     	return_null;
@@ -467,6 +484,13 @@ DyObject *Dy_GetItemU(DyObject *self, DyObject *key)
     		return_null;
     	}
     	return list_getitemu((DyListObject *)self, DyLong_Get(key));
+    case DY_DEQUE:
+    	if (key->type != DY_LONG)
+    	{
+    		TE__listindex(Dy_GetTypeName(Dy_Type(key)));
+    		return_null;
+    	}
+    	return deque_getitemu((DyDequeObject *)self, DyLong_Get(key));
     default:
     	TE__notsubscriptable(self);
     	return_null;
@@ -479,18 +503,13 @@ DyObject *Dy_GetItemLongU(DyObject *self, long key)
     {
     case DY_DICT:
     {
-    	DyObject *k = DyLong_New(key);
-        if (!k)
-            return_null;
-
-    	DyObject *r = dict_getitem((DyDictObject *)self, k);
-
-    	Dy_Release(k);
-
-    	return r;
+    	DyIntegral_Object k = LONG_TEMP(key);
+    	return dict_getitemu((DyDictObject *)self, (DyObject *)&k);
     }
     case DY_LIST:
     	return list_getitemu((DyListObject *)self, key);
+    case DY_DEQUE:
+    	return deque_getitemu((DyDequeObject *)self, key);
     default:
     	TE__notsubscriptable(self);
     	return_null;
@@ -562,6 +581,13 @@ bool Dy_SetItem(DyObject *self, DyObject *key, DyObject *value)
     		return_error(false);
     	}
     	return list_setitem((DyListObject *) self, DyLong_Get(key), value);
+    case DY_DEQUE:
+    	if (key->type != DY_LONG)
+    	{
+    		TE__listindex(Dy_GetTypeName(Dy_Type(key)));
+    		return_error(false);
+    	}
+    	return deque_setitem((DyDequeObject *)self, DyLong_Get(key), value);
     default:
     	TE__notsubscriptable(self);
     	return_error(false);
@@ -611,12 +637,113 @@ bool Dy_SetItemLong(DyObject *self, long key, DyObject *value)
     	}
     	case DY_LIST:
     		return list_setitem((DyListObject *)self, key, value);
+    	case DY_DEQUE:
+    		return deque_setitem((DyDequeObject *)self, key, value);
     	default:
     		TE__notsubscriptable(self);
     		return_error(false);
     }
 }
 
+// Key handles
+bool DyKey_Init(DyKey *key, const char *cstr)
+{
+    key->cstr = cstr;
+    key->str = NULL;
+    key->hash = 0;
+
+    DyObject *str = DyString_InternStringFromString(cstr);
+    if (!str)
+        return_error(false);
+
+    key->hash = string_hash((DyStringObject *)str);
+    key->str = str;
+    return true;
+}
+
+void DyKey_Clear(DyKey *key)
+{
+    DyObject *str = __atomic_exchange_n(&key->str, NULL, __ATOMIC_ACQ_REL);
+    if (str)
+        Dy_Release(str);
+}
+
+// Resolve a key handle on first use. Racing threads resolve to the same
+// interned string; the loser's extra reference only keeps it alive.
+static inline bool key_resolve(DyKey *key)
+{
+    if (__atomic_load_n(&key->str, __ATOMIC_ACQUIRE))
+        return true;
+
+    DyObject *str = DyString_InternStringFromString(key->cstr);
+    if (!str)
+        return_error(false);
+
+    key->hash = string_hash((DyStringObject *)str);
+    __atomic_store_n(&key->str, str, __ATOMIC_RELEASE);
+    return true;
+}
+
+DyObject *Dy_GetItemKey(DyObject *self, DyKey *key)
+{
+    switch (self->type)
+    {
+    case DY_DICT:
+        if (!key_resolve(key))
+            return_null;
+        return dict_getitem_hashed((DyDictObject *)self, key->str, key->hash);
+    case DY_LIST:
+    	TE__listindex(Dy_GetTypeName(DY_STRING));
+    	return_null;
+    default:
+    	TE__notsubscriptable(self);
+    	return_null;
+    }
+}
+
+DyObject *Dy_GetItemKeyU(DyObject *self, DyKey *key)
+{
+    switch (self->type)
+    {
+    case DY_DICT:
+        if (!key_resolve(key))
+            return_null;
+        return dict_get_inherited((DyDictObject *)self, key->str, key->hash);
+    case DY_LIST:
+    	TE__listindex(Dy_GetTypeName(DY_STRING));
+    	return_null;
+    default:
+    	TE__notsubscriptable(self);
+    	return_null;
+    }
+}
+
+DyObject *Dy_GetItemKeyD(DyObject *self, DyKey *key, DyObject *def)
+{
+    DyObject *res = Dy_GetItemKeyU(self, key);
+    if (res == Dy_Undefined)
+        return def;
+    else
+        return res;
+}
+
+bool Dy_SetItemKey(DyObject *self, DyKey *key, DyObject *value)
+{
+    switch (self->type)
+    {
+    case DY_DICT:
+        if (!key_resolve(key))
+            return_error(false);
+        return dict_setitem_hashed((DyDictObject *)self, key->str, key->hash, value);
+    case DY_LIST:
+    	TE__listindex(Dy_GetTypeName(DY_STRING));
+    	return_error(false);
+    default:
+    	TE__notsubscriptable(self);
+    	return_error(false);
+    }
+}
+
 // Length
 size_t Dy_Length(DyObject *self)
 {
@@ -626,8 +753,14 @@ size_t Dy_Length(DyObject *self)
     	return ((DyListObject *)self)->size;
     case DY_STRING:
     	return ((DyStringObject *)self)->size;
+    case DY_DICT:
+    	return ((DyDictObject *)self)->used;
+    case DY_ARRAY:
+    	return ((DyArrayObject *)self)->size;
+    case DY_DEQUE:
+    	return ((DyDequeObject *)self)->size;
     default:
-    	DyErr_SetArgumentTypeError("Dy_Length", 0, "list or string", Dy_GetTypeName(self->type));
+    	DyErr_SetArgumentTypeError("Dy_Length", 0, "list, dict, array, deque or string", Dy_GetTypeName(self->type));
     	return_error(0);
     }
 }
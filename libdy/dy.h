@@ -28,7 +28,10 @@
 #include "constants.h"
 #include "numbers.h"
 #include "collections.h"
+#include "array.h"
+#include "region.h"
 #include "dystring.h"
+#include "stringbuilder.h"
 #include "call.h"
 
 #include "exceptions.h"
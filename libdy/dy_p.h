@@ -34,15 +34,32 @@
 #define /*T**/ NEWN(/*typename*/ T, /*int*/ N)\
     memset(dy_malloc(sizeof(T)*N), 0, sizeof(T)*N)
 
-// Opaque Object Header
+// Opaque Object Header, 8 bytes.
+// The flags are for the object type to use, except for DY_IMMORTAL.
 #define DyObject_HEAD\
     uint8_t type;\
-    _Atomic(unsigned long) refcnt;
+    uint8_t flags;\
+    _Atomic(uint32_t) refcnt;
 
 struct _DyObject {
     DyObject_HEAD
 };
 
+// Statically allocated objects that are never freed. Their reference count
+// is left alone, so threads sharing them don't fight over the cache line.
+#define DY_IMMORTAL 0x80
+
+// Numbers, lists, dicts and userdata that live in a pool slab.
+// Strings use this bit for themselves, they are never pooled.
+#define DY_POOLED 0x40
+
+// Some types add flags to objects that are already shared (strings cache
+// their encoding), so code that may run on other threads reads them atomically
+static inline uint8_t object_flags(DyObject *o)
+{
+    return __atomic_load_n(&o->flags, __ATOMIC_RELAXED);
+}
+
 // Private Prototypes
 void Dy_InitObject(DyObject *, DyObjectType);
 void Dy_FreeObject(DyObject *);
@@ -52,8 +69,8 @@ bool Dy_HashEx(DyObject *, DyHash *);
 void exception_destroy(DyObject *exc);
 
 // Internal repr
-struct dy_buildstring_t;
-struct dy_buildstring_t *bsrepr(struct dy_buildstring_t *bs, DyObject *self);
+struct DyStringBuilder;
+bool sbrepr(struct DyStringBuilder *sb, DyObject *self);
 
 #define return_error(T) { \
     assert(DyErr_Occurred() && "return_error: error return without exception set."); \
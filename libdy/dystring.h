@@ -28,7 +28,9 @@
 #include "config.h"
 #include "object.h"
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -80,12 +82,134 @@ static inline DyObject *DyString_FromString(const char *cstr)
  */
 LIBDY_API const char *DyString_AsString(DyObject *self);
 
+/**
+ * @brief Get the characters of a string object without terminating them
+ * @param self The string object
+ * @param size Where to store the string size
+ * @return A readonly character buffer of *size bytes, not necessarily NUL-terminated
+ * @sa DyString_AsString
+ */
+LIBDY_API const char *DyString_AsStringAndSize(DyObject *self, size_t *size);
+
+/**
+ * @brief Concatenate two strings
+ * @param a The first string
+ * @param b The second string
+ * @return New reference to a string object
+ */
+LIBDY_API DyObject *DyString_Concat(DyObject *a, DyObject *b);
+
+/**
+ * @brief Join a list of strings
+ * @param sep The separator put between the items
+ * @param list A list of string objects
+ * @return New reference to a string object
+ */
+LIBDY_API DyObject *DyString_Join(DyObject *sep, DyObject *list);
+
+/**
+ * @brief Create a string object from printf-style formatted text
+ * @param fmt The format string
+ * @return New reference to a string object
+ * @sa DyStringBuilder_Printf for composing longer strings
+ */
+LIBDY_API DyObject *DyString_Format(const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 1, 2)))
+#endif
+    ;
+
+/**
+ * @brief Create a string object from printf-style formatted text
+ * @sa DyString_Format
+ */
+LIBDY_API DyObject *DyString_FormatV(const char *fmt, va_list args);
+
+
+///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name Encoding
+///@brief Strings are not validated unless DyHost_SetCheckUTF8() was enabled.
+///
+/// The encoding of a string is checked the first time it is asked for and
+/// remembered. Strings from the JSON parser are known to be valid already.
+/**
+ * @brief Check whether a string is valid UTF-8
+ * @param self The string object
+ */
+LIBDY_API bool DyString_IsUTF8(DyObject *self);
+
+/**
+ * @brief Check whether a string consists of ASCII characters only
+ * @param self The string object
+ */
+LIBDY_API bool DyString_IsASCII(DyObject *self);
+
+/**
+ * @brief Get the number of codepoints in a string
+ * @param self The string object
+ * @return The number of characters
+ *
+ * O(1) for ASCII strings. Other strings are counted on every call, since
+ * the count isn't cached.
+ * @sa Dy_Length for the size in bytes
+ */
+LIBDY_API size_t DyString_Length(DyObject *self);
+
+/**
+ * @brief Get a codepoint by its index
+ * @param self The string object, which must be valid UTF-8
+ * @param index The codepoint index; O(1) for ASCII strings, a scan from
+ *              the start otherwise
+ * @return The codepoint or -1 on error
+ */
+LIBDY_API int32_t DyString_CodepointAt(DyObject *self, size_t index);
+
+
+///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name String Views
+///@brief Strings can refer to characters they don't own instead of copying them.
+///
+/// A view keeps the string or buffer it refers to alive. Short strings are
+/// always copied, since a view wouldn't be any smaller.
+/**
+ * @brief Get a substring
+ * @param self The string object
+ * @param start The offset of the first character
+ * @param size The substring size
+ * @return New reference to a string object sharing the characters of @p self
+ */
+LIBDY_API DyObject *DyString_Slice(DyObject *self, size_t start, size_t size);
+
+/**
+ * @brief Create a string object referring to an external buffer
+ * @param data The character data
+ * @param size The string size
+ * @param buffer Passed to @p destroy
+ * @param destroy Called with @p buffer once neither the string nor any slice
+ *        of it is in use anymore. If NULL, data must stay valid forever.
+ * @return New reference to a string object. If it can't be created,
+ *         @p buffer is destroyed right away.
+ *         Inside a region, the characters are copied and @p buffer is
+ *         destroyed right away as well.
+ */
+LIBDY_API DyObject *DyString_FromBuffer(const char *data, size_t size,
+                                        void *buffer, DyDataDestructor destroy);
+
 
 ///@}
 // ----------------------------------------------------------------------------
 ///@{
 ///@name String Interning
 ///@brief libdy supports interned strings through a hash lookup table.
+///
+/// Interning is thread safe. Each thread keeps references to the strings it
+/// interned most recently, which lets it find them again without locking.
+/// Borrowed references returned by these functions stay valid at least until
+/// the calling thread interns another string.
 /**
  * @brief Check if a string object is interned and return the interned instance
  * @param str The string object to check for
@@ -113,18 +237,11 @@ LIBDY_API DyObject *DyString_Intern(DyObject *str);
 
 /**
  * @brief Intern a string object and put the result back
- * @param strp Reference to a string object pointer.
+ * @param strp Reference to a string object pointer. The reference is
+ *        replaced by one to the interned instance.
+ * @return Whether the operation succeeded; *strp is left alone if not
  */
-static inline void DyString_InternInplace(DyObject **strp)
-{
-    DyObject *interned = DyString_Intern(*strp);
-    if (interned != *strp)
-    {
-        Dy_Retain(interned);
-        Dy_Release(*strp);
-    }
-    *strp = interned;
-}
+LIBDY_API bool DyString_InternInplace(DyObject **strp);
 
 /**
  * @brief Create an interned string object from character array and size
@@ -146,6 +263,39 @@ static inline DyObject *DyString_InternStringFromString(const char *cstr)
     return DyString_InternStringFromStringAndSize(cstr, strlen(cstr));
 }
 
+/**
+ * @brief Drop the calling thread's references to recently interned strings
+ * Exiting threads do this automatically. Call it to release the strings
+ * earlier, e.g. before checking the intern table statistics.
+ */
+LIBDY_API void DyString_InternFlushCache(void);
+
+/**
+ * @brief Statistics of the string intern table
+ * @sa DyString_GetInternStats
+ */
+typedef struct DyString_InternStats {
+    /// Interned strings
+    size_t count;
+    /// Chains in the table; it grows and shrinks with count
+    size_t buckets;
+    /// Chains that aren't empty
+    size_t used;
+    /// Length of the longest chain
+    size_t longest;
+    /// Chain nodes allocated, used or not
+    size_t capacity;
+    /// Whether colliding keys made the table switch to the keyed hash
+    bool keyed;
+} DyString_InternStats;
+
+/**
+ * @brief Get statistics about the string intern table
+ * @param stats Where to store the statistics
+ * @note Walks all chains, so it's not exactly cheap
+ */
+LIBDY_API void DyString_GetInternStats(DyString_InternStats *stats);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
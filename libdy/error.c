@@ -148,7 +148,9 @@ const char *DyObject_Type_Names[] = {
     "Object",
     "List",
     "Callable",
-    "Exception"
+    "Exception",
+    "Array",
+    "Deque"
 };
 
 DyObject *DyErr_SetArgumentTypeError(const char *fname, int arg_num, const char *expected, const char *got)
@@ -174,6 +176,7 @@ const char *Dy_GetTypeName(DyObjectType t)
 // Memory error
 struct _DyExceptionObject __MemoryError = {
     .type = DY_EXCEPTION,
+    .flags = DY_IMMORTAL,
     .refcnt = 1,
     .errid = DY_ERRID_MEMORY_ERROR,
     .cause = NULL,
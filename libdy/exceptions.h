@@ -48,6 +48,9 @@ extern "C" {
 #define DY_ERRID_KEY_ERROR     		"dy.KeyError"
 #define DY_ERRID_INDEX_ERROR     	"dy.KeyError.IndexError"
 #define DY_ERRID_MEMORY_ERROR     	"dy.MemoryError"
+#define DY_ERRID_ENCODING_ERROR    	"dy.EncodingError"
+#define DY_ERRID_VALUE_ERROR     	"dy.ValueError"
+#define DY_ERRID_REGION_ERROR     	"dy.ValueError.RegionError"
 
 // Global error state
 /**
@@ -19,6 +19,7 @@
 #include "host_p.h"
 
 #include <stdint.h>
+#include <string.h>
 
 // --[ Hash implementations ]--
 // Murmur
@@ -29,9 +30,12 @@ static inline uint32_t rotl32 ( uint32_t x, int8_t r )
 
 #define ROTL32(x,y)     rotl32(x,y)
 
-static inline uint32_t getblock32 ( const uint32_t * p, int i )
+static inline uint32_t getblock32 ( const uint8_t * p, int i )
 {
-  return p[i];
+  // Keys are not necessarily 4-byte aligned
+  uint32_t v;
+  memcpy(&v, p + i * 4, 4);
+  return v;
 }
 
 static inline uint32_t fmix32 ( uint32_t h )
@@ -59,7 +63,7 @@ static inline void MurmurHash3_x86_32 ( const void * key, int len,
   //----------
   // body
 
-  const uint32_t * blocks = (const uint32_t *)(data + nblocks*4);
+  const uint8_t * blocks = data + nblocks*4;
 
   for(int i = -nblocks; i; i++)
   {
@@ -101,8 +105,8 @@ static inline void MurmurHash3_x86_32 ( const void * key, int len,
 
 DyHash Dy_hash_Murmur3_32(const char *data, size_t length)
 {
-    DyHash result;
-    MurmurHash3_x86_32(data, length, 0, &result);
+    uint32_t result;
+    MurmurHash3_x86_32(data, length, (uint32_t)DyHost.hash_key[0], &result);
     return result;
 }
 
@@ -111,7 +115,7 @@ static inline unsigned fnv1Hash(const char *key, unsigned len)
 {
     unsigned hash = 2166136261;
     const char *end = key + len;
-    for (const char *s = key; s <= end; ++s)
+    for (const char *s = key; s < end; ++s)
         hash = (16777619 * hash) ^ (*s);
     return hash;
 }
@@ -120,3 +124,176 @@ DyHash Dy_hash_fnv1(const char *data, size_t length)
 {
     return fnv1Hash(data, length);
 }
+
+// wyhash (final version 4, public domain, Wang Yi)
+// Reads 8-16 bytes per step and mixes with a 64x64->128 multiply
+static inline void wymum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), lo = t + (rm1 << 32);
+    uint64_t c = (t < rl) + (lo < t);
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wyr8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t wyr3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static const uint64_t wyp[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+static inline uint64_t wyhash(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ wyp[0], wyp[1]);
+
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = wyr3(p, len);
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = len;
+        if (i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            }
+            while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+DyHash Dy_hash_wyhash(const char *data, size_t length)
+{
+    return (DyHash)wyhash(data, length, DyHost.hash_key[0]);
+}
+
+// SipHash-1-3 (Aumasson, Bernstein)
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+#define SIPROUND \
+    do { \
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32); \
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32); \
+    } while (0)
+
+static inline uint64_t siphash13(const void *key, size_t len, uint64_t k0, uint64_t k1)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    const uint8_t *end = p + (len & ~(size_t)7);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k1 ^ 0x7465646279746573ull;
+    uint64_t m;
+
+    for (; p != end; p += 8)
+    {
+        m = wyr8(p);
+        v3 ^= m;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    // Last block: remaining bytes and the length
+    m = (uint64_t)len << 56;
+    switch (len & 7)
+    {
+    case 7: m |= (uint64_t)p[6] << 48; /* fallthrough */
+    case 6: m |= (uint64_t)p[5] << 40; /* fallthrough */
+    case 5: m |= (uint64_t)p[4] << 32; /* fallthrough */
+    case 4: m |= (uint64_t)p[3] << 24; /* fallthrough */
+    case 3: m |= (uint64_t)p[2] << 16; /* fallthrough */
+    case 2: m |= (uint64_t)p[1] << 8;  /* fallthrough */
+    case 1: m |= (uint64_t)p[0];
+    }
+
+    v3 ^= m;
+    SIPROUND;
+    v0 ^= m;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+
+DyHash Dy_hash_siphash13(const char *data, size_t length)
+{
+    return (DyHash)siphash13(data, length, DyHost.hash_key[0], DyHost.hash_key[1]);
+}
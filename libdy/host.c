@@ -19,11 +19,24 @@
 #include "host_p.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+// Pooled objects would hide use-after-free from the sanitizer
+#if defined(__SANITIZE_ADDRESS__)
+#define DY_POOL_DEFAULT_LIMIT 0
+#else
+#define DY_POOL_DEFAULT_LIMIT (64 << 20)
+#endif
 
 struct _DyHost DyHost = {
-    .string_hash_fn = &Dy_hash_fnv1,
-    .dict_table_size = 16,
+    .string_hash_fn = &Dy_hash_wyhash,
+    .hash_key = {0x736f6d6570736575ull, 0x646f72616e646f6dull},
+    .check_utf8 = false,
+    .sort_threads = 0,
+    .dict_table_size = 8,
     .dict_block_size = 16,
+    .pool_limit = DY_POOL_DEFAULT_LIMIT,
     .mm = {
         .malloc = malloc,
         .free = free,
@@ -36,6 +49,61 @@ void DyHost_SetHashFunc(Dy_string_hash_fn func)
     DyHost.string_hash_fn = func;
 }
 
+void DyHost_SetHashSeed(uint64_t k0, uint64_t k1)
+{
+    DyHost.hash_key[0] = k0;
+    DyHost.hash_key[1] = k1;
+}
+
+#ifdef __GNUC__
+// Pick a random hash key before anything gets hashed, so hash values
+// (and with them, colliding keys) can't be predicted from outside
+__attribute__((constructor))
+static void host_init_hash_key(void)
+{
+    uint64_t key[2];
+
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (f)
+    {
+        size_t n = fread(key, sizeof(key), 1, f);
+        fclose(f);
+        if (n == 1)
+        {
+            DyHost_SetHashSeed(key[0], key[1]);
+            return;
+        }
+    }
+
+    // Fall back to what little entropy there is: time and address layout
+    key[0] = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32);
+    key[1] = (uint64_t)(uintptr_t)&key ^ ((uint64_t)(uintptr_t)&DyHost << 17);
+    DyHost_SetHashSeed(DyHost.hash_key[0] ^ Dy_hash_wyhash((const char *)key, sizeof(key)),
+                       DyHost.hash_key[1] ^ Dy_hash_Murmur3_32((const char *)key, sizeof(key)));
+}
+#endif
+
+void DyHost_SetCheckUTF8(bool check)
+{
+    DyHost.check_utf8 = check;
+}
+
+void DyHost_SetSortThreads(unsigned threads)
+{
+    DyHost.sort_threads = threads;
+}
+
+void DyHost_SetDictSizes(size_t table_size, size_t block_size)
+{
+    DyHost.dict_table_size = table_size;
+    DyHost.dict_block_size = block_size;
+}
+
+void DyHost_SetPoolLimit(size_t bytes)
+{
+    DyHost.pool_limit = bytes;
+}
+
 void DyHost_SetMemoryManager(Dy_MemoryManager_t mm)
 {
     assert(mm.malloc);
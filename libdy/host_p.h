@@ -20,12 +20,21 @@
 
 #include "runtime.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
 extern struct _DyHost {
     // Strings
     Dy_string_hash_fn string_hash_fn;
+    uint64_t hash_key[2]; // Key for the seeded hash functions, random per process
+    bool check_utf8; // DyString_FromStringAndSize rejects invalid UTF-8
+    // Lists
+    unsigned sort_threads; // 0 for one per CPU
     // Dictionaries
-    size_t dict_table_size;
-    size_t dict_block_size;
+    size_t dict_table_size; // Slots in a newly allocated table
+    size_t dict_block_size; // Tables up to this size are kept on clear
+    // Object pools
+    size_t pool_limit; // Bytes of slabs per size class
     // Memory management
     Dy_MemoryManager_t mm;
 } DyHost;
@@ -20,11 +20,13 @@
 
 #include "dy.h"
 #include "json_token.h"
-#include "buildstring.h"
-#include "linalloc.h"
 #include "host_p.h"
 #include "exceptions.h"
 #include "dy_p.h"
+#include "dict_p.h"
+#include "string_p.h"
+#include "array_p.h"
+#include "region_p.h"
 
 #include <assert.h>
 
@@ -41,11 +43,17 @@ inline static DyObject *this_or(dyj_token_t*, DyJson_NextChunkFn_t, void*, dyj_t
                           DyJson_NextChunkFn_t chunk, \
                           void *chunk_data)
 
+// Number of object items collected on the stack before going to the heap
+#define OBJECT_STACK_ITEMS 16
+
 HANDLER(OBJECT)
 {
-    DyObject *dict = DyDict_New();
-    if (!dict)
-        return_null;
+    // Collect the items first, so the dict can be built in one go
+    DyObject *stack_items[2 * OBJECT_STACK_ITEMS];
+    DyObject **items = stack_items;
+    size_t capacity = OBJECT_STACK_ITEMS;
+    size_t count = 0;
+    DyObject *dict = NULL;
 
     while (true)
     {
@@ -59,9 +67,20 @@ HANDLER(OBJECT)
         if (!key)
             goto cleanup;
 
+        // Object keys tend to repeat, interned ones compare by pointer.
+        // A region would hold on to the interned copies for good.
+        if (key->type == DY_STRING && !region_owns(key) && !DyString_InternInplace(&key))
+        {
+            Dy_Release(key);
+            goto cleanup;
+        }
+
         if (!next_token(token, chunk, chunk_data)
          || !check_token(token, TOKEN_COLON, 0))
+        {
+            Dy_Release(key);
             goto cleanup;
+        }
 
         DyObject *value = DyJson_NextEx(token, chunk, chunk_data);
         if (!value)
@@ -70,12 +89,30 @@ HANDLER(OBJECT)
             goto cleanup;
         }
 
-        bool res = Dy_SetItem(dict, key, value);
-        Dy_Release(key);
-        Dy_Release(value);
+        if (count == capacity)
+        {
+            DyObject **grown = dy_malloc(sizeof(DyObject *) * 4 * capacity);
+            if (!grown)
+            {
+                DyErr_SetMemoryError();
+                Dy_Release(key);
+                Dy_Release(value);
+                goto cleanup;
+            }
 
-        if (!res)
-            goto cleanup;
+            // Keys in the first half, values in the second
+            memcpy(grown, items, sizeof(DyObject *) * count);
+            memcpy(grown + 2 * capacity, items + capacity, sizeof(DyObject *) * count);
+
+            if (items != stack_items)
+                dy_free(items);
+            items = grown;
+            capacity *= 2;
+        }
+
+        items[count] = key;
+        items[capacity + count] = value;
+        ++count;
 
         if (!next_token(token, chunk, chunk_data))
             goto cleanup;
@@ -86,27 +123,153 @@ HANDLER(OBJECT)
             goto cleanup;
     }
 
-    return dict;
+    dict = dict_from_arrays(items, items + capacity, count, true);
 
 cleanup:
-    Dy_Release(dict);
-    return_null;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Dy_Release(items[i]);
+        Dy_Release(items[capacity + i]);
+    }
+
+    if (items != stack_items)
+        dy_free(items);
+
+    if (!dict)
+        return_null;
+    return dict;
 }
 
-HANDLER(ARRAY)
+// Number of elements a typed array starts out with
+#define NUMBER_ARRAY_ITEMS 16
+
+// Turn the first count elements of an int64 array into doubles
+static void number_array_to_double(DyArrayObject *array, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        int64_t l;
+        memcpy(&l, (int64_t *)array->data + i, sizeof(l));
+        double d = (double)l;
+        memcpy((double *)array->data + i, &d, sizeof(d));
+    }
+    array->kind = DY_ARRAY_DOUBLE;
+}
+
+// Box the numbers collected so far
+static DyObject *number_array_to_list(DyArrayObject *array, size_t count)
 {
-    DyObject *list = DyList_New();
+    DyObject *list = DyList_NewEx(count + 1);
     if (!list)
         return_null;
 
+    array->size = count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        DyObject *item = DyArray_GetItem((DyObject *)array, i);
+        if (!item || !DyList_Append(list, item))
+        {
+            if (item)
+                Dy_Release(item);
+            Dy_Release(list);
+            return_null;
+        }
+        Dy_Release(item);
+    }
+
+    return list;
+}
+
+// Collect the numbers of an array into a typed array, starting at the
+// current token. If anything else comes up, they're put into a list
+// instead, leaving the token at the item that didn't fit.
+static DyObject *number_array(dyj_token_t *token, DyJson_NextChunkFn_t chunk, void *chunk_data)
+{
+    DyArrayObject *array = array_new(DY_ARRAY_INT64, NUMBER_ARRAY_ITEMS);
+    if (!array)
+        return_null;
+
+    size_t count = 0;
+
     while (true)
     {
+        if (token->type != TOKEN_INT && token->type != TOKEN_FLOAT)
+        {
+            DyObject *list = number_array_to_list(array, count);
+            Dy_Release((DyObject *)array);
+            return list;
+        }
+
+        if (count == array->size)
+        {
+            DyArrayObject *grown = array_realloc(array, 2 * count);
+            if (!grown)
+                goto error;
+            array = grown;
+        }
+
+        if (token->type == TOKEN_FLOAT && array->kind == DY_ARRAY_INT64)
+            number_array_to_double(array, count);
+
+        if (array->kind == DY_ARRAY_INT64)
+            ((int64_t *)array->data)[count++] = token->int_value;
+        else if (token->type == TOKEN_INT)
+            ((double *)array->data)[count++] = (double)token->int_value;
+        else
+            ((double *)array->data)[count++] = token->float_value;
+
         if (!next_token(token, chunk, chunk_data))
-            goto cleanup;
+            goto error;
 
         if (token->type == TOKEN_BRACKET_CLOSE)
             break;
+        else if (!check_token(token, TOKEN_COMMA, TOKEN_BRACKET_CLOSE)
+              || !next_token(token, chunk, chunk_data))
+            goto error;
+
+        if (token->type == TOKEN_BRACKET_CLOSE)
+            break;
+    }
 
+    if (count != array->size)
+    {
+        DyArrayObject *shrunk = array_realloc(array, count);
+        if (!shrunk)
+            goto error;
+        array = shrunk;
+    }
+
+    return (DyObject *)array;
+
+error:
+    Dy_Release((DyObject *)array);
+    return_null;
+}
+
+HANDLER(ARRAY)
+{
+    if (!next_token(token, chunk, chunk_data))
+        return_null;
+
+    DyObject *list;
+    if (token->parse_flags & DYJ_PARSE_ARRAYS
+     && (token->type == TOKEN_INT || token->type == TOKEN_FLOAT))
+    {
+        list = number_array(token, chunk, chunk_data);
+
+        // Unless the numbers were followed by something else
+        if (!list || list->type == DY_ARRAY)
+            return list;
+    }
+    else
+    {
+        list = DyList_New();
+        if (!list)
+            return_null;
+    }
+
+    while (token->type != TOKEN_BRACKET_CLOSE)
+    {
         DyObject *item = this_or(token, chunk, chunk_data, TOKEN_BRACKET_CLOSE);
         if (!item)
             goto cleanup;
@@ -122,7 +285,8 @@ HANDLER(ARRAY)
 
         if (token->type == TOKEN_BRACKET_CLOSE)
             break;
-        else if (!check_token(token, TOKEN_COMMA, TOKEN_BRACKET_CLOSE))
+        else if (!check_token(token, TOKEN_COMMA, TOKEN_BRACKET_CLOSE)
+              || !next_token(token, chunk, chunk_data))
             goto cleanup;
     }
 
@@ -136,57 +300,94 @@ cleanup:
 HANDLER(STRING)
 {
     dyj_string_token_t strtok;
-    dy_buildstring_t *bs = NULL;
-    dy_linalloc_t *mem = dy_linalloc_new(6 * 32, dy_malloc);
-    if (!mem)
-    {
-        DyErr_SetMemoryError();
-        return_null;
-    }
 
     dyj_init_string(&strtok, token);
     dyj_next_string(&strtok);
 
+    if (!dyj_next_string(&strtok))
+        goto error;
+
+    const char *text = strtok.begin;
+
+    if (strtok.type == DYJ_STRTOK_QUOTE)
+        return DyString_FromStringAndSize("", 0);
 
-    while (dyj_next_string(&strtok))
+    else if (strtok.type == DYJ_STRTOK_TEXT)
     {
-        if (strtok.type == DYJ_STRTOK_QUOTE)
-            break;
+        if (!dyj_next_string(&strtok))
+            goto error;
 
-        else if (strtok.type == DYJ_STRTOK_ESCAPE)
+        // No escape sequences, the characters can be used as they are
+        if (strtok.type == DYJ_STRTOK_QUOTE)
         {
-            // FIXME: this is dirty... fix it
-            uint8_t *buf = (uint8_t*) dy_linalloc_malloc(mem, 6);
-            if (!buf)
-            {
-                strtok.type = DYJ_STRTOK_INVALID;
-                strtok.error = "Too many escape sequences";
-                break;
-            }
-            size_t len = dyj_unicode_utf8(strtok.escape, buf);
-            dy_buildstring_more(&bs, (char*)buf, len);
+            size_t size = strtok.begin - text;
+            DyStringObject *str;
+            if (token->parse_flags & DYJ_PARSE_VIEWS && token->source)
+                str = string_view((DyStringObject *)token->source, text, size);
+            else
+                str = string_new(text, size);
+
+            // The tokenizer validated it
+            if (str)
+                str->flags |= DYSTRING_CHECKED | DYSTRING_UTF8
+                            | (token->string_ascii ? DYSTRING_ASCII : 0);
+            return (DyObject *)str;
         }
-        else
-            dy_buildstring_more(&bs, strtok.begin, strtok.end - strtok.begin);
     }
 
-    if (strtok.type == DYJ_STRTOK_INVALID)
-    {
-        DyErr_Format(DY_ERRID_JSON_PARSE_STRING,
-                     "%s (at line %d, column %d)",
-                     strtok.error, token->location.line,
-                     token->location.column + strtok.error_offset);
-        dy_buildstring_free(bs);
-        dy_free(mem);
+    // Unescape right into the string. An escape sequence is never shorter
+    // than its UTF-8 encoding, so the raw size is enough.
+    DyStringObject *str = string_new_ex(token->end - text - 1);
+    if (!str)
         return_null;
-    }
-    else
+
+    char *out = str->data;
+    memcpy(out, text, strtok.begin - text);
+    out += strtok.begin - text;
+
+    bool ascii = token->string_ascii;
+    bool valid = true;
+
+    while (strtok.type != DYJ_STRTOK_QUOTE)
     {
-        DyObject *result = dy_buildstring_build(bs);
-        dy_buildstring_free(bs);
-        dy_free(mem);
-        return result;
+        if (strtok.type == DYJ_STRTOK_ESCAPE)
+        {
+            // Surrogate pairs are combined by the tokenizer, lone
+            // surrogates come out as invalid UTF-8
+            ascii &= strtok.escape < 0x80;
+            valid &= strtok.escape < 0xD800 || strtok.escape > 0xDFFF;
+
+            uint8_t buf[8];
+            size_t len = dyj_unicode_utf8(strtok.escape, buf);
+            memcpy(out, buf, len);
+            out += len;
+        }
+        else
+        {
+            memcpy(out, strtok.begin, strtok.end - strtok.begin);
+            out += strtok.end - strtok.begin;
+        }
+
+        if (!dyj_next_string(&strtok))
+        {
+            Dy_Release((DyObject *)str);
+            goto error;
+        }
     }
+
+    str->size = out - str->data;
+    *out = 0;
+
+    if (valid)
+        str->flags |= DYSTRING_CHECKED | DYSTRING_UTF8 | (ascii ? DYSTRING_ASCII : 0);
+    return (DyObject *)str;
+
+error:
+    DyErr_Format(DY_ERRID_JSON_PARSE_STRING,
+                 "%s (at line %d, column %d)",
+                 strtok.error, token->location.line,
+                 token->location.column + strtok.error_offset);
+    return_null;
 }
 
 HANDLER(INT)
@@ -338,3 +539,22 @@ DyObject *DyJson_Parse(const char *json)
     dyj_init_token(&tok, json);
     return DyJson_NextEx(&tok, NULL, NULL);
 }
+
+DyObject *DyJson_ParseEx(DyObject *json, unsigned flags)
+{
+    const char *data = DyString_AsString(json);
+    if (!data)
+        return_null;
+
+    dyj_token_t tok;
+
+    dyj_init_token(&tok, data);
+    tok.parse_flags = flags;
+
+    // Unless DyString_AsString had to make a terminated copy
+    size_t size;
+    if (DyString_AsStringAndSize(json, &size) == data)
+        tok.source = json;
+
+    return DyJson_NextEx(&tok, NULL, NULL);
+}
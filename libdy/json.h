@@ -35,6 +35,11 @@ extern "C" {
 #define DY_ERRID_JSON_TOKEN "dy.json.ParseError.TokenError"
 #define DY_ERRID_JSON_PARSE_STRING "dy.json.ParseError.StringParseError"
 
+/// Return strings without escape sequences as views into the json string
+#define DYJ_PARSE_VIEWS 1
+/// Return arrays of numbers as typed arrays
+#define DYJ_PARSE_ARRAYS 2
+
 
 struct dyj_token_t;
 
@@ -75,6 +80,21 @@ LIBDY_API DyObject *DyJson_NextEx(struct dyj_token_t *token,
  */
 LIBDY_API DyObject *DyJson_Parse(const char *json);
 
+/**
+ * @brief Parse a json string object into a DyObject
+ * @param json The json string object
+ * @param flags DYJ_PARSE_* flags
+ * @return A new DyObject reference
+ *
+ * With DYJ_PARSE_VIEWS, longer strings that need no unescaping refer to the
+ * characters of @p json instead of copying them, keeping it alive.
+ * With DYJ_PARSE_ARRAYS, non-empty arrays holding only numbers become int64
+ * arrays, or double arrays if any number has a fraction or exponent.
+ * @sa DyString_Slice
+ * @sa DyArray_Sum
+ */
+LIBDY_API DyObject *DyJson_ParseEx(DyObject *json, unsigned flags);
+
 
 #ifdef __cplusplus
 }
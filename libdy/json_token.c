@@ -17,6 +17,7 @@
  */
 
 #include "json_token.h"
+#include "utf8_p.h"
 
 #include <math.h>
 #include <string.h>
@@ -59,6 +60,9 @@ void dyj_init_token_ex(dyj_token_t *token, const char *data, size_t offset, size
     token->end_location.line = line;
     token->end_location.column = column;
     token->error = NULL;
+    token->string_ascii = false;
+    token->parse_flags = 0;
+    token->source = NULL;
 }
 
 
@@ -168,25 +172,45 @@ static bool token_string(dyj_token_t *token)
     const char *data = token->begin + 1; // Skip the leading quote
     bool escape = false;
 
-    do
+    token->string_ascii = true;
+
+    while (true)
     {
-        if (*data <= 0x1F || *data == 0x7F)
+        uint8_t c = *data;
+
+        if (c <= 0x1F || c == 0x7F)
             return token_error(token, data, "Encountered Control character (possibly EOF) in string");
 
+        if (c >= 0x80)
+        {
+            // The length of the input isn't known, but the sequence is read
+            // byte by byte and stops at the terminator
+            const uint8_t *s = (const uint8_t *)data;
+            size_t n = dy_utf8_sequence(s, s + 4);
+            if (!n)
+                return token_error(token, data, "Invalid UTF-8 in string");
+
+            token->string_ascii = false;
+            escape = false;
+            data += n;
+            continue;
+        }
+
         if (!escape)
         {
-            if (*data == '\\')
+            if (c == '\\')
                 // We don't actually chech for valid escape sequences since the
                 // actual parser needs to parse them anyway.
                 escape = true;
 
-            else if (*data == '"')
+            else if (c == '"')
                 break;
         }
         else
             escape = false;
+
+        ++data;
     }
-    while (++data);
 
     update_token(token, TOKEN_STRING, ++data); // Skip the trailing quote too
 
@@ -405,6 +429,27 @@ inline static bool strtok_char(dyj_string_token_t *strtok, dyj_string_token_type
     return true;
 }
 
+// Parse exactly four hex digits
+inline static bool strtok_hex4(const char *here, uint32_t *value)
+{
+    uint32_t v = 0;
+
+    for (int i = 0; i < 4; ++i, ++here)
+    {
+        v <<= 4;
+
+        if ('0' <= *here && *here <= '9')
+            v |= *here - '0';
+        else if ('a' <= (*here | 0x20) && (*here | 0x20) <= 'f')
+            v |= (*here | 0x20) - 'a' + 10;
+        else
+            return false;
+    }
+
+    *value = v;
+    return true;
+}
+
 inline static bool strtok_escape(dyj_string_token_t *strtok)
 {
     const char *here = strtok->begin + 1;
@@ -433,17 +478,20 @@ inline static bool strtok_escape(dyj_string_token_t *strtok)
         break;
     case 'u':
     {
-        uint32_t escape = 0;
+        uint32_t escape;
 
-        for (int i = 0; i < 4; ++i)
-        {
-            here++;
+        if (!strtok_hex4(here + 1, &escape))
+            return strtok_error(strtok, here, "Invalid unicode escape sequence");
+        here += 4;
 
-            if (0x30 > *here || *here > 0x3F)
-                return strtok_error(strtok, here, "Invalid unicode escape sequence");
-
-            escape <<= 4;
-            escape |= *here & 0xF;
+        // A high surrogate directly followed by a low surrogate escape
+        // encodes a single codepoint outside the BMP
+        uint32_t low;
+        if (0xD800 <= escape && escape <= 0xDBFF && here[1] == '\\' && here[2] == 'u'
+                && strtok_hex4(here + 3, &low) && 0xDC00 <= low && low <= 0xDFFF)
+        {
+            escape = 0x10000 + ((escape - 0xD800) << 10) + (low - 0xDC00);
+            here += 6;
         }
 
         strtok->escape = escape;
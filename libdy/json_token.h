@@ -78,6 +78,9 @@ typedef struct dyj_token_t {
     int64_t int_value;
     double float_value;
 
+    // String tokens: no characters above 0x7F (escapes aside)
+    bool string_ascii;
+
     // Location tracking
     dyj_token_location location;
     dyj_token_location end_location;
@@ -85,6 +88,11 @@ typedef struct dyj_token_t {
     // Error message
     const char *error;
     dyj_token_location error_location;
+
+    // Parser state: DYJ_PARSE_* flags and the string object holding
+    // the input, if any
+    unsigned parse_flags;
+    struct _DyObject *source;
 } dyj_token_t;
 
 
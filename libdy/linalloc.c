@@ -18,35 +18,145 @@
 
 #include "linalloc.h"
 
+#include <string.h>
+
+
+// All allocations are aligned to this
+#define LA_ALIGN 16
+
+// Chunks double in size up to this, larger requests get a chunk of their own
+#define LA_MAX_CHUNK (4 << 20)
+
+#define la_round(size) (((size) + LA_ALIGN - 1) & ~(size_t)(LA_ALIGN - 1))
+
+
+typedef struct la_chunk_t {
+    struct la_chunk_t *prev;
+    size_t size;
+    _Alignas(LA_ALIGN) uint8_t data[];
+} la_chunk_t;
 
 struct dy_linalloc_t {
-    size_t freect;
-    void *next;
-    uint8_t data[0];
+    uint8_t *next;          // Bump pointer into the current chunk
+    uint8_t *end;
+    la_chunk_t *chunks;     // Chunks added after the first, newest first
+    size_t chunk_size;      // The size of the last chunk
+    size_t first_size;      // The size of data
+    size_t used;
+    void *(*malloc)(size_t);
+    _Alignas(LA_ALIGN) uint8_t data[];
 };
 
 
 dy_linalloc_t *dy_linalloc_new(size_t size, void*(*malloc)(size_t))
 {
+    size = la_round(size);
+
     dy_linalloc_t *la = malloc(sizeof(struct dy_linalloc_t) + size);
     if (!la)
         return NULL;
 
-    la->freect = size;
     la->next = la->data;
+    la->end = la->data + size;
+    la->chunks = NULL;
+    la->chunk_size = size;
+    la->first_size = size;
+    la->used = 0;
+    la->malloc = malloc;
     return la;
 }
 
+// Continue in a new chunk that fits at least size bytes
+static int la_grow(dy_linalloc_t *la, size_t size)
+{
+    size_t chunk_size = la->chunk_size < LA_MAX_CHUNK / 2 ? 2 * la->chunk_size : LA_MAX_CHUNK;
+    if (chunk_size < LA_ALIGN)
+        chunk_size = LA_ALIGN;
+    if (chunk_size < size)
+        chunk_size = size;
+
+    la_chunk_t *chunk = la->malloc(sizeof(la_chunk_t) + chunk_size);
+    if (!chunk)
+        return 0;
+
+    chunk->prev = la->chunks;
+    chunk->size = chunk_size;
+    la->chunks = chunk;
+    la->chunk_size = chunk_size;
+    la->next = chunk->data;
+    la->end = chunk->data + chunk_size;
+    return 1;
+}
+
 void *dy_linalloc_malloc(dy_linalloc_t *la, size_t size)
 {
-    if (la->freect < size)
+    if (size > SIZE_MAX / 2)
         return NULL;
+
+    size = la_round(size);
+
+    if ((size_t)(la->end - la->next) < size && !la_grow(la, size))
+        return NULL;
+
     void *mem = la->next;
     la->next += size;
+    la->used += size;
+    return mem;
+}
+
+void *dy_linalloc_realloc(dy_linalloc_t *la, void *ptr, size_t old_size, size_t size)
+{
+    if (size > SIZE_MAX / 2)
+        return NULL;
+
+    old_size = la_round(old_size);
+
+    // The last allocation can grow and shrink in place
+    if (ptr && (uint8_t *)ptr + old_size == la->next
+     && la_round(size) <= (size_t)(la->end - (uint8_t *)ptr))
+    {
+        la->next = (uint8_t *)ptr + la_round(size);
+        la->used += la_round(size) - old_size;
+        return ptr;
+    }
+
+    if (la_round(size) <= old_size)
+        return ptr;
+
+    void *mem = dy_linalloc_malloc(la, size);
+    if (mem && ptr)
+        memcpy(mem, ptr, old_size);
     return mem;
 }
 
 size_t dy_linalloc_remaining(dy_linalloc_t *la)
 {
-    return la->freect;
+    return la->end - la->next;
+}
+
+size_t dy_linalloc_used(dy_linalloc_t *la)
+{
+    return la->used;
+}
+
+int dy_linalloc_owns(dy_linalloc_t *la, const void *ptr)
+{
+    uintptr_t p = (uintptr_t)ptr;
+
+    // Newer chunks first, recent allocations are the likely ones
+    for (la_chunk_t *chunk = la->chunks; chunk; chunk = chunk->prev)
+        if (p >= (uintptr_t)chunk->data && p < (uintptr_t)chunk->data + chunk->size)
+            return 1;
+
+    return p >= (uintptr_t)la->data && p < (uintptr_t)la->data + la->first_size;
+}
+
+void dy_linalloc_free(dy_linalloc_t *la, void(*free)(void*))
+{
+    for (la_chunk_t *chunk = la->chunks, *prev; chunk; chunk = prev)
+    {
+        prev = chunk->prev;
+        free(chunk);
+    }
+    free(la);
 }
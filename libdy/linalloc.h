@@ -23,8 +23,12 @@
  * @brief A simple linear allocator.
  *
  * Create a new pool using dy_linalloc_new(), passing it a parent allocator
- * Then it can be used through dy_linalloc_malloc() and dy_linalloc_remaining()
- * Finally, free the whole pool using the parent allocator's free()
+ * Then it can be used through dy_linalloc_malloc() and dy_linalloc_realloc().
+ * Finally, free the whole pool at once using dy_linalloc_free()
+ *
+ * When the pool runs out of space, it grows by another chunk of memory taken
+ * from the parent allocator. Memory is never given back before the whole
+ * pool is freed.
  *
  * This is mostly useful to store larger anmounts of temporary data.
  */
@@ -45,7 +49,8 @@ typedef struct dy_linalloc_t dy_linalloc_t;
 
 /**
  * @brief Create a new linear memory pool
- * @param size The pool size
+ * @param size The size of the first chunk
+ * @param malloc The parent allocator, also used to add chunks
  * @return A new linear memory pool
  */
 LIBDY_API dy_linalloc_t *dy_linalloc_new(size_t size, void*(*malloc)(size_t));
@@ -54,17 +59,51 @@ LIBDY_API dy_linalloc_t *dy_linalloc_new(size_t size, void*(*malloc)(size_t));
  * @brief Allocate memory from the pool
  * @param la The linalloc instance
  * @param size The anmount of memory needed
- * @return A free chunk of memory
+ * @return A free chunk of memory aligned to 16 bytes,
+ *         NULL if the parent allocator failed
  */
 LIBDY_API void *dy_linalloc_malloc(dy_linalloc_t *la, size_t size);
 
 /**
- * @brief Check how much memory is free in the pool
+ * @brief Resize memory allocated from the pool
+ * @param la The linalloc instance
+ * @param ptr The memory, or NULL
+ * @param old_size The size it was allocated with
+ * @param size The new size
+ * @return The memory, which moved unless it was the last allocation,
+ *         NULL if the parent allocator failed
+ */
+LIBDY_API void *dy_linalloc_realloc(dy_linalloc_t *la, void *ptr, size_t old_size, size_t size);
+
+/**
+ * @brief Check how much memory is free in the current chunk
  * @param la The linalloc instance
- * @return The anmount of free memory in the pool
+ * @return The anmount of memory that can be allocated without growing
  */
 LIBDY_API size_t dy_linalloc_remaining(dy_linalloc_t *la);
 
+/**
+ * @brief Check how much memory was allocated from the pool
+ * @param la The linalloc instance
+ * @return The total size of all allocations
+ */
+LIBDY_API size_t dy_linalloc_used(dy_linalloc_t *la);
+
+/**
+ * @brief Check whether memory was allocated from the pool
+ * @param la The linalloc instance
+ * @param ptr The memory
+ * @return Non-zero if ptr points into one of the pool's chunks
+ */
+LIBDY_API int dy_linalloc_owns(dy_linalloc_t *la, const void *ptr);
+
+/**
+ * @brief Free the pool and all memory allocated from it
+ * @param la The linalloc instance
+ * @param free The parent allocator's free()
+ */
+LIBDY_API void dy_linalloc_free(dy_linalloc_t *la, void(*free)(void*));
+
 
 #ifdef __cplusplus
 }
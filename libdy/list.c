@@ -17,9 +17,12 @@
  */
 
 #include "list_p.h"
+#include "pool_p.h"
+#include "region_p.h"
 #include "exceptions.h"
 
 #include <assert.h>
+#include <string.h>
 
 // Inlines
 bool DyList_Check(DyObject *self)
@@ -30,31 +33,32 @@ bool DyList_Check(DyObject *self)
 // Modeled after cpython/Objects/listobject.c
 DyObject *DyList_New()
 {
-    DyListObject *self = NEW(DyListObject);
+    DyListObject *self = (DyListObject *)pool_new(DY_LIST, sizeof(DyListObject));
     if (!self)
-    {
-        DyErr_SetMemoryError();
         return_null;
-    }
 
-    Dy_InitObject((DyObject *)self, DY_LIST);
+    self->size = 0;
+    self->allocated = 0;
+    self->items = NULL;
 
     return (DyObject *)self;
 }
 
 DyObject *DyList_NewEx(size_t allocate)
 {
-    DyListObject *self = NEW(DyListObject);
+    DyListObject *self = (DyListObject *)pool_new(DY_LIST, sizeof(DyListObject));
     if (!self)
-    {
-        DyErr_SetMemoryError();
         return_null;
-    }
-
-    Dy_InitObject((DyObject *)self, DY_LIST);
 
+    self->size = 0;
     self->allocated = allocate;
-    self->items = dy_malloc(sizeof(DyObject *) * allocate);
+    self->items = NULL;
+
+    if (allocate && !(self->items = object_buffer((DyObject *)self, sizeof(DyObject *) * allocate)))
+    {
+        Dy_Release((DyObject *)self);
+        return_null;
+    }
 
     return (DyObject *)self;
 }
@@ -75,15 +79,18 @@ inline static int list_resize(DyListObject *self, size_t new_size)
     new_allocated = new_size + (new_size >> 3) + (new_size < 9 ? 3 : 6);
     
     if (new_size == 0)
-    	new_allocated = 0;
+    {
+    	object_free((DyObject *)self, self->items);
+    	self->items = NULL;
+    	self->size = self->allocated = 0;
+    	return 0;
+    }
     
-    items = dy_realloc(self->items, sizeof(DyObject*) * new_allocated);
+    items = object_realloc((DyObject *)self, self->items,
+                           sizeof(DyObject*) * allocated, sizeof(DyObject*) * new_allocated);
     
     if (items == NULL)
-    {
-        DyErr_SetMemoryError();
     	return_error(-1);
-    }
     
     self->items = items;
     self->size = new_size;
@@ -164,10 +171,8 @@ inline static bool list_insert(DyListObject *self, ssize_t where, DyObject *valu
     
     // Insert
     DyObject **items = self->items;
-    for (size_t i = (size_t)n; --i >= where; )
-    	items[i+1] = items[i];
-    Dy_Retain(value);
-    items[where] = value;
+    memmove(items + where + 1, items + where, sizeof(DyObject *) * (n - where));
+    items[where] = Dy_Retain(value);
     return true;
 }
 
@@ -217,46 +222,249 @@ bool DyList_Clear(DyObject *self)
     {
     	for (ssize_t i = ((DyListObject *)self)->size; --i >= 0; )
     		Dy_Release(((DyListObject *)self)->items[i]);
-    	dy_free(((DyListObject *)self)->items);
+    	object_free(self, ((DyListObject *)self)->items);
     	((DyListObject *)self)->items = NULL;
     	((DyListObject *)self)->size = 0;
+    	((DyListObject *)self)->allocated = 0;
     }
     return true;
 }
 
 
-// Repr ------------------------------------------------------------------------
-#include "buildstring.h"
+// Bulk operations -------------------------------------------------------------
+// Modeled after cpython/Objects/listobject.c as well
 
-dy_buildstring_t *list_bsrepr(dy_buildstring_t *bs, DyListObject *self)
+// Clamp slice bounds to the list, counting negative ones from the end
+inline static void list_bounds(DyListObject *self, ssize_t *start, ssize_t *stop)
 {
-    dy_buildstring_t *lbs = bs = dy_buildstring_append(bs, "[", 1);
-    if (!lbs)
+    ssize_t size = self->size;
+
+    if (*start < 0 && (*start += size) < 0)
+    	*start = 0;
+    else if (*start > size)
+    	*start = size;
+
+    if (*stop < 0 && (*stop += size) < 0)
+    	*stop = 0;
+    else if (*stop > size)
+    	*stop = size;
+
+    if (*stop < *start)
+    	*stop = *start;
+}
+
+// Number of replaced items kept on the stack until they are released
+#define RECYCLE_STACK_ITEMS 8
+
+// Replace self[low:high] by n items. The replaced items are released
+// only after the list is consistent again.
+static bool list_ass_slice(DyListObject *self, ssize_t low, ssize_t high, DyObject **items, size_t n)
+{
+    size_t size = self->size;
+    size_t removed = high - low;
+
+    DyObject *recycle_stack[RECYCLE_STACK_ITEMS];
+    DyObject **recycle = recycle_stack;
+    if (removed > RECYCLE_STACK_ITEMS)
     {
-        DyErr_SetMemoryError();
-        return_null;
+    	recycle = dy_malloc(sizeof(DyObject *) * removed);
+    	if (!recycle)
+    	{
+    		DyErr_SetMemoryError();
+    		return_error(false);
+    	}
     }
 
-    for (size_t i = 0; i < (self->size < 20 ? self->size : 20); ++i)
+    if (removed)
+    	memcpy(recycle, self->items + low, sizeof(DyObject *) * removed);
+
+    if (n < removed)
     {
-        lbs = bsrepr(lbs, self->items[i]);
-        if (!lbs)
-            return_null;
-
-        lbs = dy_buildstring_append(lbs, ", ", 2);
-        if (!lbs)
-        {
-            DyErr_SetMemoryError();
-            return_null;
-        }
+    	memmove(self->items + low + n, self->items + high, sizeof(DyObject *) * (size - high));
+    	list_resize(self, size - removed + n);
     }
+    else if (n > removed)
+    {
+    	if (list_resize(self, size - removed + n) == -1)
+    	{
+    		if (recycle != recycle_stack)
+    			dy_free(recycle);
+    		return_error(false);
+    	}
+    	memmove(self->items + low + n, self->items + high, sizeof(DyObject *) * (size - high));
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    	self->items[low + i] = Dy_Retain(items[i]);
+
+    for (size_t i = removed; i-- > 0; )
+    	Dy_Release(recycle[i]);
+
+    if (recycle != recycle_stack)
+    	dy_free(recycle);
+    return true;
+}
+
+bool DyList_Extend(DyObject *self, DyObject *other)
+{
+    if (DyErr_CheckArg("DyList_Extend", 0, DY_LIST, self)
+     || DyErr_CheckArg("DyList_Extend", 1, DY_LIST, other))
+    	return_error(false);
+
+    DyListObject *lo = (DyListObject *)self;
+    size_t size = lo->size;
+    size_t n = ((DyListObject *)other)->size;
+
+    if (!n)
+    	return true;
+
+    if (list_resize(lo, size + n) == -1)
+    	return_error(false);
+
+    // Read the items after resizing, other may be self
+    DyObject **src = ((DyListObject *)other)->items;
+    for (size_t i = 0; i < n; ++i)
+    	lo->items[size + i] = Dy_Retain(src[i]);
 
-    if (lbs != bs)
+    return true;
+}
+
+DyObject *DyList_GetSlice(DyObject *self, ssize_t start, ssize_t stop)
+{
+    if (DyErr_CheckArg("DyList_GetSlice", 0, DY_LIST, self))
+    	return_null;
+
+    DyListObject *lo = (DyListObject *)self;
+    list_bounds(lo, &start, &stop);
+
+    DyListObject *slice = (DyListObject *)DyList_New();
+    if (!slice)
+    	return_null;
+
+    if (stop > start)
     {
-        lbs->part = "]";
-        lbs->part_size = 1;
+    	if (list_resize(slice, stop - start) == -1)
+    	{
+    		Dy_Release((DyObject *)slice);
+    		return_null;
+    	}
+
+    	for (ssize_t i = start; i < stop; ++i)
+    		slice->items[i - start] = Dy_Retain(lo->items[i]);
+    }
+
+    return (DyObject *)slice;
+}
+
+bool DyList_SetSlice(DyObject *self, ssize_t start, ssize_t stop, DyObject *items)
+{
+    if (DyErr_CheckArg("DyList_SetSlice", 0, DY_LIST, self)
+     || DyErr_CheckArg("DyList_SetSlice", 3, DY_LIST, items))
+    	return_error(false);
+
+    DyListObject *lo = (DyListObject *)self;
+    list_bounds(lo, &start, &stop);
+
+    // The items would move underneath us
+    if (items == self)
+    {
+    	DyObject *copy = DyList_GetSlice(items, 0, lo->size);
+    	if (!copy)
+    		return_error(false);
+
+    	bool result = DyList_SetSlice(self, start, stop, copy);
+    	Dy_Release(copy);
+    	return result;
+    }
+
+    DyListObject *io = (DyListObject *)items;
+    return list_ass_slice(lo, start, stop, io->items, io->size);
+}
+
+bool DyList_DelSlice(DyObject *self, ssize_t start, ssize_t stop)
+{
+    if (DyErr_CheckArg("DyList_DelSlice", 0, DY_LIST, self))
+    	return_error(false);
+
+    list_bounds((DyListObject *)self, &start, &stop);
+    return list_ass_slice((DyListObject *)self, start, stop, NULL, 0);
+}
+
+DyObject *DyList_Pop(DyObject *self, ssize_t index)
+{
+    if (DyErr_CheckArg("DyList_Pop", 0, DY_LIST, self))
+    	return_null;
+
+    DyListObject *lo = (DyListObject *)self;
+    size_t size = lo->size;
+
+    if (index < 0)
+    	index += size;
+
+    if (index < 0 || (size_t)index >= size)
+    {
+    	DyErr_Set(DY_ERRID_INDEX_ERROR, size ? "Pop index out of range" : "Pop from empty list");
+    	return_null;
+    }
+
+    // The list's reference goes to the caller
+    DyObject *item = lo->items[index];
+    memmove(lo->items + index, lo->items + index + 1, sizeof(DyObject *) * (size - index - 1));
+    list_resize(lo, size - 1);
+    return item;
+}
+
+bool DyList_Remove(DyObject *self, DyObject *value)
+{
+    if (DyErr_CheckArg("DyList_Remove", 0, DY_LIST, self))
+    	return_error(false);
+
+    DyListObject *lo = (DyListObject *)self;
+    for (size_t i = 0; i < lo->size; ++i)
+    	if (Dy_Equals(lo->items[i], value))
+    		return list_ass_slice(lo, i, i + 1, NULL, 0);
+
+    DyErr_Set(DY_ERRID_VALUE_ERROR, "DyList_Remove(): Item not in list");
+    return_error(false);
+}
+
+bool DyList_Reverse(DyObject *self)
+{
+    if (DyErr_CheckArg("DyList_Reverse", 0, DY_LIST, self))
+    	return_error(false);
+
+    DyListObject *lo = (DyListObject *)self;
+    if (lo->size < 2)
+    	return true;
+
+    DyObject **lo_item = lo->items, **hi_item = lo->items + lo->size - 1;
+    while (lo_item < hi_item)
+    {
+    	DyObject *tmp = *lo_item;
+    	*lo_item++ = *hi_item;
+    	*hi_item-- = tmp;
+    }
+    return true;
+}
+
+
+// Repr ------------------------------------------------------------------------
+#include "stringbuilder.h"
+
+bool list_sbrepr(DyStringBuilder *sb, DyListObject *self)
+{
+    if (!DyStringBuilder_AppendChar(sb, '['))
+        return_error(false);
+
+    for (size_t i = 0; i < (self->size < 20 ? self->size : 20); ++i)
+    {
+        if (i && !DyStringBuilder_Append(sb, ", ", 2))
+            return_error(false);
+
+        if (!sbrepr(sb, self->items[i]))
+            return_error(false);
     }
 
-    return lbs;
+    return DyStringBuilder_AppendChar(sb, ']');
 }
 
@@ -38,4 +38,4 @@ DyObject *list_getitem(DyListObject *self, ssize_t key);
 DyObject *list_getitemu(DyListObject *self, ssize_t key);
 bool list_setitem(DyListObject *self, ssize_t key, DyObject *value);
 
-struct dy_buildstring_t *list_bsrepr(struct dy_buildstring_t *bs, DyListObject *self);
+bool list_sbrepr(struct DyStringBuilder *sb, DyListObject *self);
@@ -155,6 +155,7 @@ LIBDY_API const char *Dy_AsRepr(DyObject *self);
  * @return The length
  *
  * For lists: the number of items contained
+ * For dicts: the number of items contained (not counting inherited ones)
  * For strings: the string length
  */
 LIBDY_API size_t      Dy_Length(DyObject *self);
@@ -0,0 +1,209 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pool_p.h"
+#include "freelist_p.h"
+#include "region_p.h"
+#include "exceptions.h"
+
+#include <stdatomic.h>
+
+// ----------------------------------------------------------------------------
+// Object Pools
+//
+// Numbers, lists, dicts and userdata are small and have a fixed size, so they
+// are carved out of slabs instead of being allocated one by one. There is one
+// pool per size class, shared by all types of that size. A pool hands out
+// objects from its freelist and refills it with a new slab when it runs dry.
+// DyHost.pool_limit bounds how much memory a pool keeps in slabs. Past that,
+// objects come from the allocator and go back to it, and only the objects
+// with DY_POOLED set are returned to a pool.
+//
+// Objects don't know their slab, so a pool can't tell when a single slab
+// becomes empty. Once all of its objects are freed, though, every slab is;
+// the pool then gives back all but one, which saves churn when a pool keeps
+// going from empty to one object and back.
+typedef struct pool_slab_t {
+    struct pool_slab_t *next;
+    freelist_t items;
+} pool_slab_t;
+
+typedef struct pool_t {
+    // Also keeps pools on separate cache lines
+    _Alignas(64) atomic_flag lock;
+    pool_slab_t *slabs;
+    size_t nslabs;
+    size_t in_use;
+    size_t overflows;
+    size_t released;
+    freelist_t free;
+} pool_t;
+
+static pool_t DyPools[POOL_CLASSES];
+
+static inline pool_t *pool_get(size_t size)
+{
+    assert(size && size <= POOL_MAX_SIZE);
+    return &DyPools[(size - 1) / POOL_GRANULE];
+}
+
+static inline size_t pool_item_size(pool_t *pool)
+{
+    return (pool - DyPools + 1) * POOL_GRANULE;
+}
+
+static inline size_t pool_slab_items(pool_t *pool)
+{
+    return (POOL_SLAB_SIZE - sizeof(pool_slab_t)) / pool_item_size(pool);
+}
+
+static inline void pool_lock(pool_t *pool)
+{
+    while (atomic_flag_test_and_set_explicit(&pool->lock, memory_order_acquire));
+}
+
+static inline void pool_unlock(pool_t *pool)
+{
+    atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+}
+
+// Add a slab to an empty pool. Called with the lock held.
+static bool pool_refill(pool_t *pool)
+{
+    if ((pool->nslabs + 1) * POOL_SLAB_SIZE > DyHost.pool_limit)
+        return false;
+
+    pool_slab_t *slab = dy_malloc(POOL_SLAB_SIZE);
+    if (!slab)
+        return false;
+
+    freelist_init(&slab->items, pool_item_size(pool), pool_slab_items(pool));
+    pool->free.root = slab->items.root;
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    ++pool->nslabs;
+    return true;
+}
+
+// Keep only the newest slab of a pool without objects in use, returning the
+// others for the caller to free. Called with the lock held.
+static pool_slab_t *pool_shrink(pool_t *pool)
+{
+    pool_slab_t *slab = pool->slabs;
+    pool_slab_t *released = slab->next;
+
+    slab->next = NULL;
+    freelist_init(&slab->items, pool_item_size(pool), pool_slab_items(pool));
+    pool->free.root = slab->items.root;
+
+    pool->released += pool->nslabs - 1;
+    pool->nslabs = 1;
+    return released;
+}
+
+DyObject *pool_new(DyObjectType type, size_t size)
+{
+    DyObject *o = NULL;
+
+    // Regions take care of their objects themselves
+    if (dy_region)
+    {
+        o = object_malloc(size);
+        if (!o)
+        {
+            DyErr_SetMemoryError();
+            return_null;
+        }
+        object_init(o, type);
+        return o;
+    }
+
+    pool_t *pool = pool_get(size);
+
+    pool_lock(pool);
+    if (!freelist_empty(&pool->free) || pool_refill(pool))
+    {
+        o = (DyObject *)freelist_pop(&pool->free);
+        ++pool->in_use;
+    }
+    else
+        ++pool->overflows;
+    pool_unlock(pool);
+
+    if (o)
+        o->flags = DY_POOLED;
+    else
+    {
+        o = dy_malloc(size);
+        if (!o)
+        {
+            DyErr_SetMemoryError();
+            return_null;
+        }
+        o->flags = 0;
+    }
+
+    o->type = type;
+    o->refcnt = 1;
+    return o;
+}
+
+void pool_free(DyObject *o, size_t size)
+{
+    if (!(o->flags & DY_POOLED))
+    {
+        dy_free(o);
+        return;
+    }
+
+    pool_t *pool = pool_get(size);
+    pool_slab_t *released = NULL;
+
+    pool_lock(pool);
+    freelist_push(&pool->free, (freelist_entry_t *)o);
+    if (!--pool->in_use && pool->nslabs > 1)
+        released = pool_shrink(pool);
+    pool_unlock(pool);
+
+    while (released)
+    {
+        pool_slab_t *next = released->next;
+        dy_free(released);
+        released = next;
+    }
+}
+
+size_t DyHost_GetPoolStats(DyPoolStats *stats, size_t count)
+{
+    for (size_t i = 0; i < count && i < POOL_CLASSES; ++i)
+    {
+        pool_t *pool = &DyPools[i];
+
+        pool_lock(pool);
+        stats[i].object_size = pool_item_size(pool);
+        stats[i].slabs = pool->nslabs;
+        stats[i].capacity = pool->nslabs * pool_slab_items(pool);
+        stats[i].in_use = pool->in_use;
+        stats[i].overflows = pool->overflows;
+        stats[i].released = pool->released;
+        pool_unlock(pool);
+    }
+
+    return POOL_CLASSES;
+}
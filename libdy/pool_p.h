@@ -0,0 +1,53 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "dy_p.h"
+
+/**
+ * @file pool_p.h
+ * @brief Object pools for the small fixed-size object types
+ */
+
+// Size classes are POOL_GRANULE bytes apart, up to POOL_MAX_SIZE
+#define POOL_GRANULE 16
+#define POOL_CLASSES 8
+#define POOL_MAX_SIZE (POOL_GRANULE * POOL_CLASSES)
+
+// Memory taken from the allocator at once
+#define POOL_SLAB_SIZE 16384
+
+/**
+ * @brief Allocate an object and initialize its header
+ * @param type The object type
+ * @param size The object size, at most POOL_MAX_SIZE
+ * @return The object with a reference count of 1, NULL with a MemoryError set
+ *
+ * The object comes from the thread's region if it is in one, otherwise from
+ * a pool slab if the pool is below its limit, in which case its flags are
+ * DY_POOLED. The rest of the object is NOT cleared.
+ */
+DyObject *pool_new(DyObjectType type, size_t size);
+
+/**
+ * @brief Free an object allocated by pool_new()
+ * @param o The object
+ * @param size The size passed to pool_new()
+ */
+void pool_free(DyObject *o, size_t size);
@@ -0,0 +1,93 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "region_p.h"
+#include "exceptions.h"
+
+
+// The first chunk of a region, unless told otherwise
+#define REGION_DEFAULT_SIZE 65536
+
+
+_Thread_local DyRegion *dy_region;
+
+DyRegion *DyRegion_New(size_t size)
+{
+    dy_linalloc_t *arena = dy_linalloc_new(size ? size : REGION_DEFAULT_SIZE, DyHost.mm.malloc);
+    if (!arena)
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    // The region lives in its own arena
+    DyRegion *region = dy_linalloc_malloc(arena, sizeof(DyRegion));
+    if (!region)
+    {
+        dy_linalloc_free(arena, DyHost.mm.free);
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    region->arena = arena;
+    region->outer = NULL;
+    return region;
+}
+
+void DyRegion_Enter(DyRegion *region)
+{
+    region->outer = dy_region;
+    dy_region = region;
+}
+
+void DyRegion_Leave(DyRegion *region)
+{
+    assert(dy_region == region && "DyRegion_Leave: not the current region");
+    dy_region = region->outer;
+    region->outer = NULL;
+}
+
+DyRegion *region_of(DyObject *o)
+{
+    for (DyRegion *region = dy_region; region; region = region->outer)
+        if (dy_linalloc_owns(region->arena, o))
+            return region;
+    return NULL;
+}
+
+void *region_error(void)
+{
+    DyErr_Set(DY_ERRID_REGION_ERROR, "Object belongs to a region that is not entered on this thread");
+    return_null;
+}
+
+DyRegion *DyRegion_Current(void)
+{
+    return dy_region;
+}
+
+size_t DyRegion_Size(DyRegion *region)
+{
+    return dy_linalloc_used(region->arena);
+}
+
+void DyRegion_Free(DyRegion *region)
+{
+    assert(dy_region != region && "DyRegion_Free: region is still entered");
+    dy_linalloc_free(region->arena, DyHost.mm.free);
+}
@@ -0,0 +1,109 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file libdy/region.h
+ * @brief Allocating whole object trees at once
+ *
+ * While a region is entered on a thread, the objects created on that thread
+ * are allocated from the region's arena. Their reference counts are left
+ * alone, and none of them is freed on its own: DyRegion_Free() releases the
+ * whole region in one go. This suits documents that are built or parsed,
+ * used and thrown away together:
+ * @code
+ * DyRegion *region = DyRegion_New(0);
+ * DyRegion_Enter(region);
+ * DyObject *doc = DyJson_Parse(request);
+ * DyRegion_Leave(region);
+ * // ... use doc ...
+ * DyRegion_Free(region);
+ * @endcode
+ *
+ * The objects of a region must not be used after it is freed, so they
+ * must not be stored in objects that live longer. Objects from outside
+ * that are stored in the region are never released by it. Destructors of
+ * userdata and array buffers in the region are not called.
+ *
+ * Containers of a region can only grow while the region is entered on
+ * the calling thread, though another one may be entered inside of it.
+ * Otherwise growing them fails with a dy.ValueError.RegionError.
+ * Interned strings never live in a region, and dicts in a region don't
+ * intern their keys or share key tables.
+ */
+
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/// An object allocation region
+typedef struct DyRegion DyRegion;
+
+/**
+ * @brief Create a new region
+ * @param size The size of its first chunk of memory, 0 for a default.
+ *        It grows as needed.
+ * @return A new region, NULL with a MemoryError set on failure
+ */
+LIBDY_API DyRegion *DyRegion_New(size_t size);
+
+/**
+ * @brief Allocate new objects on the calling thread from a region
+ * @param region The region. It can only be entered by one thread at a time.
+ *
+ * Regions can be nested, leaving the inner one continues with the outer one.
+ * Containers keep growing in the region they were created in.
+ */
+LIBDY_API void DyRegion_Enter(DyRegion *region);
+
+/**
+ * @brief Stop allocating from a region
+ * @param region The region most recently entered on the calling thread
+ */
+LIBDY_API void DyRegion_Leave(DyRegion *region);
+
+/**
+ * @brief Get the region the calling thread allocates from
+ * @return The region, NULL if none is entered
+ */
+LIBDY_API DyRegion *DyRegion_Current(void);
+
+/**
+ * @brief Get the memory allocated from a region
+ * @return The size of the allocations in bytes
+ */
+LIBDY_API size_t DyRegion_Size(DyRegion *region);
+
+/**
+ * @brief Free a region and all objects in it
+ * @param region The region, which must not be entered anymore
+ */
+LIBDY_API void DyRegion_Free(DyRegion *region);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,133 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "region.h"
+#include "linalloc.h"
+#include "dy_p.h"
+#include "exceptions.h"
+
+#include <stdatomic.h>
+
+/**
+ * @file region_p.h
+ * @brief Region implementation header
+ */
+
+struct DyRegion {
+    dy_linalloc_t *arena;
+    struct DyRegion *outer;     // The region entered before, while entered
+};
+
+// The region new objects come from, NULL outside of regions
+extern _Thread_local DyRegion *dy_region;
+
+// Objects in a region are immortal and have this reference count
+#define DY_REGION_REFCNT UINT32_MAX
+
+static inline bool region_owns(DyObject *o)
+{
+    return object_flags(o) & DY_IMMORTAL
+        && atomic_load_explicit(&o->refcnt, memory_order_relaxed) == DY_REGION_REFCNT;
+}
+
+// Memory for a new object, from the thread's region if it is in one.
+// It must be initialized by object_init() before leaving the region.
+static inline void *object_malloc(size_t size)
+{
+    DyRegion *region = dy_region;
+    return region ? dy_linalloc_malloc(region->arena, size) : dy_malloc(size);
+}
+
+static inline void object_init(DyObject *o, DyObjectType type)
+{
+    Dy_InitObject(o, type);
+    if (dy_region)
+    {
+        o->flags = DY_IMMORTAL;
+        o->refcnt = DY_REGION_REFCNT;
+    }
+}
+
+// The region an object was allocated from, if it is entered on this thread
+DyRegion *region_of(DyObject *o);
+
+// Sets the error for growing an object whose region isn't entered
+void *region_error(void);
+
+// Memory belonging to an object. Objects in a region keep theirs there,
+// so it's only available while the region is entered. These set an error
+// when they fail.
+static inline void *object_buffer(DyObject *owner, size_t size)
+{
+    void *mem;
+    if (!region_owns(owner))
+        mem = dy_malloc(size);
+    else
+    {
+        DyRegion *region = region_of(owner);
+        if (!region)
+            return region_error();
+        mem = dy_linalloc_malloc(region->arena, size);
+    }
+
+    if (!mem)
+        DyErr_SetMemoryError();
+    return mem;
+}
+
+// Shrinking doesn't fail, it may keep the old memory
+static inline void *object_realloc(DyObject *owner, void *ptr, size_t old_size, size_t size)
+{
+    void *mem;
+    if (!region_owns(owner))
+        mem = dy_realloc(ptr, size);
+    else
+    {
+        DyRegion *region = region_of(owner);
+        if (!region)
+            return size <= old_size ? ptr : region_error();
+        mem = dy_linalloc_realloc(region->arena, ptr, old_size, size);
+    }
+
+    if (!mem && size <= old_size)
+        return ptr;
+    if (!mem)
+        DyErr_SetMemoryError();
+    return mem;
+}
+
+static inline void object_free(DyObject *owner, void *ptr)
+{
+    if (!region_owns(owner))
+        dy_free(ptr);
+}
+
+// Allocate global data while in a region
+static inline DyRegion *region_suspend(void)
+{
+    DyRegion *region = dy_region;
+    dy_region = NULL;
+    return region;
+}
+
+static inline void region_resume(DyRegion *region)
+{
+    dy_region = region;
+}
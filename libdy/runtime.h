@@ -33,7 +33,9 @@
 #include "types.h"
 #include "config.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 
 #ifdef __cplusplus
@@ -53,11 +55,105 @@ typedef DyHash (*Dy_string_hash_fn)(const char *data, size_t length);
  */
 LIBDY_API void DyHost_SetHashFunc(Dy_string_hash_fn func);
 
+/**
+ * @brief Set the key of the seeded hash functions
+ * @param k0 The first half of the 128 bit key
+ * @param k1 The second half
+ * The key is random for every process by default, so colliding keys can't
+ * be crafted in advance. Fixing it makes hash values reproducible.
+ * Like DyHost_SetHashFunc(), this must be done before using ANY libdy objects.
+ */
+LIBDY_API void DyHost_SetHashSeed(uint64_t k0, uint64_t k1);
+
+/**
+ * @brief Make DyString_FromStringAndSize() validate its input
+ * @param check Whether strings have to be valid UTF-8
+ * Invalid strings are rejected with a dy.EncodingError then. This is off by
+ * default; strings from the JSON parser are always checked.
+ */
+LIBDY_API void DyHost_SetCheckUTF8(bool check);
+
 ///@{
 ///@name Predefined hash functions:
+/// FNV-1, unseeded
 LIBDY_API DyHash Dy_hash_fnv1(const char *data, size_t length);
+/// 32-bit Murmur3, seeded
 LIBDY_API DyHash Dy_hash_Murmur3_32(const char *data, size_t length);
+/// 64-bit wyhash, seeded; the default
+LIBDY_API DyHash Dy_hash_wyhash(const char *data, size_t length);
+/**
+ * SipHash-1-3, keyed with the full 128 bit seed.
+ * Slower, but collisions can't be found without knowing the key.
+ * Dictionaries and the intern table switch to it on their own when they
+ * detect colliding keys, so it's seldom necessary to make it the default.
+ */
+LIBDY_API DyHash Dy_hash_siphash13(const char *data, size_t length);
+///@}
+
+///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name Dictionaries
+/**
+ * @brief Tune the dictionary table allocation
+ * @param table_size The number of slots allocated for a dictionary's first
+ *        table (rounded up to a power of 2, at least 8)
+ * @param block_size Tables with at most this many slots are kept allocated
+ *        when a dictionary is cleared
+ */
+LIBDY_API void DyHost_SetDictSizes(size_t table_size, size_t block_size);
+
 ///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name Lists
+/**
+ * @brief Set the number of threads sorting long lists
+ * @param threads The maximum number of threads, 1 to sort on the calling
+ *        thread only. 0, the default, uses one thread per CPU.
+ *        No more than 16 threads are used either way.
+ *
+ * The worker threads are started by the first sort that needs them and kept
+ * for later ones. Only one sort at a time uses them; lists sorted meanwhile
+ * on other threads are sorted by those threads alone.
+ * @sa DyList_Sort
+ */
+LIBDY_API void DyHost_SetSortThreads(unsigned threads);
+
+///@}
+// ----------------------------------------------------------------------------
+///@{
+///@name Object pools
+/**
+ * @brief Limit the memory kept for pooled objects
+ * @param bytes The maximum size of the slabs of one size class. 0 disables
+ *        the pools for new objects.
+ *
+ * Numbers, lists, dictionaries and userdata objects are allocated from
+ * slabs grouped by size, which are kept when the objects are freed.
+ * Once all objects of a size class are freed, all but one of its slabs
+ * are given back. Once a size class reaches the limit, further objects
+ * are allocated one by one. The default is 64 MiB.
+ */
+LIBDY_API void DyHost_SetPoolLimit(size_t bytes);
+
+/// Statistics of the pool of one size class
+typedef struct DyPoolStats {
+    size_t object_size; ///< The size of the pooled objects in bytes
+    size_t slabs;       ///< The number of slabs allocated
+    size_t capacity;    ///< The number of objects the slabs hold
+    size_t in_use;      ///< The number of objects currently allocated
+    size_t overflows;   ///< Objects allocated outside the pool because of the limit
+    size_t released;    ///< The number of slabs given back to the allocator
+} DyPoolStats;
+
+/**
+ * @brief Get statistics on the object pools
+ * @param stats Array receiving the statistics of each size class
+ * @param count The length of @p stats
+ * @return The number of size classes
+ */
+LIBDY_API size_t DyHost_GetPoolStats(DyPoolStats *stats, size_t count);
 
 ///@}
 // ----------------------------------------------------------------------------
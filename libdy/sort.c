@@ -0,0 +1,683 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "list_p.h"
+#include "string_p.h"
+#include "exceptions.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// Lists are sorted as arrays of entries: the item's index and, for keys of
+// a single type, a 64 bit number that orders like the key itself. Longs
+// and floats are compared by that number alone, strings by their first
+// 8 bytes first. The items are only put in order once everything is sorted.
+//
+// The sort is a merge sort that finds runs already in order, like timsort.
+// Large lists are cut into chunks that are sorted on separate threads and
+// then merged in rounds, splitting each merge among the threads. The worker
+// threads are started on first use and kept for later sorts.
+
+typedef struct sort_entry {
+    uint64_t v;
+    size_t index;
+} sort_entry;
+
+enum sort_mode {
+    SORT_BITS,      // Only v: all longs or all floats
+    SORT_STRING,    // v is a prefix
+    SORT_NUMBER,    // Mixed longs and floats
+    SORT_CALLBACK,  // User comparator
+};
+
+typedef struct sort_t {
+    enum sort_mode mode;
+    DyObject **keys;
+    DyList_CompareFn compare;
+    void *data;
+} sort_t;
+
+// Runs shorter than this are extended with insertion sort
+#define SORT_MIN_RUN 32
+
+// Lists with fewer items are sorted on a single thread
+#define SORT_PARALLEL_MIN (1 << 16)
+
+// No more threads than this sort one list, they're sized on the stack
+#define SORT_MAX_THREADS 16
+
+// Enough for runs of at least SORT_MIN_RUN under timsort's stack invariant
+#define SORT_MAX_RUNS 128
+
+#ifdef __GNUC__
+#define SORT_INLINE inline static __attribute__((always_inline))
+#else
+#define SORT_INLINE inline static
+#endif
+
+
+// Keys -----------------------------------------------------------------------
+static int string_compare(DyObject *a, DyObject *b)
+{
+    DyStringObject *x = (DyStringObject *)a, *y = (DyStringObject *)b;
+    int result = memcmp(string_data(x), string_data(y), x->size < y->size ? x->size : y->size);
+    if (result)
+        return result;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+static int number_compare(DyObject *a, DyObject *b)
+{
+    if (a->type == DY_LONG && b->type == DY_LONG)
+    {
+        int64_t x = DyLong_Get(a), y = DyLong_Get(b);
+        return (x > y) - (x < y);
+    }
+
+    double x = a->type == DY_LONG ? (double)DyLong_Get(a) : DyFloat_Get(a);
+    double y = b->type == DY_LONG ? (double)DyLong_Get(b) : DyFloat_Get(b);
+    return (x > y) - (x < y);
+}
+
+static uint64_t long_bits(int64_t value)
+{
+    return (uint64_t)value ^ (1ull << 63);
+}
+
+// Positive floats get the sign bit set, negative ones are flipped entirely
+static uint64_t float_bits(double value)
+{
+    if (value == 0)
+        value = 0; // -0.0 == 0.0
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (1ull << 63);
+}
+
+static uint64_t string_prefix(DyObject *str)
+{
+    DyStringObject *so = (DyStringObject *)str;
+    const uint8_t *data = (const uint8_t *)string_data(so);
+    size_t size = so->size < 8 ? so->size : 8;
+
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < size; ++i)
+        prefix |= (uint64_t)data[i] << (56 - 8 * i);
+    return prefix;
+}
+
+
+// Serial merge sort ----------------------------------------------------------
+SORT_INLINE int sort_cmp(const sort_t *s, const sort_entry *a, const sort_entry *b, enum sort_mode mode)
+{
+    if ((mode == SORT_BITS || mode == SORT_STRING) && a->v != b->v)
+        return a->v < b->v ? -1 : 1;
+
+    switch (mode)
+    {
+    case SORT_BITS:
+        return 0;
+    case SORT_STRING:
+        return string_compare(s->keys[a->index], s->keys[b->index]);
+    case SORT_NUMBER:
+        return number_compare(s->keys[a->index], s->keys[b->index]);
+    default:
+        return s->compare(s->keys[a->index], s->keys[b->index], s->data);
+    }
+}
+
+// The first entry in a that goes after x
+SORT_INLINE size_t upper_bound(const sort_t *s, const sort_entry *a, size_t n, const sort_entry *x, enum sort_mode mode)
+{
+    size_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sort_cmp(s, x, &a[mid], mode) < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+// The first entry in a that doesn't go before x
+SORT_INLINE size_t lower_bound(const sort_t *s, const sort_entry *a, size_t n, const sort_entry *x, enum sort_mode mode)
+{
+    size_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sort_cmp(s, &a[mid], x, mode) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// a[0:start] is sorted, insert the rest
+SORT_INLINE void insertion_sort(const sort_t *s, sort_entry *a, size_t start, size_t n, enum sort_mode mode)
+{
+    for (size_t i = start; i < n; ++i)
+    {
+        sort_entry x = a[i];
+        size_t at = upper_bound(s, a, i, &x, mode);
+        memmove(a + at + 1, a + at, sizeof(sort_entry) * (i - at));
+        a[at] = x;
+    }
+}
+
+// Length of the run at the start of a. Strictly descending runs are
+// reversed; equal entries would swap places otherwise.
+SORT_INLINE size_t count_run(const sort_t *s, sort_entry *a, size_t n, enum sort_mode mode)
+{
+    if (n < 2)
+        return n;
+
+    size_t i = 2;
+    if (sort_cmp(s, &a[1], &a[0], mode) < 0)
+    {
+        while (i < n && sort_cmp(s, &a[i], &a[i - 1], mode) < 0)
+            ++i;
+
+        for (sort_entry *lo = a, *hi = a + i - 1; lo < hi; ++lo, --hi)
+        {
+            sort_entry tmp = *lo;
+            *lo = *hi;
+            *hi = tmp;
+        }
+    }
+    else
+    {
+        while (i < n && sort_cmp(s, &a[i], &a[i - 1], mode) >= 0)
+            ++i;
+    }
+    return i;
+}
+
+// Merge the sorted runs a[0:na] and a[na:na+nb]. Entries that are already
+// in place at either end are left alone, the rest of a goes through tmp.
+SORT_INLINE void merge_adjacent(const sort_t *s, sort_entry *a, size_t na, size_t nb, sort_entry *tmp, enum sort_mode mode)
+{
+    sort_entry *b = a + na;
+    if (sort_cmp(s, &b[0], &a[na - 1], mode) >= 0)
+        return;
+
+    size_t skip = upper_bound(s, a, na, &b[0], mode);
+    a += skip;
+    na -= skip;
+    nb = lower_bound(s, b, nb, &a[na - 1], mode);
+
+    memcpy(tmp, a, sizeof(sort_entry) * na);
+
+    sort_entry *x = tmp, *x_end = tmp + na, *y = b, *y_end = b + nb, *out = a;
+    while (x < x_end && y < y_end)
+        *out++ = sort_cmp(s, y, x, mode) < 0 ? *y++ : *x++;
+
+    memcpy(out, x, sizeof(sort_entry) * (x_end - x));
+}
+
+SORT_INLINE void sort_serial(const sort_t *s, sort_entry *a, size_t n, sort_entry *tmp, enum sort_mode mode)
+{
+    size_t start[SORT_MAX_RUNS], len[SORT_MAX_RUNS];
+    size_t runs = 0;
+
+#define MERGE_AT(k) do { \
+        merge_adjacent(s, a + start[k], len[k], len[(k) + 1], tmp, mode); \
+        len[k] += len[(k) + 1]; \
+        if ((k) + 2 < runs) \
+        { \
+            start[(k) + 1] = start[(k) + 2]; \
+            len[(k) + 1] = len[(k) + 2]; \
+        } \
+        --runs; \
+    } while (0)
+
+    for (size_t pos = 0; pos < n; )
+    {
+        size_t run = count_run(s, a + pos, n - pos, mode);
+        if (run < SORT_MIN_RUN)
+        {
+            size_t extended = n - pos < SORT_MIN_RUN ? n - pos : SORT_MIN_RUN;
+            insertion_sort(s, a + pos, run, extended, mode);
+            run = extended;
+        }
+
+        start[runs] = pos;
+        len[runs] = run;
+        ++runs;
+        pos += run;
+
+        // Keep the run lengths growing like Fibonacci numbers
+        while (runs > 1)
+        {
+            size_t k = runs - 2;
+            if ((k > 0 && len[k - 1] <= len[k] + len[k + 1])
+             || (k > 1 && len[k - 2] <= len[k - 1] + len[k]))
+            {
+                if (len[k - 1] < len[k + 1])
+                    --k;
+                MERGE_AT(k);
+            }
+            else if (len[k] <= len[k + 1])
+                MERGE_AT(k);
+            else
+                break;
+        }
+    }
+
+    while (runs > 1)
+    {
+        size_t k = runs - 2;
+        if (k > 0 && len[k - 1] < len[k + 1])
+            --k;
+        MERGE_AT(k);
+    }
+
+#undef MERGE_AT
+}
+
+// Parallel merging -----------------------------------------------------------
+// How many of the first k merged entries come from a
+SORT_INLINE size_t merge_split(const sort_t *s, const sort_entry *a, size_t na,
+                               const sort_entry *b, size_t nb, size_t k, enum sort_mode mode)
+{
+    size_t lo = k > nb ? k - nb : 0, hi = k < na ? k : na;
+    while (lo < hi)
+    {
+        size_t i = lo + (hi - lo) / 2, j = k - i;
+        // Taking i from a is enough once b[j-1] goes before a[i]
+        if (j == 0 || sort_cmp(s, &b[j - 1], &a[i], mode) < 0)
+            hi = i;
+        else
+            lo = i + 1;
+    }
+    return lo;
+}
+
+// Merge the entries [first, last) of the merge of a and b into out
+SORT_INLINE void merge_piece(const sort_t *s, const sort_entry *a, size_t na, const sort_entry *b, size_t nb,
+                             size_t first, size_t last, sort_entry *out, enum sort_mode mode)
+{
+    size_t i = merge_split(s, a, na, b, nb, first, mode), j = first - i;
+    size_t i_end = merge_split(s, a, na, b, nb, last, mode), j_end = last - i_end;
+
+    out += first;
+    while (i < i_end && j < j_end)
+        *out++ = sort_cmp(s, &b[j], &a[i], mode) < 0 ? b[j++] : a[i++];
+
+    memcpy(out, a + i, sizeof(sort_entry) * (i_end - i));
+    memcpy(out + (i_end - i), b + j, sizeof(sort_entry) * (j_end - j));
+}
+
+// One copy of the sort for each mode, with the comparison inlined
+#define SORT_INSTANCE(name, mode) \
+    static void sort_serial_##name(const sort_t *s, sort_entry *a, size_t n, sort_entry *tmp) \
+    { \
+        sort_serial(s, a, n, tmp, mode); \
+    } \
+    static void merge_piece_##name(const sort_t *s, const sort_entry *a, size_t na, const sort_entry *b, size_t nb, \
+                                   size_t first, size_t last, sort_entry *out) \
+    { \
+        merge_piece(s, a, na, b, nb, first, last, out, mode); \
+    }
+
+SORT_INSTANCE(bits, SORT_BITS)
+SORT_INSTANCE(string, SORT_STRING)
+SORT_INSTANCE(number, SORT_NUMBER)
+SORT_INSTANCE(callback, SORT_CALLBACK)
+
+static void (*const sort_serial_fns[])(const sort_t *, sort_entry *, size_t, sort_entry *) = {
+    sort_serial_bits, sort_serial_string, sort_serial_number, sort_serial_callback,
+};
+
+static void (*const merge_piece_fns[])(const sort_t *, const sort_entry *, size_t, const sort_entry *, size_t,
+                                       size_t, size_t, sort_entry *) = {
+    merge_piece_bits, merge_piece_string, merge_piece_number, merge_piece_callback,
+};
+
+// Work shared by the threads. Each round is split into units that the
+// threads take in turn: sorting a chunk, or a piece of merging two chunks.
+typedef struct sort_job {
+    const sort_t *s;
+    sort_entry *src, *dst;
+    size_t *bounds;     // Chunk i is src[bounds[i]:bounds[i+1]]
+    size_t chunks;
+    size_t pieces;      // Per merge
+    size_t units;
+    _Atomic(size_t) next;
+} sort_job;
+
+static void sort_unit(sort_job *job, size_t unit)
+{
+    const sort_t *s = job->s;
+    size_t *bounds = job->bounds;
+
+    // Sorting the chunks, using dst as scratch space
+    if (!job->pieces)
+    {
+        sort_serial_fns[s->mode](s, job->src + bounds[unit], bounds[unit + 1] - bounds[unit], job->dst + bounds[unit]);
+        return;
+    }
+
+    size_t pair = unit / job->pieces, piece = unit % job->pieces;
+    size_t a = bounds[2 * pair], b = bounds[2 * pair + 1];
+
+    // The odd chunk out is copied over
+    if (2 * pair + 1 == job->chunks)
+    {
+        if (!piece)
+            memcpy(job->dst + a, job->src + a, sizeof(sort_entry) * (bounds[job->chunks] - a));
+        return;
+    }
+
+    size_t end = bounds[2 * pair + 2];
+    size_t n = end - a;
+    merge_piece_fns[s->mode](s, job->src + a, b - a, job->src + b, end - b,
+                             n * piece / job->pieces, n * (piece + 1) / job->pieces, job->dst + a);
+}
+
+static void sort_work(sort_job *job)
+{
+    size_t unit;
+    while ((unit = job->next++) < job->units)
+        sort_unit(job, unit);
+}
+
+// Worker threads are started when a sort first needs them and then wait for
+// the rounds of later sorts. One sort uses them at a time.
+static struct {
+    pthread_mutex_t owner;  // Held by the sort using the workers
+    pthread_mutex_t lock;   // Protects the rest
+    pthread_cond_t wake, done;
+    unsigned workers;       // Started so far
+    sort_job *job;
+    uint64_t round;
+    unsigned wanted;        // Workers 0..wanted-1 take part in the round
+    unsigned busy;          // Of those, the ones not finished yet
+} sort_pool = {
+    .owner = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static void *sort_worker(void *arg)
+{
+    unsigned id = (unsigned)(uintptr_t)arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&sort_pool.lock);
+    while (true)
+    {
+        while (sort_pool.round == seen)
+            pthread_cond_wait(&sort_pool.wake, &sort_pool.lock);
+        // A new worker catches up on the last round too, which didn't
+        // count on it, since it wasn't numbered yet
+        seen = sort_pool.round;
+        if (id >= sort_pool.wanted)
+            continue;
+
+        sort_job *job = sort_pool.job;
+        pthread_mutex_unlock(&sort_pool.lock);
+        sort_work(job);
+        pthread_mutex_lock(&sort_pool.lock);
+
+        if (!--sort_pool.busy)
+            pthread_cond_signal(&sort_pool.done);
+    }
+    return NULL;
+}
+
+// Make sure there are count workers, returning how many there are.
+// Called by the owner of the pool.
+static unsigned sort_pool_start(unsigned count)
+{
+    pthread_mutex_lock(&sort_pool.lock);
+    while (sort_pool.workers < count)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, sort_worker, (void *)(uintptr_t)sort_pool.workers))
+            break;
+        pthread_detach(thread);
+        ++sort_pool.workers;
+    }
+    count = sort_pool.workers < count ? sort_pool.workers : count;
+    pthread_mutex_unlock(&sort_pool.lock);
+    return count;
+}
+
+// Work on the job with this thread and up to helpers workers
+static void sort_run(sort_job *job, unsigned helpers)
+{
+    job->next = 0;
+    if (helpers > job->units - 1)
+        helpers = job->units - 1;
+
+    if (helpers)
+    {
+        pthread_mutex_lock(&sort_pool.lock);
+        sort_pool.job = job;
+        sort_pool.wanted = sort_pool.busy = helpers;
+        ++sort_pool.round;
+        pthread_cond_broadcast(&sort_pool.wake);
+        pthread_mutex_unlock(&sort_pool.lock);
+    }
+
+    sort_work(job);
+
+    if (helpers)
+    {
+        pthread_mutex_lock(&sort_pool.lock);
+        while (sort_pool.busy)
+            pthread_cond_wait(&sort_pool.done, &sort_pool.lock);
+        pthread_mutex_unlock(&sort_pool.lock);
+    }
+}
+
+static unsigned sort_threads(void)
+{
+    if (DyHost.sort_threads)
+        return DyHost.sort_threads < SORT_MAX_THREADS ? DyHost.sort_threads : SORT_MAX_THREADS;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : cpus > SORT_MAX_THREADS ? SORT_MAX_THREADS : (unsigned)cpus;
+}
+
+// Sort entries, returning the buffer that ends up holding them
+static sort_entry *sort_entries(const sort_t *s, sort_entry *entries, size_t n, sort_entry *tmp)
+{
+    // Sorts that find the workers busy run on their own thread
+    unsigned threads = sort_threads();
+    if (n < SORT_PARALLEL_MIN || threads < 2 || pthread_mutex_trylock(&sort_pool.owner))
+    {
+        sort_serial_fns[s->mode](s, entries, n, tmp);
+        return entries;
+    }
+
+    unsigned helpers = sort_pool_start(threads - 1);
+
+    size_t bounds[threads + 1];
+    for (unsigned i = 0; i <= threads; ++i)
+        bounds[i] = n * i / threads;
+
+    sort_job job = {
+        .s = s,
+        .src = entries,
+        .dst = tmp,
+        .bounds = bounds,
+        .chunks = threads,
+        .pieces = 0,
+        .units = threads,
+    };
+    sort_run(&job, helpers);
+
+    while (job.chunks > 1)
+    {
+        size_t pairs = (job.chunks + 1) / 2;
+        job.pieces = (threads + pairs - 1) / pairs;
+        job.units = pairs * job.pieces;
+        sort_run(&job, helpers);
+
+        // Every other bound remains
+        for (size_t i = 0; i < pairs; ++i)
+            bounds[i] = bounds[2 * i];
+        bounds[pairs] = n;
+        job.chunks = pairs;
+
+        sort_entry *swap = job.src;
+        job.src = job.dst;
+        job.dst = swap;
+    }
+
+    pthread_mutex_unlock(&sort_pool.owner);
+    return job.src;
+}
+
+
+// List interface -------------------------------------------------------------
+// Pick the fastest way to compare the keys, filling in the entries
+static bool sort_prepare(sort_t *s, sort_entry *entries, size_t n)
+{
+    bool longs = true, floats = true, strings = true;
+    for (size_t i = 0; i < n; ++i)
+    {
+        DyObjectType type = s->keys[i]->type;
+        longs &= type == DY_LONG;
+        floats &= type == DY_FLOAT;
+        strings &= type == DY_STRING;
+        entries[i].index = i;
+        entries[i].v = 0;
+    }
+
+    if (s->compare)
+        s->mode = SORT_CALLBACK;
+    else if (longs)
+    {
+        s->mode = SORT_BITS;
+        for (size_t i = 0; i < n; ++i)
+            entries[i].v = long_bits(DyLong_Get(s->keys[i]));
+    }
+    else if (floats)
+    {
+        s->mode = SORT_BITS;
+        for (size_t i = 0; i < n; ++i)
+            entries[i].v = float_bits(DyFloat_Get(s->keys[i]));
+    }
+    else if (strings)
+    {
+        s->mode = SORT_STRING;
+        for (size_t i = 0; i < n; ++i)
+            entries[i].v = string_prefix(s->keys[i]);
+    }
+    else
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            DyObjectType type = s->keys[i]->type;
+            if (type != DY_LONG && type != DY_FLOAT)
+            {
+                DyErr_Format(DY_ERRID_TYPE_ERROR, "DyList_Sort(): Can't compare %s objects without a comparator",
+                             Dy_GetTypeName(type));
+                return_error(false);
+            }
+        }
+        s->mode = SORT_NUMBER;
+    }
+
+    return true;
+}
+
+bool DyList_Sort(DyObject *self, DyList_KeyFn key, DyList_CompareFn compare, void *data)
+{
+    if (DyErr_CheckArg("DyList_Sort", 0, DY_LIST, self))
+        return_error(false);
+
+    DyListObject *lo = (DyListObject *)self;
+    size_t n = lo->size;
+    if (n < 2)
+        return true;
+
+    // Callbacks see an empty list, so they can't pull the items away
+    DyObject **items = lo->items;
+    size_t allocated = lo->allocated;
+    lo->items = NULL;
+    lo->size = lo->allocated = 0;
+
+    bool result = false;
+    size_t keyed = 0;
+    sort_t s = { .keys = items, .compare = compare, .data = data };
+    sort_entry *entries = dy_malloc(2 * sizeof(sort_entry) * n);
+    if (!entries)
+    {
+        DyErr_SetMemoryError();
+        goto restore;
+    }
+
+    if (key)
+    {
+        s.keys = dy_malloc(sizeof(DyObject *) * n);
+        if (!s.keys)
+        {
+            DyErr_SetMemoryError();
+            goto restore;
+        }
+
+        for (; keyed < n; ++keyed)
+            if (!(s.keys[keyed] = key(items[keyed], data)))
+                goto restore;
+    }
+
+    if (!sort_prepare(&s, entries, n))
+        goto restore;
+
+    sort_entry *sorted = sort_entries(&s, entries, n, entries + n);
+
+    // Reorder the items, borrowing the unused half of the entries
+    DyObject **reordered = (DyObject **)(sorted == entries ? entries + n : entries);
+    for (size_t i = 0; i < n; ++i)
+        reordered[i] = items[sorted[i].index];
+    memcpy(items, reordered, sizeof(DyObject *) * n);
+    result = true;
+
+restore:
+    if (s.keys != items)
+    {
+        for (size_t i = 0; i < keyed; ++i)
+            Dy_Release(s.keys[i]);
+        dy_free(s.keys);
+    }
+    dy_free(entries);
+
+    if (lo->items || lo->size)
+    {
+        if (result)
+            DyErr_Set(DY_ERRID_VALUE_ERROR, "DyList_Sort(): List modified during sort");
+        result = false;
+        DyList_Clear(self);
+    }
+
+    lo->items = items;
+    lo->size = n;
+    lo->allocated = allocated;
+    return result;
+}
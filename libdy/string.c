@@ -18,14 +18,19 @@
 
 #include "string_p.h"
 #include "host_p.h"
+#include "region_p.h"
 #include "exceptions.h"
 #include "dystring.h"
+#include "userdata.h"
+#include "utf8_p.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <strings.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <stdarg.h>
 
 bool DyString_Check(DyObject *obj)
 {
@@ -35,16 +40,16 @@ bool DyString_Check(DyObject *obj)
 // Implementation
 DyStringObject *string_new_ex(size_t size)
 {
-    DyStringObject *o = dy_malloc(sizeof(DyStringObject) + size);
+    // The size has to fit the header
+    DyStringObject *o = size <= UINT32_MAX ? object_malloc(DYSTRING_ALLOC_SIZE(size)) : NULL;
     if (!o)
     {
         DyErr_SetMemoryError();
         return_null;
     }
 
-    Dy_InitObject((DyObject*)o, DY_STRING);
+    object_init((DyObject*)o, DY_STRING);
 
-    o->flags = 0;
     o->size = size;
 
     return o;
@@ -59,35 +64,197 @@ DyStringObject *string_new(const char *s, size_t size)
     memcpy(o->data, s, size);
     o->data[size] = 0;
 
+    if (size <= STRING_EAGER_HASH_SIZE)
+    {
+        o->hash = DyHost.string_hash_fn(o->data, size);
+        o->flags |= DYSTRING_HASH;
+    }
+
     return o;
 }
 
+DyStringObject *string_new_prehashed(const char *s, size_t size, DyHash hash)
+{
+    DyStringObject *o = string_new_ex(size);
+    if (!o)
+        return_null;
+
+    memcpy(o->data, s, size);
+    o->data[size] = 0;
+
+    o->hash = hash;
+    o->flags |= DYSTRING_HASH;
+
+    return o;
+}
+
+// Views ----------------------------------------------------------------------
+static DyStringObject *view_new(const char *data, size_t size, DyObject *owner, bool terminated)
+{
+    // Objects in a region are never destroyed, a view couldn't free its C string
+    // or let go of its owner
+    if (dy_region)
+        return string_new(data, size);
+
+    DyStringViewObject *o = size <= UINT32_MAX ? dy_malloc(sizeof(DyStringViewObject)) : NULL;
+    if (!o)
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    Dy_InitObject((DyObject*)o, DY_STRING);
+
+    o->flags = DYSTRING_VIEW | (terminated ? DYSTRING_TERMINATED : 0);
+    o->size = size;
+    o->ptr = data;
+    o->owner = owner ? Dy_Retain(owner) : NULL;
+    atomic_init(&o->cstr, NULL);
+
+    return (DyStringObject *)o;
+}
+
+DyStringObject *string_view(DyStringObject *source, const char *data, size_t size)
+{
+    if (size < DYSTRING_VIEW_MIN)
+    {
+        DyStringObject *copy = string_new(data, size);
+        if (copy && source->flags & DYSTRING_ASCII)
+            copy->flags |= DYSTRING_ENCODING_FLAGS;
+        return copy;
+    }
+
+    DyStringObject *view;
+
+    if (!(source->flags & DYSTRING_VIEW))
+        // data[size] lies within the allocation, at worst it's the NUL
+        view = view_new(data, size, (DyObject*)source, !data[size]);
+    else
+    {
+        DyStringViewObject *parent = (DyStringViewObject *)source;
+        const char *end = parent->ptr + parent->size;
+        bool terminated = data + size < end ? !data[size]
+                                            : (parent->flags & DYSTRING_TERMINATED) != 0;
+
+        // Views of literal data have no owner
+        view = view_new(data, size, parent->owner, terminated);
+    }
+
+    // Any part of ASCII text is ASCII too
+    if (view && source->flags & DYSTRING_ASCII)
+        view->flags |= DYSTRING_ENCODING_FLAGS;
+
+    return view;
+}
+
+DyObject *DyString_Slice(DyObject *self, size_t start, size_t size)
+{
+    if (DyErr_CheckArg("DyString_Slice", 0, DY_STRING, self))
+        return_null;
+
+    DyStringObject *str = (DyStringObject *)self;
+    if (start > str->size || size > str->size - start)
+    {
+        DyErr_Format(DY_ERRID_INDEX_ERROR,
+                     "Slice [%zu:%zu] out of bounds for string of size %u",
+                     start, start + size, str->size);
+        return_null;
+    }
+
+    if (start == 0 && size == str->size)
+        return Dy_Retain(self);
+
+    return (DyObject *)string_view(str, string_data(str) + start, size);
+}
+
+DyObject *DyString_FromBuffer(const char *data, size_t size, void *buffer, DyDataDestructor destroy)
+{
+    if (!destroy)
+        return (DyObject *)view_new(data, size, NULL, false);
+
+    // The region would never destroy the buffer's owner, a copy needs no buffer
+    if (dy_region)
+    {
+        DyStringObject *copy = string_new(data, size);
+        destroy(buffer);
+        return (DyObject *)copy;
+    }
+
+    DyObject *owner = DyUser_Create(buffer);
+    if (!owner)
+    {
+        destroy(buffer);
+        return_null;
+    }
+    DyUser_SetDestructor(owner, destroy);
+
+    DyStringObject *view = view_new(data, size, owner, false);
+    Dy_Release(owner);
+    return (DyObject *)view;
+}
+
 DyObject *DyString_FromStringAndSize(const char *data, size_t size)
 {
     //if (size < 16)
     //    return DyString_InternStringFromStringAndSize(data, size);
-    return (DyObject *)string_new(data, size);
+    if (!DyHost.check_utf8)
+        return (DyObject *)string_new(data, size);
+
+    unsigned check = dy_utf8_check(data, size);
+    if (!check)
+    {
+        DyErr_Set(DY_ERRID_ENCODING_ERROR, "DyString_FromStringAndSize: invalid UTF-8");
+        return_null;
+    }
+
+    DyStringObject *o = string_new(data, size);
+    if (o)
+        o->flags |= DYSTRING_CHECKED | DYSTRING_UTF8 | (check & DY_UTF8_ASCII ? DYSTRING_ASCII : 0);
+    return (DyObject *)o;
 }
 
 void string_destroy(DyStringObject *o)
 {
     if (o->flags & DYSTRING_INTERNED)
         string_unintern(o);
+
+    if (o->flags & DYSTRING_VIEW)
+    {
+        DyStringViewObject *view = (DyStringViewObject *)o;
+        dy_free(atomic_load_explicit(&view->cstr, memory_order_acquire));
+        if (view->owner)
+            Dy_Release(view->owner);
+    }
 }
 
 DyHash string_hash(DyStringObject *o)
 {
-    if (!o->flags & DYSTRING_HASH)
+    if (!(__atomic_load_n(&o->flags, __ATOMIC_ACQUIRE) & DYSTRING_HASH))
     {
-        o->hash = DyHost.string_hash_fn(o->data, o->size);
-        o->flags |= DYSTRING_HASH;
+        o->hash = DyHost.string_hash_fn(string_data(o), o->size);
+        string_add_flags(o, DYSTRING_HASH);
     }
     return o->hash;
 }
 
+unsigned string_check(DyStringObject *o)
+{
+    unsigned flags = string_flags(o);
+    if (!(flags & DYSTRING_CHECKED))
+    {
+        unsigned check = dy_utf8_check(string_data(o), o->size);
+        uint8_t found = DYSTRING_CHECKED
+                      | (check & DY_UTF8_VALID ? DYSTRING_UTF8 : 0)
+                      | (check & DY_UTF8_ASCII ? DYSTRING_ASCII : 0);
+        string_add_flags(o, found);
+        flags |= found;
+    }
+    return flags;
+}
+
 inline bool DyString_Equals(DyStringObject *a, DyStringObject *b)
 {
-    return a->size == b->size && !memcmp(a->data, b->data, a->size);
+    return a->size == b->size && !memcmp(string_data(a), string_data(b), a->size);
 }
 
 /*char *DyString_GetString(DyObject *self)
@@ -109,37 +276,278 @@ const char *DyString_AsString(DyObject *self)
     if (DyErr_CheckArg("DyString_AsString", 0, DY_STRING, self))
     	return_null;
 
-    return ((DyStringObject *)self)->data;
+    DyStringObject *str = (DyStringObject *)self;
+    if (!(str->flags & DYSTRING_VIEW))
+        return str->data;
+
+    DyStringViewObject *view = (DyStringViewObject *)self;
+    if (view->flags & DYSTRING_TERMINATED)
+        return view->ptr;
+
+    char *cstr = atomic_load_explicit(&view->cstr, memory_order_acquire);
+    if (cstr)
+        return cstr;
+
+    // Another thread may race us to it, only one copy is kept
+    char *copy = dy_malloc(view->size + 1);
+    if (!copy)
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+    memcpy(copy, view->ptr, view->size);
+    copy[view->size] = 0;
+
+    if (!atomic_compare_exchange_strong_explicit(&view->cstr, &cstr, copy,
+                                                 memory_order_acq_rel, memory_order_acquire))
+    {
+        dy_free(copy);
+        return cstr;
+    }
+    return copy;
+}
+
+const char *DyString_AsStringAndSize(DyObject *self, size_t *size)
+{
+    if (DyErr_CheckArg("DyString_AsStringAndSize", 0, DY_STRING, self))
+    	return_null;
+
+    DyStringObject *str = (DyStringObject *)self;
+    *size = str->size;
+    return string_data(str);
+}
+
+// Encoding --------------------------------------------------------------------
+bool DyString_IsUTF8(DyObject *self)
+{
+    if (DyErr_CheckArg("DyString_IsUTF8", 0, DY_STRING, self))
+        return_error(false);
+
+    return string_check((DyStringObject *)self) & DYSTRING_UTF8;
+}
+
+bool DyString_IsASCII(DyObject *self)
+{
+    if (DyErr_CheckArg("DyString_IsASCII", 0, DY_STRING, self))
+        return_error(false);
+
+    return string_check((DyStringObject *)self) & DYSTRING_ASCII;
+}
+
+size_t DyString_Length(DyObject *self)
+{
+    if (DyErr_CheckArg("DyString_Length", 0, DY_STRING, self))
+        return_error(0);
+
+    DyStringObject *str = (DyStringObject *)self;
+    if (string_check(str) & DYSTRING_ASCII)
+        return str->size;
+    return dy_utf8_count(string_data(str), str->size);
+}
+
+int32_t DyString_CodepointAt(DyObject *self, size_t index)
+{
+    if (DyErr_CheckArg("DyString_CodepointAt", 0, DY_STRING, self))
+        return_error(-1);
+
+    DyStringObject *str = (DyStringObject *)self;
+    const uint8_t *data = (const uint8_t *)string_data(str);
+    unsigned flags = string_check(str);
+
+    if (!(flags & DYSTRING_UTF8))
+    {
+        DyErr_Set(DY_ERRID_ENCODING_ERROR, "DyString_CodepointAt: invalid UTF-8");
+        return_error(-1);
+    }
+
+    size_t offset = flags & DYSTRING_ASCII ? index : dy_utf8_offset((const char *)data, str->size, index);
+    if (offset >= str->size)
+    {
+        DyErr_Format(DY_ERRID_INDEX_ERROR, "Codepoint index %zu out of range", index);
+        return_error(-1);
+    }
+
+    const uint8_t *s = data + offset;
+    switch (dy_utf8_sequence(s, data + str->size))
+    {
+    case 2:
+        return (s[0] & 0x1F) << 6 | (s[1] & 0x3F);
+    case 3:
+        return (s[0] & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+    case 4:
+        return (s[0] & 0x07) << 18 | (s[1] & 0x3F) << 12 | (s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+    default:
+        return s[0];
+    }
 }
 
 DyObject *string_repr(DyStringObject *self)
 {
-    char *x = dy_malloc(self->size + 3);
-    snprintf(x, self->size + 3, "\"%s\"", self->data);
-    DyObject *s = DyString_FromStringAndSize(x, self->size + 2);
-    dy_free(x);
-    return s;
+    DyStringObject *s = string_new_ex(self->size + 2);
+    if (!s)
+        return_null;
+    s->data[0] = '"';
+    memcpy(s->data + 1, string_data(self), self->size);
+    s->data[self->size + 1] = '"';
+    s->data[self->size + 2] = 0;
+    return (DyObject *)s;
 }
 
-// Repr ------------------------------------------------------------------------
-#include "buildstring.h"
+// Composition ----------------------------------------------------------------
+// The result size is known up front, so each of these allocates exactly once.
+// memcpy already uses the widest vector moves the CPU has for long inputs.
 
-dy_buildstring_t *string_bsrepr(dy_buildstring_t *bs, DyStringObject *self)
+DyObject *DyString_Concat(DyObject *a, DyObject *b)
 {
-    dy_buildstring_t *lbs = dy_buildstring_append(bs, "\"", 1);
-    if (!lbs)
+    if (DyErr_CheckArg("DyString_Concat", 0, DY_STRING, a)
+     || DyErr_CheckArg("DyString_Concat", 1, DY_STRING, b))
+        return_null;
+
+    DyStringObject *sa = (DyStringObject *)a, *sb = (DyStringObject *)b;
+
+    if (!sb->size)
+        return Dy_Retain(a);
+    if (!sa->size)
+        return Dy_Retain(b);
+
+    if ((size_t)sa->size + sb->size > UINT32_MAX)
     {
         DyErr_SetMemoryError();
         return_null;
     }
 
-    lbs = dy_buildstring_append2(lbs, (DyObject*)self);
+    DyStringObject *o = string_new_ex(sa->size + sb->size);
+    if (!o)
+        return_null;
+
+    memcpy(o->data, string_data(sa), sa->size);
+    memcpy(o->data + sa->size, string_data(sb), sb->size);
+    o->data[o->size] = 0;
+
+    if (sa->flags & sb->flags & DYSTRING_ASCII)
+        o->flags |= DYSTRING_ENCODING_FLAGS;
+
+    if (o->size <= STRING_EAGER_HASH_SIZE)
+        string_hash(o);
 
-    if (!lbs)
+    return (DyObject *)o;
+}
+
+#include "list_p.h"
+
+DyObject *DyString_Join(DyObject *sep, DyObject *list)
+{
+    if (DyErr_CheckArg("DyString_Join", 0, DY_STRING, sep)
+     || DyErr_CheckArg("DyString_Join", 1, DY_LIST, list))
         return_null;
 
-    lbs = dy_buildstring_append(lbs, "\"", 1);
-    if (!lbs)
+    DyStringObject *ssep = (DyStringObject *)sep;
+    DyListObject *l = (DyListObject *)list;
+
+    if (!l->size)
+        return DyString_FromStringAndSize("", 0);
+
+    size_t size = ssep->size * (l->size - 1);
+    for (size_t i = 0; i < l->size; ++i)
+    {
+        if (DyErr_CheckArg("DyString_Join", 1, DY_STRING, l->items[i]))
+            return_null;
+        size += ((DyStringObject *)l->items[i])->size;
+    }
+
+    if (l->size == 1)
+        return Dy_Retain(l->items[0]);
+
+    if (size > UINT32_MAX)
+    {
         DyErr_SetMemoryError();
-    return lbs;
+        return_null;
+    }
+
+    DyStringObject *o = string_new_ex(size);
+    if (!o)
+        return_null;
+
+    const char *sep_data = string_data(ssep);
+    char *out = o->data;
+    unsigned ascii = ssep->flags & DYSTRING_ASCII;
+    for (size_t i = 0; i < l->size; ++i)
+    {
+        if (i)
+        {
+            memcpy(out, sep_data, ssep->size);
+            out += ssep->size;
+        }
+
+        DyStringObject *item = (DyStringObject *)l->items[i];
+        memcpy(out, string_data(item), item->size);
+        out += item->size;
+        ascii &= item->flags;
+    }
+    *out = 0;
+
+    if (ascii)
+        o->flags |= DYSTRING_ENCODING_FLAGS;
+
+    if (size <= STRING_EAGER_HASH_SIZE)
+        string_hash(o);
+
+    return (DyObject *)o;
+}
+
+// Short results are formatted on the stack and copied, longer ones are
+// measured first and formatted into the string directly.
+#define STRING_FORMAT_STACK 256
+
+DyObject *DyString_FormatV(const char *fmt, va_list args)
+{
+    char buf[STRING_FORMAT_STACK];
+    va_list again;
+    va_copy(again, args);
+
+    int size = vsnprintf(buf, sizeof(buf), fmt, args);
+    if (size < 0)
+    {
+        va_end(again);
+        DyErr_Set(DY_ERRID_ARGUMENT_TYPE, "DyString_Format: invalid format string");
+        return_null;
+    }
+
+    if ((size_t)size < sizeof(buf))
+    {
+        va_end(again);
+        return (DyObject *)string_new(buf, size);
+    }
+
+    DyStringObject *o = string_new_ex(size);
+    if (o)
+        vsnprintf(o->data, size + 1, fmt, again);
+    va_end(again);
+
+    if (!o)
+        return_null;
+    return (DyObject *)o;
+}
+
+DyObject *DyString_Format(const char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    DyObject *result = DyString_FormatV(fmt, va);
+    va_end(va);
+    return result;
+}
+
+// Repr ------------------------------------------------------------------------
+#include "stringbuilder.h"
+
+bool string_sbrepr(DyStringBuilder *sb, DyStringObject *self)
+{
+    if (!DyStringBuilder_Reserve(sb, self->size + 2))
+        return_error(false);
+
+    DyStringBuilder_AppendChar(sb, '"');
+    DyStringBuilder_Append(sb, string_data(self), self->size);
+    DyStringBuilder_AppendChar(sb, '"');
+    return true;
 }
@@ -16,18 +16,35 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "freelist_p.h"
 #include "string_p.h"
 #include "host_p.h"
+#include "region_p.h"
 #include "dystring.h"
 #include "exceptions.h"
 
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 // ----------------------------------------------------------------------------
 // String Interning
-#define DY_INTERN_TABLE_SIZE 256
+//
+// The table is split into DY_INTERN_SHARDS independent shards, picked by the
+// string hash, each protected by its own spinlock. A shard is a chained hash
+// table: the head array grows when there are more strings than chains and
+// shrinks when it is less than an eighth full. Chain nodes come from blocks of
+// DY_INTERN_BLOCK_SIZE and are recycled through a per-shard free list.
+//
+// In front of the shards, every thread keeps a small direct-mapped cache of
+// strings it interned recently. The cache holds references, so a hit needs
+// neither a lock nor a look at another thread's data.
+#define DY_INTERN_SHARDS 64
+#define DY_INTERN_SHARD_BITS 6
+#define DY_INTERN_MIN_SIZE 64
 #define DY_INTERN_BLOCK_SIZE 64
+#define DY_INTERN_CACHE_SIZE 256
+// Chains this long suggest colliding keys
+#define DY_INTERN_FLOOD_CHAIN 32
 
 typedef struct si_bucket_t {
     struct _DyStringObject *item;
@@ -36,77 +53,338 @@ typedef struct si_bucket_t {
 
 typedef struct si_block_t {
     struct si_block_t *next;
-    struct freelist_t freelist; // The Buckets need to immediately follow the freelist. (see freelist_struct())
     struct si_bucket_t buckets[DY_INTERN_BLOCK_SIZE];
 } si_block_t;
 
-static struct {
+typedef struct si_shard_t {
+    // Also keeps shards on separate cache lines
+    _Alignas(64) atomic_flag lock;
+    // Chain heads; size is mask + 1, NULL until the first string is interned
+    struct si_bucket_t **table;
+    size_t mask;
+    size_t count;
+    // Buckets are chosen by Dy_hash_siphash13() instead of the string hash
+    bool keyed;
+    // Allocated blocks and the unused buckets in them
     struct si_block_t *blocks;
-    struct si_bucket_t table[DY_INTERN_TABLE_SIZE];
-} DyIntern;
+    struct si_bucket_t *free;
+    size_t nblocks;
+} si_shard_t;
 
-// Fast implementation for string objects
-DyObject *DyString_Interned(DyObject *o)
+static si_shard_t DyIntern[DY_INTERN_SHARDS];
+
+static _Thread_local DyStringObject *si_cache[DY_INTERN_CACHE_SIZE];
+
+// Flushes the cache of exiting threads
+static pthread_key_t si_cache_key;
+static pthread_once_t si_cache_key_once = PTHREAD_ONCE_INIT;
+static bool si_cache_key_valid;
+static _Thread_local bool si_cache_registered;
+
+// Shards ----------------------------------------------------------------------
+static inline si_shard_t *si_shard(DyHash hash)
 {
-    if (o->type != DY_STRING)
+    // Multiplicative, so 32 bit hashes spread over the shards as well
+    return &DyIntern[((uint64_t)hash * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - DY_INTERN_SHARD_BITS)];
+}
+
+static inline void si_lock(si_shard_t *shard)
+{
+    while (atomic_flag_test_and_set_explicit(&shard->lock, memory_order_acquire));
+}
+
+static inline void si_unlock(si_shard_t *shard)
+{
+    atomic_flag_clear_explicit(&shard->lock, memory_order_release);
+}
+
+// The bucket index of a string
+static inline size_t si_index(si_shard_t *shard, const char *data, size_t size, DyHash hash)
+{
+    if (shard->keyed)
+        hash = Dy_hash_siphash13(data, size);
+    return (size_t)hash & shard->mask;
+}
+
+// Redistribute the chains over a new head array. Nothing changes on failure,
+// the old table keeps working.
+static bool si_resize(si_shard_t *shard, size_t size, bool keyed)
+{
+    si_bucket_t **table = dy_malloc(sizeof(si_bucket_t *) * size);
+    if (!table)
+        return false;
+
+    memset(table, 0, sizeof(si_bucket_t *) * size);
+
+    si_bucket_t **old = shard->table;
+    size_t old_size = old ? shard->mask + 1 : 0;
+
+    shard->table = table;
+    shard->mask = size - 1;
+    shard->keyed = keyed;
+
+    for (size_t i = 0; i < old_size; ++i)
+        for (si_bucket_t *bucket = old[i], *next; bucket; bucket = next)
+        {
+            size_t index = si_index(shard, bucket->item->data, bucket->item->size, bucket->item->hash);
+            next = bucket->next;
+            bucket->next = table[index];
+            table[index] = bucket;
+        }
+
+    dy_free(old);
+    return true;
+}
+
+// Get an empty bucket
+static inline si_bucket_t *si_get_free_bucket(si_shard_t *shard)
+{
+    if (!shard->free)
     {
-        DyErr_SetArgumentTypeError("DyString_Interned", 0, "String", Dy_GetTypeName(o->type));
-        return NULL;
+        si_block_t *block = dy_malloc(sizeof(si_block_t));
+        if (!block)
+            return NULL;
+
+        block->next = shard->blocks;
+        shard->blocks = block;
+        ++shard->nblocks;
+
+        for (size_t i = 0; i < DY_INTERN_BLOCK_SIZE; ++i)
+        {
+            block->buckets[i].next = shard->free;
+            shard->free = &block->buckets[i];
+        }
     }
-    if (((DyStringObject *)o)->flags & DYSTRING_INTERNED)
-        return o;
 
-    DyStringObject *str = ((DyStringObject *)o);
-    DyHash hash = string_hash(str);
-    si_bucket_t *bucket = &DyIntern.table[hash % DY_INTERN_TABLE_SIZE];
+    si_bucket_t *bucket = shard->free;
+    shard->free = bucket->next;
+    return bucket;
+}
+
+inline static void si_free_bucket(si_shard_t *shard, si_bucket_t *bucket)
+{
+    bucket->item = NULL;
+    bucket->next = shard->free;
+    shard->free = bucket;
+}
+
+// Take a reference to a string, unless its last one is already gone and it
+// is about to be removed from the table
+static inline bool si_retain_live(DyStringObject *str)
+{
+    uint32_t refcnt = atomic_load_explicit(&str->refcnt, memory_order_relaxed);
+    do if (!refcnt)
+        return false;
+    while (!atomic_compare_exchange_weak_explicit(&str->refcnt, &refcnt, refcnt + 1,
+                                                  memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
 
-    if (!bucket->item)
+// Find a live string in a locked shard and take a reference to it.
+// Sets *length to the number of buckets visited.
+static DyStringObject *si_find(si_shard_t *shard, const char *data, size_t size, DyHash hash, size_t *length)
+{
+    *length = 0;
+    if (!shard->table)
         return NULL;
 
-    // Find in chain
-    do if (str->size == bucket->item->size
-           && hash == bucket->item->hash
-           && !memcmp(str->data, bucket->item->data, str->size))
-        return (DyObject*)bucket->item;
-    while ((bucket = bucket->next));
+    for (si_bucket_t *bucket = shard->table[si_index(shard, data, size, hash)]; bucket; bucket = bucket->next)
+    {
+        ++*length;
+        if (hash == bucket->item->hash
+         && size == bucket->item->size
+         && !memcmp(data, bucket->item->data, size)
+         && si_retain_live(bucket->item))
+            return bucket->item;
+    }
 
     return NULL;
 }
 
-// Fast implementation for c strings (NTBS)
-DyObject *DyString_InternedString(const char *s)
+// Add a string known not to be in the locked shard yet.
+// length is the chain length si_find() reported for it.
+static bool si_insert(si_shard_t *shard, DyStringObject *str, size_t length)
 {
-    size_t size = strlen(s);
-    DyHash hash = DyHost.string_hash_fn(s, size);
-    si_bucket_t *bucket = &DyIntern.table[hash % DY_INTERN_TABLE_SIZE];
+    if (!shard->table && !si_resize(shard, DY_INTERN_MIN_SIZE, false))
+        return false;
 
-    if (!bucket->item)
-        return NULL;
+    si_bucket_t *bucket = si_get_free_bucket(shard);
+    if (!bucket)
+        return false;
 
-    // Find in chain
-    do if (size == bucket->item->size
-           && hash == bucket->item->hash
-           && !memcmp(s, bucket->item->data, size))
-        return (DyObject*)bucket->item;
-    while ((bucket = bucket->next));
+    size_t index = si_index(shard, str->data, str->size, str->hash);
+    bucket->item = str;
+    bucket->next = shard->table[index];
+    shard->table[index] = bucket;
+    string_add_flags(str, DYSTRING_INTERNED);
+    ++shard->count;
+
+    // Growing is optional, the table works at any load
+    if (!shard->keyed && length >= DY_INTERN_FLOOD_CHAIN)
+        si_resize(shard, shard->mask + 1, true);
+    else if (shard->count > shard->mask + 1)
+        si_resize(shard, (shard->mask + 1) * 2, shard->keyed);
+
+    return true;
+}
 
+// Thread cache ----------------------------------------------------------------
+static inline DyStringObject **si_cache_slot(DyHash hash)
+{
+    return &si_cache[((uint64_t)hash >> DY_INTERN_SHARD_BITS) & (DY_INTERN_CACHE_SIZE - 1)];
+}
+
+static inline DyStringObject *si_cache_get(const char *data, size_t size, DyHash hash)
+{
+    DyStringObject *str = *si_cache_slot(hash);
+    if (str && str->hash == hash && str->size == size && !memcmp(str->data, data, size))
+        return str;
     return NULL;
 }
 
-// Get an empty bucket
-static inline si_bucket_t *si_get_free_bucket()
+static void si_cache_exit(void *cache)
 {
-    for (si_block_t *block = DyIntern.blocks; block; block = block->next)
-        if (!freelist_empty2(block))
-    		return freelist_pop2(block);
+    (void)cache;
+    DyString_InternFlushCache();
+}
 
-    si_block_t *block = dy_malloc(sizeof(si_block_t));
-    freelist_init(&block->freelist, sizeof(si_bucket_t), DY_INTERN_BLOCK_SIZE);
+static void si_cache_key_create(void)
+{
+    si_cache_key_valid = !pthread_key_create(&si_cache_key, si_cache_exit);
+}
 
-    block->next = DyIntern.blocks;
-    DyIntern.blocks = block;
+// Make sure the cache is flushed when the thread exits. The value only needs
+// to be non-NULL for the destructor to run. Without a key, the cache has to
+// be flushed by hand.
+static void si_cache_register(void)
+{
+    pthread_once(&si_cache_key_once, si_cache_key_create);
+    if (si_cache_key_valid)
+        pthread_setspecific(si_cache_key, si_cache);
+    si_cache_registered = true;
+}
+
+// Remember a string, handing over a reference to it
+static inline void si_cache_put(DyStringObject *str)
+{
+    if (!si_cache_registered)
+        si_cache_register();
+
+    DyStringObject **slot = si_cache_slot(str->hash);
+    DyStringObject *old = *slot;
+    *slot = str;
+    if (old)
+        Dy_Release((DyObject*)old);
+}
 
-    return freelist_pop2(block);
+void DyString_InternFlushCache(void)
+{
+    for (size_t i = 0; i < DY_INTERN_CACHE_SIZE; ++i)
+        if (si_cache[i])
+        {
+            DyStringObject *str = si_cache[i];
+            si_cache[i] = NULL;
+            Dy_Release((DyObject*)str);
+        }
+}
+
+// Lookup ----------------------------------------------------------------------
+// Look up a string, returning a new reference.
+// If str is given and not interned yet, it is interned.
+static DyStringObject *si_lookup(const char *data, size_t size, DyHash hash, DyStringObject *str)
+{
+    DyStringObject *found = si_cache_get(data, size, hash);
+    if (found)
+        return (DyStringObject *)Dy_Retain((DyObject*)found);
+
+    si_shard_t *shard = si_shard(hash);
+    size_t length;
+    bool failed = false;
+
+    si_lock(shard);
+    found = si_find(shard, data, size, hash, &length);
+    if (!found && str)
+    {
+        if (si_insert(shard, str, length))
+            found = (DyStringObject *)Dy_Retain((DyObject*)str);
+        else
+            failed = true;
+    }
+    si_unlock(shard);
+
+    if (failed)
+    {
+        DyErr_SetMemoryError();
+        return_null;
+    }
+
+    // One reference for the cache, one for the caller
+    if (found)
+        si_cache_put((DyStringObject *)Dy_Retain((DyObject*)found));
+
+    return found;
+}
+
+// Create a string to be interned. The table outlives any region.
+static DyStringObject *si_new_string(const char *s, size_t size, DyHash hash)
+{
+    DyRegion *region = region_suspend();
+    DyStringObject *str = string_new_prehashed(s, size, hash);
+    region_resume(region);
+    return str;
+}
+
+// Intern a string object, returning a new reference to the interned instance.
+// Views are never interned themselves, they'd pin the buffer they refer to.
+// Neither are strings in a region, which goes away before the table.
+static DyStringObject *si_intern(DyStringObject *str)
+{
+    const char *data = string_data(str);
+    DyHash hash = string_hash(str);
+
+    if (!(str->flags & DYSTRING_VIEW) && !region_owns((DyObject *)str))
+        return si_lookup(data, str->size, hash, str);
+
+    DyStringObject *found = si_lookup(data, str->size, hash, NULL);
+    if (found)
+        return found;
+
+    DyStringObject *copy = si_new_string(data, str->size, hash);
+    if (!copy)
+        return_null;
+
+    found = si_lookup(data, str->size, hash, copy);
+    Dy_Release((DyObject*)copy);
+    return found;
+}
+
+// Fast implementation for string objects
+DyObject *DyString_Interned(DyObject *o)
+{
+    if (o->type != DY_STRING)
+    {
+        DyErr_SetArgumentTypeError("DyString_Interned", 0, "String", Dy_GetTypeName(o->type));
+        return NULL;
+    }
+    if (string_flags((DyStringObject *)o) & DYSTRING_INTERNED)
+        return o;
+
+    // The thread cache keeps it alive
+    DyStringObject *str = ((DyStringObject *)o);
+    DyStringObject *found = si_lookup(string_data(str), str->size, string_hash(str), NULL);
+    if (found)
+        Dy_Release((DyObject*)found);
+    return (DyObject*)found;
+}
+
+// Fast implementation for c strings (NTBS)
+DyObject *DyString_InternedString(const char *s)
+{
+    size_t size = strlen(s);
+    DyStringObject *found = si_lookup(s, size, DyHost.string_hash_fn(s, size), NULL);
+    if (found)
+        Dy_Release((DyObject*)found);
+    return (DyObject*)found;
 }
 
 // Intern an existing string
@@ -117,133 +395,132 @@ DyObject *DyString_Intern(DyObject *o)
         DyErr_SetArgumentTypeError("DyString_Intern", 0, "String", Dy_GetTypeName(o->type));
         return NULL;
     }
-    if (((DyStringObject *)o)->flags & DYSTRING_INTERNED)
+    if (string_flags((DyStringObject *)o) & DYSTRING_INTERNED)
         return o;
 
     DyStringObject *str = ((DyStringObject *)o);
-    DyHash hash = string_hash(str);
-    si_bucket_t *bucket = &DyIntern.table[hash % DY_INTERN_TABLE_SIZE];
-    si_bucket_t *tbucket = bucket;
+    DyStringObject *interned = si_intern(str);
+    if (!interned)
+        return_null;
 
-    if (!bucket->item)
+    Dy_Release((DyObject*)interned);
+    return (DyObject*)interned;
+}
+
+bool DyString_InternInplace(DyObject **strp)
+{
+    DyObject *o = *strp;
+    if (o->type != DY_STRING)
     {
-        // Insert into table
-        bucket->item = str;
-        str->flags |= DYSTRING_INTERNED;
-        return o;
+        DyErr_SetArgumentTypeError("DyString_InternInplace", 0, "String", Dy_GetTypeName(o->type));
+        return_error(false);
     }
+    if (string_flags((DyStringObject *)o) & DYSTRING_INTERNED)
+        return true;
 
-    // Find in chain
-    do if (str->size == bucket->item->size
-           && hash == bucket->item->hash
-           && !memcmp(str->data, bucket->item->data, str->size))
-        return (DyObject*)bucket->item;
-    while ((bucket = bucket->next));
+    DyStringObject *str = ((DyStringObject *)o);
+    DyStringObject *interned = si_intern(str);
+    if (!interned)
+        return_error(false);
 
-    // Insert in chain
-    bucket = si_get_free_bucket();
-    bucket->item = str;
-    
-    bucket->next = tbucket->next; // XXX inverse
-    tbucket->next = bucket;
-    
-    str->flags |= DYSTRING_INTERNED;
-    
-    return o;
+    Dy_Release(o);
+    *strp = (DyObject*)interned;
+    return true;
 }
 
-void DyString_InternInplace(DyObject **strp);
-
 // Create new intern string
 DyObject *DyString_InternStringFromStringAndSize(const char *s, size_t size)
 {
     DyHash hash = DyHost.string_hash_fn(s, size);
-    si_bucket_t *bucket = &DyIntern.table[hash % DY_INTERN_TABLE_SIZE];
-    si_bucket_t *tbucket = bucket;
+    DyStringObject *str = si_cache_get(s, size, hash);
+    if (str)
+        return Dy_Retain((DyObject*)str);
+
+    // Allocate outside of the lock; usually it's found anyway
+    si_shard_t *shard = si_shard(hash);
+    size_t length;
 
-    if (!bucket->item)
+    si_lock(shard);
+    str = si_find(shard, s, size, hash, &length);
+    si_unlock(shard);
+
+    if (!str)
     {
-        // Insert into table
-        DyStringObject *str = string_new(s, size);
-        str->hash = hash;
-        bucket->item = str;
-        str->flags |= DYSTRING_INTERNED;
-        return (DyObject*)str;
+        DyStringObject *created = si_new_string(s, size, hash);
+        if (!created)
+            return_null;
+
+        str = si_lookup(s, size, hash, created);
+        Dy_Release((DyObject*)created);
+        if (!str)
+            return_null;
     }
-
-    // Find in chain
-    do if (size == bucket->item->size
-           && hash == bucket->item->hash
-           && !memcmp(s, bucket->item->data, size))
-        return Dy_Retain((DyObject*)bucket->item);
-    while ((bucket = bucket->next));
-
-    // Insert in chain
-    DyStringObject *str = string_new(s, size);
-    str->hash = hash;
-    str->flags |= DYSTRING_INTERNED;
-    
-    bucket = si_get_free_bucket();
-    bucket->item = str;
-    
-    bucket->next = tbucket->next; // XXX inverse
-    tbucket->next = bucket;
+    else
+        si_cache_put((DyStringObject *)Dy_Retain((DyObject*)str));
 
     return (DyObject*)str;
 }
 
 DyObject *DyString_InternStringFromString(const char *cstr);
 
-inline static void si_free_bucket(si_bucket_t *bucket)
+void string_unintern(DyStringObject *str)
 {
-    // Find block the bucket belongs to
-    for (si_block_t *block = DyIntern.blocks; block; block = block->next)
-    	// Check if it lies in the memory region
-    	if (block->buckets <= bucket && bucket < (block->buckets + DY_INTERN_BLOCK_SIZE))
-    	{
-    		// Free the memory
-    		freelist_push2(block, bucket);
-    		break;
-    	}
+    si_shard_t *shard = si_shard(str->hash);
+
+    si_lock(shard);
+
+    // Strings are unique in the table, so look for this very object
+    si_bucket_t **link = &shard->table[si_index(shard, str->data, str->size, str->hash)];
+
+    for (; *link; link = &(*link)->next)
+        if ((*link)->item == str)
+        {
+            si_bucket_t *bucket = *link;
+            *link = bucket->next;
+            si_free_bucket(shard, bucket);
+            --shard->count;
+            break;
+        }
+
+    string_clear_flags(str, DYSTRING_INTERNED);
+
+    // Shrinking is optional as well
+    if (shard->mask + 1 > DY_INTERN_MIN_SIZE && shard->count < (shard->mask + 1) / 8)
+        si_resize(shard, (shard->mask + 1) / 2, shard->keyed);
+
+    si_unlock(shard);
 }
 
-void string_unintern(DyStringObject *o) // See also dict.c:find_and_remove_bucket()
+void DyString_GetInternStats(DyString_InternStats *stats)
 {
-    DyStringObject *str = ((DyStringObject *)o);
-    DyHash hash = string_hash(str);
-    si_bucket_t *bucket = &DyIntern.table[hash % DY_INTERN_TABLE_SIZE];
-    si_bucket_t *tbucket = bucket;
-    si_bucket_t *prev;
+    memset(stats, 0, sizeof(*stats));
 
-    // Find in chain
-    //do if (str == bucket->item)
-    do if (DyString_Equals(str, bucket->item))
+    for (size_t s = 0; s < DY_INTERN_SHARDS; ++s)
     {
-    	// If it's in the table, we can't free it
-        if (bucket == tbucket)
-    	{
-    		// We might need to pull in the next one
-            if (tbucket->next)
-    		{
-    			bucket = tbucket->next;
-    			memcpy(tbucket, bucket, sizeof(si_bucket_t)); 	// Copy the bucket into the table
-    			si_free_bucket(bucket);						// Free the now obsolete bucket
-    		}
-    		// Otherwise, we can simply invalidate it.
-    		else
-    			tbucket->item = NULL;
-    	}
-        else
+        si_shard_t *shard = &DyIntern[s];
+        si_lock(shard);
+
+        stats->count += shard->count;
+        stats->keyed |= shard->keyed;
+        stats->capacity += shard->nblocks * DY_INTERN_BLOCK_SIZE;
+
+        if (shard->table)
         {
-    		// Pull bucket out
-            prev->next = bucket->next;
-    		
-    		// Free the bucket
-    		si_free_bucket(bucket);
+            stats->buckets += shard->mask + 1;
+
+            for (size_t i = 0; i <= shard->mask; ++i)
+            {
+                size_t length = 0;
+                for (si_bucket_t *bucket = shard->table[i]; bucket; bucket = bucket->next)
+                    ++length;
+
+                if (length)
+                    ++stats->used;
+                if (length > stats->longest)
+                    stats->longest = length;
+            }
         }
-    	
-    	// We're done
-    	break;
+
+        si_unlock(shard);
     }
-    while ((bucket = (prev = bucket)->next));
 }
@@ -20,28 +20,93 @@
 #pragma once
 #include "dy_p.h"
 
-// Flags
+#include <stddef.h>
+
+// Flags (in the object header)
 #define DYSTRING_INTERNED 1
 #define DYSTRING_HASH 2
+// The string is a DyStringViewObject
+#define DYSTRING_VIEW 4
+// The characters of a view are followed by a NUL byte
+#define DYSTRING_TERMINATED 8
+// The encoding was checked, DYSTRING_UTF8 and DYSTRING_ASCII are valid
+#define DYSTRING_CHECKED 16
+#define DYSTRING_UTF8 32
+#define DYSTRING_ASCII 64
+
+#define DYSTRING_ENCODING_FLAGS (DYSTRING_CHECKED | DYSTRING_UTF8 | DYSTRING_ASCII)
 
-// Data structure
+// Data structure. The characters follow the 20 byte header directly, so
+// strings of up to 11 bytes (plus the terminating NUL) fit a 32 byte allocation.
+// There's no room left for a codepoint count, only the flags know about ASCII.
 typedef struct _DyStringObject {
     DyObject_HEAD;
-    uint32_t size;
-    uint8_t flags;
     DyHash hash;
-    char data[1];
+    uint32_t size;
+    char data[];
 } DyStringObject;
 
+#define DYSTRING_ALLOC_SIZE(size) (offsetof(DyStringObject, data) + (size) + 1)
+
+// A string referring to characters owned by another object.
+// The owner is an owned string or a userdata wrapping an external buffer;
+// slicing a view refers to the same owner, so views never chain.
+typedef struct _DyStringViewObject {
+    DyObject_HEAD;
+    DyHash hash;
+    uint32_t size;
+    const char *ptr;
+    DyObject *owner;
+    // NUL-terminated copy, made on demand by DyString_AsString
+    _Atomic(char *) cstr;
+} DyStringViewObject;
+
+// Strings up to this size are hashed right away, while they're still in cache
+#define STRING_EAGER_HASH_SIZE 64
+
+// Slices shorter than this are copied; a view isn't smaller than that
+#define DYSTRING_VIEW_MIN 32
+
+// Strings are shared between threads, so flags found out about later are
+// added atomically; another thread may be setting DYSTRING_INTERNED.
+static inline void string_add_flags(DyStringObject *o, uint8_t flags)
+{
+    __atomic_fetch_or(&o->flags, flags, __ATOMIC_RELEASE);
+}
+
+static inline void string_clear_flags(DyStringObject *o, uint8_t flags)
+{
+    __atomic_fetch_and(&o->flags, (uint8_t)~flags, __ATOMIC_RELEASE);
+}
+
+static inline uint8_t string_flags(DyStringObject *o)
+{
+    return object_flags((DyObject *)o);
+}
+
+static inline const char *string_data(DyStringObject *o)
+{
+    if (string_flags(o) & DYSTRING_VIEW)
+        return ((DyStringViewObject *)o)->ptr;
+    return o->data;
+}
+
 // Prototypes
 bool DyString_Equals(DyStringObject *, DyStringObject *);
 
 DyStringObject *string_new(const char *s, size_t size);
 DyStringObject *string_new_ex(size_t size);
+/// Create a string whose hash is already known
+DyStringObject *string_new_prehashed(const char *s, size_t size, DyHash hash);
+/// Refer to size characters at data, which lie within the string source.
+/// Short strings are copied instead.
+DyStringObject *string_view(DyStringObject *source, const char *data, size_t size);
 
 void string_unintern(DyStringObject *);
 void string_destroy(DyStringObject *self);
 
 DyHash string_hash(DyStringObject *self);
+/// Check the encoding if it isn't known yet, returning the string's flags
+unsigned string_check(DyStringObject *self);
 
-struct dy_buildstring_t *string_bsrepr(struct dy_buildstring_t *bs, DyStringObject *self);
+bool string_sbrepr(struct DyStringBuilder *sb, DyStringObject *self);
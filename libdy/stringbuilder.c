@@ -0,0 +1,248 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stringbuilder.h"
+#include "string_p.h"
+#include "dy_p.h"
+#include "host_p.h"
+#include "region_p.h"
+#include "exceptions.h"
+#include "dystring.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+
+// The first allocation; the string header takes part of it
+#define SB_MIN_ALLOC 64
+
+// Unused capacity worth giving back when finishing
+#define SB_MAX_SLACK 32
+
+#define sb_string(sb) ((DyStringObject *)(sb)->str)
+
+
+void DyStringBuilder_Init(DyStringBuilder *sb)
+{
+    sb->str = NULL;
+    sb->size = 0;
+    sb->capacity = 0;
+}
+
+bool DyStringBuilder_Reserve(DyStringBuilder *sb, size_t more)
+{
+    if (sb->capacity - sb->size >= more)
+        return true;
+
+    if (more > UINT32_MAX - sb->size)
+    {
+        DyErr_SetMemoryError();
+        return_error(false);
+    }
+
+    size_t alloc = sb->str ? 2 * DYSTRING_ALLOC_SIZE(sb->capacity) : SB_MIN_ALLOC;
+    if (alloc < DYSTRING_ALLOC_SIZE(sb->size + more))
+        alloc = DYSTRING_ALLOC_SIZE(sb->size + more);
+
+    size_t capacity = alloc - DYSTRING_ALLOC_SIZE(0);
+    if (capacity > UINT32_MAX)
+        capacity = UINT32_MAX;
+
+    DyStringObject *str = sb->str
+        ? object_realloc(sb->str, sb->str, DYSTRING_ALLOC_SIZE(sb->capacity), DYSTRING_ALLOC_SIZE(capacity))
+        : object_malloc(DYSTRING_ALLOC_SIZE(capacity));
+    if (!str)
+    {
+        if (!sb->str)
+            DyErr_SetMemoryError();
+        return_error(false);
+    }
+
+    if (!sb->str)
+        object_init((DyObject*)str, DY_STRING);
+
+    sb->str = (DyObject*)str;
+    sb->capacity = capacity;
+    return true;
+}
+
+bool DyStringBuilder_Append(DyStringBuilder *sb, const char *data, size_t size)
+{
+    if (!DyStringBuilder_Reserve(sb, size))
+        return_error(false);
+
+    memcpy(sb_string(sb)->data + sb->size, data, size);
+    sb->size += size;
+    return true;
+}
+
+bool DyStringBuilder_AppendChar(DyStringBuilder *sb, char c)
+{
+    if (!DyStringBuilder_Reserve(sb, 1))
+        return_error(false);
+
+    sb_string(sb)->data[sb->size++] = c;
+    return true;
+}
+
+bool DyStringBuilder_AppendString(DyStringBuilder *sb, DyObject *str)
+{
+    if (DyErr_CheckArg("DyStringBuilder_AppendString", 1, DY_STRING, str))
+        return_error(false);
+
+    DyStringObject *so = (DyStringObject *)str;
+    return DyStringBuilder_Append(sb, string_data(so), so->size);
+}
+
+// Two digits at a time
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+bool DyStringBuilder_AppendLong(DyStringBuilder *sb, int64_t value)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+
+    uint64_t u = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+    while (u >= 100)
+    {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * (u % 100), 2);
+        u /= 100;
+    }
+
+    if (u >= 10)
+    {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * u, 2);
+    }
+    else
+        *--p = '0' + u;
+
+    if (value < 0)
+        *--p = '-';
+
+    return DyStringBuilder_Append(sb, p, buf + sizeof(buf) - p);
+}
+
+// Format into the buffer directly, growing it if the guess was too small
+static bool sb_vprintf(DyStringBuilder *sb, size_t guess, const char *fmt, va_list va)
+{
+    if (!DyStringBuilder_Reserve(sb, guess))
+        return_error(false);
+
+    va_list again;
+    va_copy(again, va);
+
+    // There's always room for the terminating NUL
+    size_t space = sb->capacity - sb->size + 1;
+    int size = vsnprintf(sb_string(sb)->data + sb->size, space, fmt, va);
+
+    if (size >= 0 && (size_t)size >= space)
+    {
+        if (!DyStringBuilder_Reserve(sb, size))
+        {
+            va_end(again);
+            return_error(false);
+        }
+        vsnprintf(sb_string(sb)->data + sb->size, size + 1, fmt, again);
+    }
+    va_end(again);
+
+    if (size < 0)
+    {
+        DyErr_Set(DY_ERRID_ARGUMENT_TYPE, "DyStringBuilder: invalid format string");
+        return_error(false);
+    }
+
+    sb->size += size;
+    return true;
+}
+
+static bool sb_printf(DyStringBuilder *sb, size_t guess, const char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    bool result = sb_vprintf(sb, guess, fmt, va);
+    va_end(va);
+    return result;
+}
+
+bool DyStringBuilder_AppendFloat(DyStringBuilder *sb, double value)
+{
+    return sb_printf(sb, 32, "%f", value);
+}
+
+bool DyStringBuilder_Printf(DyStringBuilder *sb, const char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    bool result = sb_vprintf(sb, strlen(fmt) + 32, fmt, va);
+    va_end(va);
+    return result;
+}
+
+bool DyStringBuilder_AppendRepr(DyStringBuilder *sb, DyObject *obj)
+{
+    return sbrepr(sb, obj);
+}
+
+DyObject *DyStringBuilder_Finish(DyStringBuilder *sb)
+{
+    DyStringObject *str = sb_string(sb);
+    if (!str)
+        return DyString_FromStringAndSize("", 0);
+
+    if (sb->capacity - sb->size > SB_MAX_SLACK)
+    {
+        DyStringObject *shrunk = object_realloc((DyObject*)str, str, DYSTRING_ALLOC_SIZE(sb->capacity),
+                                                DYSTRING_ALLOC_SIZE(sb->size));
+        if (shrunk)
+            str = shrunk;
+    }
+
+    str->size = sb->size;
+    str->data[sb->size] = 0;
+
+    if (sb->size <= STRING_EAGER_HASH_SIZE)
+    {
+        str->hash = DyHost.string_hash_fn(str->data, sb->size);
+        str->flags |= DYSTRING_HASH;
+    }
+
+    DyStringBuilder_Init(sb);
+    return (DyObject*)str;
+}
+
+void DyStringBuilder_Discard(DyStringBuilder *sb)
+{
+    if (sb->str)
+        object_free(sb->str, sb->str);
+    DyStringBuilder_Init(sb);
+}
@@ -0,0 +1,144 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file libdy/stringbuilder.h
+ * @brief Building strings in a contiguous buffer.
+ *
+ * The characters are written right into the string object that
+ * DyStringBuilder_Finish() returns, so they are never copied again.
+ * The buffer grows geometrically, appending is amortized O(1).
+ *
+ * A builder lives on the stack:
+ * @code
+ * DyStringBuilder sb;
+ * DyStringBuilder_Init(&sb);
+ * if (!DyStringBuilder_Append(&sb, "answer: ", 8)
+ *  || !DyStringBuilder_AppendLong(&sb, 42))
+ * {
+ *     DyStringBuilder_Discard(&sb);
+ *     return_null;
+ * }
+ * return DyStringBuilder_Finish(&sb);
+ * @endcode
+ *
+ * All functions returning bool set a MemoryError if they fail.
+ */
+
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief A string under construction
+ * @attention The members are private
+ */
+typedef struct DyStringBuilder {
+    DyObject *str;      ///< The string being built, NULL before anything was appended
+    size_t size;        ///< Characters written so far
+    size_t capacity;    ///< Characters that fit without growing
+} DyStringBuilder;
+
+
+/**
+ * @brief Initialize an empty string builder. This doesn't allocate.
+ * @param sb The string builder
+ */
+LIBDY_API void DyStringBuilder_Init(DyStringBuilder *sb);
+
+/**
+ * @brief Make room for more characters
+ * @param sb The string builder
+ * @param more The number of characters about to be appended
+ * @return false if the memory could not be allocated
+ */
+LIBDY_API bool DyStringBuilder_Reserve(DyStringBuilder *sb, size_t more);
+
+/**
+ * @brief Append a character array
+ * @param sb The string builder
+ * @param data The characters
+ * @param size The number of characters
+ */
+LIBDY_API bool DyStringBuilder_Append(DyStringBuilder *sb, const char *data, size_t size);
+
+/**
+ * @brief Append a single character
+ */
+LIBDY_API bool DyStringBuilder_AppendChar(DyStringBuilder *sb, char c);
+
+/**
+ * @brief Append a string object
+ * @param sb The string builder
+ * @param str The string object
+ * @return false if str is not a string or memory could not be allocated
+ */
+LIBDY_API bool DyStringBuilder_AppendString(DyStringBuilder *sb, DyObject *str);
+
+/**
+ * @brief Append the decimal representation of an integer
+ */
+LIBDY_API bool DyStringBuilder_AppendLong(DyStringBuilder *sb, int64_t value);
+
+/**
+ * @brief Append a floating point number, formatted like printf("%f")
+ */
+LIBDY_API bool DyStringBuilder_AppendFloat(DyStringBuilder *sb, double value);
+
+/**
+ * @brief Append the representation of an object
+ * @sa Dy_Repr
+ */
+LIBDY_API bool DyStringBuilder_AppendRepr(DyStringBuilder *sb, DyObject *obj);
+
+/**
+ * @brief Append printf-style formatted text
+ */
+LIBDY_API bool DyStringBuilder_Printf(DyStringBuilder *sb, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+/**
+ * @brief Turn the built characters into a string object
+ * @param sb The string builder. It is empty again afterwards.
+ * @return New reference to a string object
+ */
+LIBDY_API DyObject *DyStringBuilder_Finish(DyStringBuilder *sb);
+
+/**
+ * @brief Throw away the built characters
+ * @param sb The string builder. It is empty again afterwards.
+ */
+LIBDY_API void DyStringBuilder_Discard(DyStringBuilder *sb);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -45,6 +45,8 @@ typedef enum _DyObjectType
     DY_LIST,
     DY_USERDATA,
     DY_EXCEPTION,
+    DY_ARRAY,
+    DY_DEQUE,
 } DyObjectType;
 
 // ----------------------------------------------------------------------------
@@ -17,6 +17,7 @@
  */
 
 #include "userdata_p.h"
+#include "pool_p.h"
 #include "dy.h"
 #include "exceptions.h"
 
@@ -35,20 +36,32 @@ bool DyCallable_Check(DyObject *obj)
     return obj->type == DY_USERDATA && ((DyUserdataObject*)obj)->call_fn;
 }
 
+static DyUserdataObject *userdata_new(void *data, DyObject *(*call_fn)(), uint8_t flags)
+{
+    DyUserdataObject *co = (DyUserdataObject *)pool_new(DY_USERDATA, sizeof(DyUserdataObject));
+    if (!co)
+        return_null;
+
+    co->flags |= flags;
+    co->data = data;
+    co->name = NULL;
+    co->call_fn = call_fn;
+    co->destructor_fn = NULL;
+    return co;
+}
+
 // Simple
 DyObject *DyUser_Create(void *data)
 {
-    DyUserdataObject *co = NEW(DyUserdataObject);
-    Dy_InitObject((DyObject *)co, DY_USERDATA);
-    co->data = data;
-    return (DyObject *)co;
+    return (DyObject *)userdata_new(data, NULL, CBA_0);
 }
 
 DyObject *DyUser_CreateNamed(void *data, const char *name)
 {
-    DyUserdataObject *co = NEW(DyUserdataObject);
-    Dy_InitObject((DyObject *)co, DY_USERDATA);
-    co->data = data;
+    DyUserdataObject *co = userdata_new(data, NULL, CBA_0);
+    if (!co)
+        return_null;
+
     co->name = name;
     return (DyObject *)co;
 }
@@ -81,35 +94,17 @@ bool DyUser_SetDestructor(DyObject *ud, DyDataDestructor fn)
 // Create
 DyObject *DyUser_CreateCallable(DyUser_Callback fn, void *data)
 {
-    DyUserdataObject *co = NEW(DyUserdataObject);
-    Dy_InitObject((DyObject*)co, DY_USERDATA);
-    co->flags = CBA_LIST;
-    co->call_fn = fn;
-    co->data = data;
-    co->name = NULL;
-    return (DyObject*)co;
+    return (DyObject*)userdata_new(data, fn, CBA_LIST);
 }
 
 DyObject *DyUser_CreateCallable0(DyUser_Callback0 fn, void *data)
 {
-    DyUserdataObject *co = NEW(DyUserdataObject);
-    Dy_InitObject((DyObject*)co, DY_USERDATA);
-    co->flags = CBA_0;
-    co->call_fn = fn;
-    co->data = data;
-    co->name = NULL;
-    return (DyObject*)co;
+    return (DyObject*)userdata_new(data, fn, CBA_0);
 }
 
 DyObject *DyUser_CreateCallable1(DyUser_Callback1 fn, void *data)
 {
-    DyUserdataObject *co = NEW(DyUserdataObject);
-    Dy_InitObject((DyObject*)co, DY_USERDATA);
-    co->flags = CBA_1;
-    co->call_fn = fn;
-    co->data = data;
-    co->name = NULL;
-    return (DyObject*)co;
+    return (DyObject*)userdata_new(data, fn, CBA_1);
 }
 
 static DyObject *_strip_args(DyObject *self, void *data)
@@ -120,13 +115,7 @@ static DyObject *_strip_args(DyObject *self, void *data)
 
 DyObject *DyUser_CreateCallback(void(*fn)())
 {
-    DyUserdataObject *co = NEW(DyUserdataObject);
-    Dy_InitObject((DyObject*)co, DY_USERDATA);
-    co->flags = CBA_0;
-    co->call_fn = _strip_args;
-    co->data = fn;
-    co->name = NULL;
-    return (DyObject*)co;
+    return (DyObject*)userdata_new(fn, _strip_args, CBA_0);
 }
 
 // Call
@@ -30,7 +30,6 @@
 // Userdata can be callable
 typedef struct _DyUserdataObject {
     DyObject_HEAD
-    uint8_t flags;          // "type" is already in use in the base DyObject!
     void *data;
     const char *name;
     // Functions
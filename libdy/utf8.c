@@ -0,0 +1,104 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utf8_p.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Most text is ASCII, so whole blocks are checked for set high bits first.
+// Only the bytes around non-ASCII characters are looked at one by one.
+
+const uint8_t *dy_ascii_skip(const uint8_t *s, const uint8_t *end)
+{
+#ifdef __SSE2__
+    while (end - s >= 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)s));
+        if (mask)
+            return s + __builtin_ctz(mask);
+        s += 16;
+    }
+#else
+    while (end - s >= 8)
+    {
+        uint64_t block;
+        memcpy(&block, s, 8);
+        if (block & 0x8080808080808080ull)
+            break;
+        s += 8;
+    }
+#endif
+
+    while (s < end && *s < 0x80)
+        ++s;
+    return s;
+}
+
+unsigned dy_utf8_check(const char *data, size_t size)
+{
+    const uint8_t *s = (const uint8_t *)data, *end = s + size;
+    unsigned result = DY_UTF8_VALID | DY_UTF8_ASCII;
+
+    while ((s = dy_ascii_skip(s, end)) < end)
+    {
+        size_t n = dy_utf8_sequence(s, end);
+        if (!n)
+            return 0;
+
+        result = DY_UTF8_VALID;
+        s += n;
+    }
+
+    return result;
+}
+
+// Every byte but continuation bytes (10xxxxxx) starts a codepoint
+size_t dy_utf8_count(const char *data, size_t size)
+{
+    const uint8_t *s = (const uint8_t *)data, *end = s + size;
+    size_t count = 0;
+
+#ifdef __SSE2__
+    // Continuation bytes are -128..-65 as signed chars
+    const __m128i limit = _mm_set1_epi8(-65);
+    while (end - s >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, limit)));
+        s += 16;
+    }
+#endif
+
+    for (; s < end; ++s)
+        count += (*s & 0xC0) != 0x80;
+    return count;
+}
+
+size_t dy_utf8_offset(const char *data, size_t size, size_t index)
+{
+    const uint8_t *s = (const uint8_t *)data, *end = s + size;
+
+    for (; s < end; ++s)
+        if ((*s & 0xC0) != 0x80 && !index--)
+            return s - (const uint8_t *)data;
+    return size;
+}
@@ -0,0 +1,76 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// UTF-8 validation
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Results of dy_utf8_check
+#define DY_UTF8_VALID 1
+#define DY_UTF8_ASCII 2
+
+/**
+ * Length of the UTF-8 sequence starting with a non-ASCII byte at s, or 0 if
+ * it isn't valid (overlong, a surrogate, above U+10FFFF or truncated).
+ * The bytes are checked in order, so for NUL-terminated data end may lie
+ * beyond the terminator.
+ */
+static inline size_t dy_utf8_sequence(const uint8_t *s, const uint8_t *end)
+{
+    uint8_t c = s[0];
+
+    if (c < 0xC2)
+        return 0;
+
+    else if (c < 0xE0)
+        return end - s >= 2 && (s[1] & 0xC0) == 0x80 ? 2 : 0;
+
+    else if (c < 0xF0)
+    {
+        if (end - s < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80)
+            return 0;
+        if ((c == 0xE0 && s[1] < 0xA0) || (c == 0xED && s[1] > 0x9F))
+            return 0;
+        return 3;
+    }
+
+    else if (c < 0xF5)
+    {
+        if (end - s < 4 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80)
+            return 0;
+        if ((c == 0xF0 && s[1] < 0x90) || (c == 0xF4 && s[1] > 0x8F))
+            return 0;
+        return 4;
+    }
+
+    return 0;
+}
+
+/// Skip the ASCII prefix of size bytes at s, returning the first other byte or end
+const uint8_t *dy_ascii_skip(const uint8_t *s, const uint8_t *end);
+
+/// Check size bytes at data, returning DY_UTF8_* flags
+unsigned dy_utf8_check(const char *data, size_t size);
+
+/// Count the codepoints in valid UTF-8 data
+size_t dy_utf8_count(const char *data, size_t size);
+
+/// Find the byte offset of a codepoint in valid UTF-8 data, or size if it's past the end
+size_t dy_utf8_offset(const char *data, size_t size, size_t index);
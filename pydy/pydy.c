@@ -708,8 +708,19 @@ static DyObject *py2dy(PyObject *o)
 
 static PyObject *dystr2pyunicode(DyObject *str)
 {
-    size_t size = Dy_Length(str);
-    return PyUnicode_FromStringAndSize(DyString_AsString(str), size);
+    size_t size;
+    const char *data = DyString_AsStringAndSize(str, &size);
+
+    // ASCII strings can be copied into a compact str as they are
+    if (DyString_IsASCII(str))
+    {
+        PyObject *uni = PyUnicode_New(size, 127);
+        if (uni)
+            memcpy(PyUnicode_DATA(uni), data, size);
+        return uni;
+    }
+
+    return PyUnicode_FromStringAndSize(data, size);
 }
 
 static PyObject *dylong2pylong(DyObject *lng)
@@ -0,0 +1,276 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * String hash benchmark
+ *
+ * Compares the predefined hash functions on a few key corpora:
+ *  - throughput (ns per key, MB/s)
+ *  - distribution over a power-of-two table (chi-square relative to the
+ *    ideal, longest bucket, colliding full hashes)
+ *
+ * Usage: bench_hash [keyfile]
+ * A keyfile contains one key per line and is benchmarked as its own corpus.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <libdy/runtime.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef struct {
+    const char *name;
+    Dy_string_hash_fn fn;
+} hash_t;
+
+static const hash_t hashes[] = {
+    {"fnv1", Dy_hash_fnv1},
+    {"murmur3_32", Dy_hash_Murmur3_32},
+    {"wyhash", Dy_hash_wyhash},
+};
+
+#define NHASHES (sizeof(hashes) / sizeof(hashes[0]))
+
+typedef struct {
+    const char *name;
+    char **keys;
+    size_t *sizes;
+    size_t count;
+    size_t bytes;
+} corpus_t;
+
+
+static void corpus_add(corpus_t *c, const char *key, size_t size)
+{
+    if (!(c->count & (c->count - 1)))
+    {
+        size_t cap = c->count ? c->count * 2 : 64;
+        c->keys = realloc(c->keys, cap * sizeof(char *));
+        c->sizes = realloc(c->sizes, cap * sizeof(size_t));
+    }
+
+    char *copy = malloc(size + 1);
+    memcpy(copy, key, size);
+    copy[size] = 0;
+
+    c->keys[c->count] = copy;
+    c->sizes[c->count] = size;
+    c->bytes += size;
+    ++c->count;
+}
+
+static void corpus_free(corpus_t *c)
+{
+    for (size_t i = 0; i < c->count; ++i)
+        free(c->keys[i]);
+    free(c->keys);
+    free(c->sizes);
+}
+
+// Sequential keys, the worst case for weak hashes
+static void corpus_sequential(corpus_t *c, size_t n)
+{
+    char buf[32];
+    c->name = "key-%d";
+    for (size_t i = 0; i < n; ++i)
+        corpus_add(c, buf, snprintf(buf, sizeof(buf), "key-%zu", i));
+}
+
+// Short identifiers as found in JSON objects
+static void corpus_fields(corpus_t *c, size_t n)
+{
+    static const char *words[] = {
+        "id", "name", "type", "value", "user", "created", "updated", "url",
+        "title", "count", "items", "data", "parent", "status", "size", "tags",
+    };
+    char buf[64];
+    c->name = "fields";
+    for (size_t i = 0; i < n; ++i)
+        corpus_add(c, buf, snprintf(buf, sizeof(buf), "%s_%s%zu",
+                                    words[i % 16], words[(i / 16) % 16], i / 256));
+}
+
+// Long, similar paths
+static void corpus_paths(corpus_t *c, size_t n)
+{
+    char buf[128];
+    c->name = "paths";
+    for (size_t i = 0; i < n; ++i)
+        corpus_add(c, buf, snprintf(buf, sizeof(buf),
+                                    "/usr/share/libdy/modules/%zu/plugins/%zu/resource.json",
+                                    i % 97, i));
+}
+
+// Random bytes of random length
+static void corpus_random(corpus_t *c, size_t n)
+{
+    char buf[256];
+    c->name = "random";
+    srand(1234);
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t size = 8 + rand() % 193;
+        for (size_t j = 0; j < size; ++j)
+            buf[j] = (char)(rand() & 0xFF);
+        corpus_add(c, buf, size);
+    }
+}
+
+static bool corpus_file(corpus_t *c, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    c->name = path;
+    while ((len = getline(&line, &cap, f)) > 0)
+    {
+        if (line[len - 1] == '\n')
+            --len;
+        corpus_add(c, line, len);
+    }
+
+    free(line);
+    fclose(f);
+    return true;
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_hash(const void *a, const void *b)
+{
+    DyHash x = *(const DyHash *)a, y = *(const DyHash *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench(const corpus_t *c, const hash_t *h)
+{
+    // Throughput: repeat until at least ~64MB have been hashed
+    size_t rounds = 1 + (64u << 20) / (c->bytes + 1);
+    volatile DyHash sink = 0;
+
+    double start = now();
+    for (size_t r = 0; r < rounds; ++r)
+        for (size_t i = 0; i < c->count; ++i)
+            sink ^= h->fn(c->keys[i], c->sizes[i]);
+    double elapsed = now() - start;
+    (void)sink;
+
+    double ns_per_key = elapsed * 1e9 / (rounds * c->count);
+    double mb_per_s = rounds * c->bytes / elapsed / (1 << 20);
+
+    // Distribution: a table with 2 keys per bucket on average, indexed by
+    // the low bits like the intern table and dict index do
+    size_t nbuckets = 1;
+    while (nbuckets * 2 < c->count)
+        nbuckets <<= 1;
+
+    unsigned *buckets = calloc(nbuckets, sizeof(unsigned));
+    DyHash *all = malloc(c->count * sizeof(DyHash));
+
+    for (size_t i = 0; i < c->count; ++i)
+    {
+        all[i] = h->fn(c->keys[i], c->sizes[i]);
+        ++buckets[(size_t)all[i] & (nbuckets - 1)];
+    }
+
+    double expected = (double)c->count / nbuckets;
+    double chi2 = 0;
+    unsigned longest = 0;
+    for (size_t i = 0; i < nbuckets; ++i)
+    {
+        double d = buckets[i] - expected;
+        chi2 += d * d / expected;
+        if (buckets[i] > longest)
+            longest = buckets[i];
+    }
+
+    qsort(all, c->count, sizeof(DyHash), compare_hash);
+    size_t collisions = 0;
+    for (size_t i = 1; i < c->count; ++i)
+        if (all[i] == all[i - 1])
+            ++collisions;
+
+    // chi2/df is ~1.0 for an ideal hash
+    printf("  %-12s %8.2f ns/key %9.1f MB/s   chi2/df %6.3f   longest %3u   collisions %zu\n",
+           h->name, ns_per_key, mb_per_s, chi2 / (nbuckets - 1), longest, collisions);
+
+    free(buckets);
+    free(all);
+}
+
+static void run(corpus_t *c)
+{
+    printf("%s: %zu keys, %.1f bytes average\n",
+           c->name, c->count, (double)c->bytes / c->count);
+    for (size_t i = 0; i < NHASHES; ++i)
+        bench(c, &hashes[i]);
+    corpus_free(c);
+}
+
+int main(int argc, char **argv)
+{
+    const size_t n = 1 << 17;
+    corpus_t c;
+
+    if (argc > 1)
+    {
+        memset(&c, 0, sizeof(c));
+        if (!corpus_file(&c, argv[1]) || !c.count)
+        {
+            fprintf(stderr, "Could not read keys from %s\n", argv[1]);
+            return 1;
+        }
+        run(&c);
+        return 0;
+    }
+
+    memset(&c, 0, sizeof(c));
+    corpus_sequential(&c, n);
+    run(&c);
+
+    memset(&c, 0, sizeof(c));
+    corpus_fields(&c, n);
+    run(&c);
+
+    memset(&c, 0, sizeof(c));
+    corpus_paths(&c, n);
+    run(&c);
+
+    memset(&c, 0, sizeof(c));
+    corpus_random(&c, n);
+    run(&c);
+
+    return 0;
+}
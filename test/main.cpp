@@ -113,6 +113,9 @@ int _main(void)
     Dy::Dict stuff{{"hey", Dy::List{}}};
     Dy::List heys;
     heys.extend(stuff["hey"]); // This line will not compile if the preference is messed up.
+    heys.extend(Dy::List{1, 2});
+    heys.extend(heys);
+    assert(heys.length() == 4);
 
     return 0;
 }
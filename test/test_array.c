@@ -0,0 +1,298 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libdy/dy.h>
+#include <libdy/exceptions.h>
+#include <libdy/json.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_support.h"
+
+
+#define N 1000
+
+// Check and release a reduction result
+static int64_t take_long(DyObject *o)
+{
+    int64_t v = o && Dy_Type(o) == DY_LONG ? DyLong_Get(o) : -1;
+    if (o)
+        Dy_Release(o);
+    return v;
+}
+
+static double take_float(DyObject *o)
+{
+    double v = o && Dy_Type(o) == DY_FLOAT ? DyFloat_Get(o) : -1;
+    if (o)
+        Dy_Release(o);
+    return v;
+}
+
+
+// Reductions agree with plain loops for every size around the vector widths
+static void test_reductions(void)
+{
+    int64_t longs[N];
+    double doubles[N];
+    uint8_t bytes[N];
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        longs[i] = (int64_t)(i * 7919 % 1009) - 500;
+        doubles[i] = longs[i] / 4.0;
+        bytes[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    for (size_t n = 1; n < 70; ++n)
+    {
+        int64_t lsum = 0, lmin = longs[0], lmax = longs[0], ldot = 0;
+        double dsum = 0, dmin = doubles[0], dmax = doubles[0], ddot = 0;
+        int64_t bsum = 0, bmin = 255, bmax = 0, bdot = 0;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            lsum += longs[i];
+            ldot += longs[i] * longs[i];
+            if (longs[i] < lmin) lmin = longs[i];
+            if (longs[i] > lmax) lmax = longs[i];
+            dsum += doubles[i];
+            ddot += doubles[i] * doubles[i];
+            if (doubles[i] < dmin) dmin = doubles[i];
+            if (doubles[i] > dmax) dmax = doubles[i];
+            bsum += bytes[i];
+            bdot += bytes[i] * bytes[i];
+            if (bytes[i] < bmin) bmin = bytes[i];
+            if (bytes[i] > bmax) bmax = bytes[i];
+        }
+
+        DyObject *la = DyArray_FromData(DY_ARRAY_INT64, longs, n);
+        DyObject *da = DyArray_FromData(DY_ARRAY_DOUBLE, doubles, n);
+        DyObject *ba = DyArray_FromData(DY_ARRAY_BYTES, bytes, n);
+
+        CHECK(take_long(DyArray_Sum(la)) == lsum, "int64 sum %zu", n);
+        CHECK(take_long(DyArray_Min(la)) == lmin, "int64 min %zu", n);
+        CHECK(take_long(DyArray_Max(la)) == lmax, "int64 max %zu", n);
+        CHECK(take_long(DyArray_Dot(la, la)) == ldot, "int64 dot %zu", n);
+
+        // Quarters add up exactly in any order
+        CHECK(take_float(DyArray_Sum(da)) == dsum, "double sum %zu", n);
+        CHECK(take_float(DyArray_Min(da)) == dmin, "double min %zu", n);
+        CHECK(take_float(DyArray_Max(da)) == dmax, "double max %zu", n);
+        CHECK(take_float(DyArray_Dot(da, da)) == ddot, "double dot %zu", n);
+
+        CHECK(take_long(DyArray_Sum(ba)) == bsum, "bytes sum %zu", n);
+        CHECK(take_long(DyArray_Min(ba)) == bmin, "bytes min %zu", n);
+        CHECK(take_long(DyArray_Max(ba)) == bmax, "bytes max %zu", n);
+        CHECK(take_long(DyArray_Dot(ba, ba)) == bdot, "bytes dot %zu", n);
+
+        Dy_Release(la);
+        Dy_Release(da);
+        Dy_Release(ba);
+    }
+
+    // Byte sums don't overflow
+    DyObject *ba = DyArray_New(DY_ARRAY_BYTES, 1 << 20);
+    size_t size;
+    uint8_t *data = DyArray_Data(ba, &size);
+    memset(data, 255, size);
+    CHECK(take_long(DyArray_Sum(ba)) == 255ll << 20, "big bytes sum");
+    CHECK(take_long(DyArray_Dot(ba, ba)) == 65025ll << 20, "big bytes dot");
+    Dy_Release(ba);
+
+    DyObject *empty = DyArray_New(DY_ARRAY_DOUBLE, 0);
+    CHECK(take_float(DyArray_Sum(empty)) == 0, "empty sum");
+    CHECK(!DyArray_Min(empty), "empty min");
+    DyErr_Clear();
+    Dy_Release(empty);
+}
+
+// Element-wise operations with arrays and scalars
+static void test_apply(void)
+{
+    int64_t longs[] = {1, -2, 3, -4, 5, -6, 7, INT64_MIN, 9};
+    DyObject *la = DyArray_FromData(DY_ARRAY_INT64, longs, 9);
+    DyObject *lb = DyArray_Copy(la);
+
+    CHECK(DyArray_Apply(la, DY_ARRAY_MUL, lb), "int64 mul");
+    CHECK(DyArray_Apply(la, DY_ARRAY_DIV, lb), "int64 div");
+    DyObject *minus_one = DyLong_New(-1);
+    CHECK(DyArray_ApplyScalar(la, DY_ARRAY_SUB, minus_one), "int64 sub scalar");
+    int64_t v;
+    CHECK(DyArray_GetLong(la, 0, &v) && v == 2, "int64 element 0");
+    CHECK(DyArray_GetLong(la, -1, &v) && v == 10, "int64 element -1");
+    CHECK(DyArray_ApplyScalar(lb, DY_ARRAY_DIV, minus_one) && DyArray_GetLong(lb, 7, &v) && v == INT64_MIN, "INT64_MIN / -1");
+    CHECK(!DyArray_GetLong(la, 9, &v), "out of range");
+    DyErr_Clear();
+
+    DyObject *zero = DyLong_New(0);
+    CHECK(!DyArray_ApplyScalar(la, DY_ARRAY_DIV, zero), "division by zero");
+    DyErr_Clear();
+    CHECK(DyArray_GetLong(la, 0, &v) && v == 2, "unchanged after error");
+
+    DyObject *half = DyFloat_New(0.5);
+    CHECK(!DyArray_ApplyScalar(la, DY_ARRAY_MUL, half), "float into int64");
+    DyErr_Clear();
+
+    double doubles[N];
+    for (size_t i = 0; i < N; ++i)
+        doubles[i] = i;
+    DyObject *da = DyArray_FromData(DY_ARRAY_DOUBLE, doubles, 17);
+    DyObject *db = DyArray_FromData(DY_ARRAY_DOUBLE, doubles, 17);
+    CHECK(DyArray_ApplyScalar(da, DY_ARRAY_MUL, half), "double mul scalar");
+    CHECK(DyArray_Apply(da, DY_ARRAY_ADD, db), "double add");
+    CHECK(DyArray_ApplyScalar(da, DY_ARRAY_DIV, zero), "double division by zero");
+    double d;
+    CHECK(DyArray_GetFloat(da, 16, &d) && d > 1e300, "inf");
+    CHECK(!DyArray_Apply(da, DY_ARRAY_ADD, la), "mixed kinds");
+    DyErr_Clear();
+
+    DyObject *dc = DyArray_FromData(DY_ARRAY_DOUBLE, doubles, 16);
+    CHECK(!DyArray_Dot(db, dc), "size mismatch");
+    DyErr_Clear();
+
+    uint8_t bytes[40];
+    for (size_t i = 0; i < sizeof(bytes); ++i)
+        bytes[i] = i * 10;
+    DyObject *ba = DyArray_FromData(DY_ARRAY_BYTES, bytes, sizeof(bytes));
+    DyObject *hundred = DyLong_New(100);
+    CHECK(DyArray_ApplyScalar(ba, DY_ARRAY_ADD, hundred), "bytes add");
+    CHECK(DyArray_GetLong(ba, 39, &v) && v == (390 + 100) % 256, "bytes wrap");
+    CHECK(DyArray_ApplyScalar(ba, DY_ARRAY_DIV, hundred), "bytes div");
+    CHECK(DyArray_GetLong(ba, 10, &v) && v == 2, "bytes div result");
+    CHECK(!DyArray_SetLong(ba, 0, 256), "byte range");
+    DyErr_Clear();
+
+    Dy_Release(minus_one);
+    Dy_Release(zero);
+    Dy_Release(half);
+    Dy_Release(hundred);
+    Dy_Release(la);
+    Dy_Release(lb);
+    Dy_Release(da);
+    Dy_Release(db);
+    Dy_Release(dc);
+    Dy_Release(ba);
+}
+
+static int destroyed = 0;
+
+static void destroy_buffer(void *buffer)
+{
+    ++destroyed;
+    free(buffer);
+}
+
+// Arrays wrap buffers, convert from and to lists and compare by value
+static void test_conversion(void)
+{
+    double *buffer = malloc(4 * sizeof(double));
+    for (int i = 0; i < 4; ++i)
+        buffer[i] = i + 0.5;
+
+    DyObject *wrapped = DyArray_FromBuffer(DY_ARRAY_DOUBLE, buffer, 4, buffer, destroy_buffer);
+    size_t size;
+    CHECK(DyArray_Data(wrapped, &size) == buffer && size == 4, "no copy");
+    CHECK(DyArray_Kind(wrapped) == DY_ARRAY_DOUBLE && Dy_Length(wrapped) == 4, "kind and length");
+
+    DyObject *list = DyArray_ToList(wrapped);
+    CHECK(list && Dy_Length(list) == 4 && DyFloat_Get(Dy_GetItemLong(list, 3)) == 3.5, "to list");
+
+    DyObject *back = DyArray_FromList(list, DY_ARRAY_DOUBLE);
+    CHECK(back && Dy_Equals(back, wrapped), "round trip");
+    CHECK(!DyArray_FromList(list, DY_ARRAY_INT64), "floats into int64");
+    DyErr_Clear();
+
+    CHECK(!strcmp(Dy_AsRepr(wrapped), "<Array double [0.500000, 1.500000, 2.500000, 3.500000]>"),
+          "repr %s", Dy_AsRepr(wrapped));
+
+    Dy_Release(back);
+    Dy_Release(list);
+    Dy_Release(wrapped);
+    CHECK(destroyed == 1, "destroyed");
+
+    list = DyJson_Parse("[1, 2, 300]");
+    back = DyArray_FromList(list, DY_ARRAY_INT64);
+    CHECK(back && take_long(DyArray_Sum(back)) == 303, "int64 from list");
+    CHECK(!DyArray_FromList(list, DY_ARRAY_BYTES), "too big for bytes");
+    DyErr_Clear();
+    Dy_Release(back);
+
+    DyList_Append(list, Dy_None);
+    CHECK(!DyArray_FromList(list, DY_ARRAY_DOUBLE), "None");
+    DyErr_Clear();
+    Dy_Release(list);
+}
+
+// Numeric JSON arrays parse into typed arrays
+static void test_json_arrays(void)
+{
+    DyObject *json = DyString_FromString(
+        "{\"ints\": [1, -2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18],"
+        " \"mixed\": [1, 2.5, 3e1],"
+        " \"trailing\": [1, 2,],"
+        " \"other\": [1, 2, \"three\", [4.5]],"
+        " \"empty\": []}");
+
+    DyObject *doc = DyJson_ParseEx(json, DYJ_PARSE_ARRAYS);
+    CHECK(doc, "parsed");
+    if (!doc)
+    {
+        DyErr_Clear();
+        Dy_Release(json);
+        return;
+    }
+
+    DyObject *ints = Dy_GetItemString(doc, "ints");
+    CHECK(Dy_Type(ints) == DY_ARRAY && DyArray_Kind(ints) == DY_ARRAY_INT64 && Dy_Length(ints) == 18, "ints");
+    CHECK(take_long(DyArray_Sum(ints)) == 167, "ints sum");
+
+    DyObject *mixed = Dy_GetItemString(doc, "mixed");
+    CHECK(Dy_Type(mixed) == DY_ARRAY && DyArray_Kind(mixed) == DY_ARRAY_DOUBLE, "mixed");
+    CHECK(take_float(DyArray_Sum(mixed)) == 33.5, "mixed sum");
+
+    CHECK(Dy_Length(Dy_GetItemString(doc, "trailing")) == 2, "trailing comma");
+
+    DyObject *other = Dy_GetItemString(doc, "other");
+    CHECK(Dy_Type(other) == DY_LIST && Dy_Length(other) == 4, "other");
+    CHECK(DyLong_Get(Dy_GetItemLong(other, 1)) == 2, "other numbers kept");
+    CHECK(Dy_Type(Dy_GetItemLong(other, 3)) == DY_ARRAY, "nested");
+
+    CHECK(Dy_Type(Dy_GetItemString(doc, "empty")) == DY_LIST, "empty");
+    Dy_Release(doc);
+
+    doc = DyJson_ParseEx(json, 0);
+    CHECK(Dy_Type(Dy_GetItemString(doc, "ints")) == DY_LIST, "flag off");
+    Dy_Release(doc);
+
+    Dy_Release(json);
+}
+
+
+int main(void)
+{
+    test_reductions();
+    test_apply();
+    test_conversion();
+    test_json_arrays();
+
+    return test_result("array");
+}
@@ -0,0 +1,616 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libdy/dy.h>
+#include <libdy/exceptions.h>
+#include <libdy/runtime.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_support.h"
+
+
+#define N 20000
+
+static DyObject *make_key(int i)
+{
+    if (i % 3)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key-%d", i);
+        return DyString_FromString(buf);
+    }
+    return DyLong_New(i);
+}
+
+// Random insert/overwrite/delete against a plain array as reference
+static void test_random_ops(void)
+{
+    DyObject *dict = DyDict_New();
+    long *ref = calloc(N, sizeof(long));
+    size_t count = 0;
+
+    srand(42);
+
+    for (int round = 0; round < 8 * N; ++round)
+    {
+        int i = rand() % N;
+        DyObject *key = make_key(i);
+
+        if (rand() % 4)
+        {
+            DyObject *value = DyLong_New(round + 1);
+            CHECK(Dy_SetItem(dict, key, value), "set %d", i);
+            Dy_Release(value);
+            if (!ref[i])
+                ++count;
+            ref[i] = round + 1;
+        }
+        else
+        {
+            CHECK(Dy_SetItem(dict, key, NULL), "delete %d", i);
+            if (ref[i])
+                --count;
+            ref[i] = 0;
+        }
+
+        Dy_Release(key);
+    }
+
+    CHECK(Dy_Length(dict) == count, "length %zu != %zu", Dy_Length(dict), count);
+
+    for (int i = 0; i < N; ++i)
+    {
+        DyObject *key = make_key(i);
+        DyObject *value = Dy_GetItemU(dict, key);
+        if (ref[i])
+            CHECK(value != Dy_Undefined && DyLong_Get(value) == ref[i], "lookup %d", i);
+        else
+            CHECK(value == Dy_Undefined, "deleted key %d still present", i);
+        Dy_Release(key);
+    }
+
+    size_t seen = 0;
+    DyDict_IterPair **it = DyDict_Iter(dict);
+    if (*it)
+        do ++seen;
+        while (DyDict_IterNext(it));
+    DyDict_IterFree(it);
+    CHECK(seen == count, "iterated %zu of %zu items", seen, count);
+
+    CHECK(DyDict_Clear(dict), "clear");
+    CHECK(Dy_Length(dict) == 0, "length after clear");
+
+    free(ref);
+    Dy_Release(dict);
+}
+
+// Lookups falling through to parents
+static void test_inheritance(void)
+{
+    DyObject *base = DyDict_New();
+    DyObject *child = DyDict_NewWithParent(base);
+
+    Dy_SetItemString(base, "a", Dy_True);
+    Dy_SetItemString(child, "b", Dy_False);
+
+    CHECK(Dy_GetItemStringU(child, "a") == Dy_True, "inherited lookup");
+    CHECK(Dy_GetItemStringU(child, "b") == Dy_False, "own lookup");
+    CHECK(Dy_GetItemStringU(base, "b") == Dy_Undefined, "parent sees child item");
+    CHECK(Dy_Length(child) == 1, "length counts inherited items");
+
+    Dy_Release(child);
+    Dy_Release(base);
+}
+
+// Iteration follows insertion order, also after deletions and growth
+static void test_order(void)
+{
+    DyObject *dict = DyDict_New();
+
+    for (long i = 0; i < 1000; ++i)
+        Dy_SetItemLong(dict, i, Dy_True);
+    for (long i = 0; i < 1000; i += 2)
+        Dy_SetItemLong(dict, i, NULL);
+    for (long i = 1000; i < 2000; ++i)
+        Dy_SetItemLong(dict, i, Dy_True);
+
+    // Overwriting keeps the position
+    Dy_SetItemLong(dict, 1, Dy_False);
+
+    long expect = 1;
+    DyDict_IterPair **it = DyDict_Iter(dict);
+    if (*it)
+        do
+        {
+            long k = DyLong_Get((*it)->key);
+            CHECK(k == expect, "order: got %ld, expected %ld", k, expect);
+            expect += expect < 999 ? 2 : 1;
+        }
+        while (DyDict_IterNext(it));
+    DyDict_IterFree(it);
+    CHECK(expect == 2000, "iteration stopped at %ld", expect);
+
+    Dy_Release(dict);
+}
+
+// Dicts sharing key tables behave like regular ones
+static void test_shared(void)
+{
+    static const char *names[] = {"id", "name", "tags", "score"};
+    DyObject *records[100];
+
+    for (int r = 0; r < 100; ++r)
+    {
+        records[r] = DyDict_NewShared();
+        for (int k = 0; k < 4; ++k)
+        {
+            DyObject *v = DyLong_New(r * 10 + k);
+            Dy_SetItemString(records[r], names[k], v);
+            Dy_Release(v);
+        }
+    }
+
+    // Diverging shapes
+    Dy_SetItemString(records[1], "extra", Dy_True);
+    Dy_SetItemString(records[2], "other", Dy_True);
+    // Overwrite, delete and non-string keys convert or stay consistent
+    Dy_SetItemString(records[3], "name", Dy_None);
+    Dy_SetItemString(records[4], "tags", NULL);
+    Dy_SetItemLong(records[5], 7, Dy_True);
+
+    for (int r = 0; r < 100; ++r)
+        for (int k = 0; k < 4; ++k)
+        {
+            DyObject *v = Dy_GetItemStringU(records[r], names[k]);
+            if (r == 3 && k == 1)
+                CHECK(v == Dy_None, "overwritten value");
+            else if (r == 4 && k == 2)
+                CHECK(v == Dy_Undefined, "deleted value");
+            else
+                CHECK(v != Dy_Undefined && DyLong_Get(v) == r * 10 + k, "record %d key %s", r, names[k]);
+        }
+
+    CHECK(Dy_GetItemStringU(records[1], "extra") == Dy_True, "extra key");
+    CHECK(Dy_GetItemStringU(records[1], "other") == Dy_Undefined, "key leaked between shapes");
+    CHECK(Dy_GetItemStringU(records[2], "other") == Dy_True, "other key");
+    CHECK(Dy_GetItemLongU(records[5], 7) == Dy_True, "long key");
+    CHECK(Dy_Length(records[1]) == 5 && Dy_Length(records[4]) == 3, "shared lengths");
+
+    int k = 0;
+    DyDict_IterPair **it = DyDict_Iter(records[1]);
+    if (*it)
+        do
+        {
+            if (k < 4)
+                CHECK(!strcmp(DyString_AsString((*it)->key), names[k]), "shared order");
+            ++k;
+        }
+        while (DyDict_IterNext(it));
+    DyDict_IterFree(it);
+    CHECK(k == 5, "shared iteration");
+
+    CHECK(DyDict_Clear(records[6]) && Dy_Length(records[6]) == 0, "shared clear");
+    Dy_SetItemString(records[6], "id", Dy_True);
+    CHECK(Dy_GetItemStringU(records[6], "id") == Dy_True, "reuse after clear");
+
+    for (int r = 0; r < 100; ++r)
+        Dy_Release(records[r]);
+}
+
+// Flattened parent view stays in sync with the ancestors
+static void test_lookup_cache(void)
+{
+    DyObject *defaults = DyDict_New();
+    DyObject *site = DyDict_NewWithParent(defaults);
+    DyObject *tenant = DyDict_NewWithParent(site);
+    DyObject *request = DyDict_NewWithParent(tenant);
+
+    Dy_SetItemString(defaults, "a", Dy_False);
+    Dy_SetItemString(defaults, "b", Dy_False);
+    Dy_SetItemString(site, "a", Dy_True);
+
+    CHECK(DyDict_EnableLookupCache(request), "enable cache");
+
+    CHECK(Dy_GetItemStringU(request, "a") == Dy_True, "nearest ancestor wins");
+    CHECK(Dy_GetItemStringU(request, "b") == Dy_False, "distant ancestor");
+    CHECK(Dy_GetItemStringU(request, "c") == Dy_Undefined, "missing key");
+
+    // Any ancestor changing invalidates the view
+    Dy_SetItemString(tenant, "b", Dy_None);
+    CHECK(Dy_GetItemStringU(request, "b") == Dy_None, "stale after set");
+    Dy_SetItemString(site, "a", NULL);
+    CHECK(Dy_GetItemStringU(request, "a") == Dy_False, "stale after delete");
+    DyDict_Clear(tenant);
+    CHECK(Dy_GetItemStringU(request, "b") == Dy_False, "stale after clear");
+
+    // Own items still take precedence
+    Dy_SetItemString(request, "b", Dy_True);
+    CHECK(Dy_GetItemStringU(request, "b") == Dy_True, "own item");
+
+    DyDict_LookupCacheStats stats;
+    CHECK(DyDict_GetLookupCacheStats(request, &stats), "stats");
+    CHECK(stats.misses == 4 && stats.hits == 2, "hits %zu misses %zu", stats.hits, stats.misses);
+    CHECK(stats.size == 2, "cache size %zu", stats.size);
+    CHECK(!DyDict_GetLookupCacheStats(tenant, &stats), "no cache");
+
+    Dy_Release(request);
+    Dy_Release(tenant);
+    Dy_Release(site);
+    Dy_Release(defaults);
+}
+
+// Pre-resolved key handles
+static DyKey k_name = DY_KEY("name");
+
+static void test_keys(void)
+{
+    DyObject *dict = DyDict_New();
+    DyObject *shared = DyDict_NewShared();
+    DyObject *value = DyString_FromString("x");
+    DyObject *plain = DyString_FromString("name");
+    DyKey k_other;
+
+    CHECK(DyKey_Init(&k_other, "other"), "init key");
+
+    // Non-interned equal keys are found through a handle and vice versa
+    Dy_SetItem(dict, plain, value);
+    CHECK(Dy_GetItemKeyU(dict, &k_name) == value, "handle finds plain key");
+    CHECK(Dy_SetItemKey(dict, &k_name, Dy_True), "set by handle");
+    CHECK(Dy_GetItemU(dict, plain) == Dy_True && Dy_Length(dict) == 1, "handle overwrites plain key");
+    CHECK(Dy_GetItemKeyD(dict, &k_other, Dy_None) == Dy_None, "default");
+
+    CHECK(Dy_GetItemKey(dict, &k_other) == NULL, "KeyError");
+    DyErr_Clear();
+
+    CHECK(Dy_SetItemKey(shared, &k_name, value) && Dy_SetItemKey(shared, &k_other, value), "set shared");
+    CHECK(Dy_GetItemStringU(shared, "other") == value, "shared lookup");
+
+    // Lists name the key's type, not the key
+    DyObject *list = DyList_New();
+    CHECK(!Dy_SetItemKey(list, &k_other, value) && !strstr(DyErr_Message(DyErr_Occurred()), "other"),
+          "list error names the type: %s", DyErr_Message(DyErr_Occurred()));
+    DyErr_Clear();
+    Dy_Release(list);
+
+    DyKey_Clear(&k_other);
+    Dy_Release(plain);
+    Dy_Release(value);
+    Dy_Release(shared);
+    Dy_Release(dict);
+}
+
+// Call-site caches notice modifications
+static void test_cached_get(void)
+{
+    DyObject *dict = DyDict_New();
+    DyObject *key = DyString_FromString("field");
+    DyDict_Cache cache = DY_DICT_CACHE_INIT;
+
+    CHECK(DyDict_CachedGet(dict, key, &cache) == Dy_Undefined, "cached miss");
+
+    Dy_SetItem(dict, key, Dy_True);
+    CHECK(DyDict_CachedGet(dict, key, &cache) == Dy_True, "cached first lookup");
+    CHECK(DyDict_CachedGet(dict, key, &cache) == Dy_True, "cached hit");
+
+    for (long i = 0; i < 100; ++i)
+        Dy_SetItemLong(dict, i, Dy_None);
+    Dy_SetItem(dict, key, Dy_False);
+    CHECK(DyDict_CachedGet(dict, key, &cache) == Dy_False, "cached after modification");
+
+    Dy_SetItem(dict, key, NULL);
+    CHECK(DyDict_CachedGet(dict, key, &cache) == Dy_Undefined, "cached after delete");
+
+    // A different dict using the same cache
+    DyObject *other = DyDict_NewShared();
+    Dy_SetItem(other, key, Dy_None);
+    CHECK(DyDict_CachedGet(other, key, &cache) == Dy_None, "cached other dict");
+    CHECK(DyDict_CachedGet(other, key, &cache) == Dy_None, "cached other dict hit");
+
+    Dy_Release(other);
+    Dy_Release(key);
+    Dy_Release(dict);
+}
+
+static DyObject *increment(DyObject *key, DyObject *value, void *data)
+{
+    (void)key;
+    ++*(int *)data;
+    return DyLong_New(value ? DyLong_Get(value) + 1 : 1);
+}
+
+// Bulk construction and single-probe read-modify-write
+static void test_bulk(void)
+{
+    DyObject *keys[100], *values[100];
+    for (int i = 0; i < 100; ++i)
+    {
+        keys[i] = make_key(i);
+        values[i] = DyLong_New(i);
+    }
+
+    DyObject *a = DyDict_FromArrays(keys, values, 100);
+    CHECK(a && Dy_Length(a) == 100, "from arrays");
+    CHECK(DyLong_Get(Dy_GetItemU(a, keys[42])) == 42, "from arrays lookup");
+
+    DyObject *b = DyDict_NewEx(1000);
+    Dy_SetItemString(b, "x", Dy_True);
+    CHECK(DyDict_Update(b, a) && Dy_Length(b) == 101, "update");
+    CHECK(DyLong_Get(Dy_GetItemU(b, keys[99])) == 99, "update lookup");
+
+    CHECK(DyDict_SetDefault(b, keys[1], Dy_None) == values[1], "setdefault existing");
+    CHECK(DyDict_SetDefault(b, keys[0], Dy_None) == values[0], "setdefault existing 0");
+    DyObject *nk = DyString_FromString("new");
+    CHECK(DyDict_SetDefault(b, nk, Dy_None) == Dy_None && Dy_Length(b) == 102, "setdefault new");
+
+    DyObject *popped = DyDict_Pop(b, keys[5], NULL);
+    CHECK(popped == values[5] && Dy_Length(b) == 101, "pop");
+    Dy_Release(popped);
+    CHECK(DyDict_Pop(b, keys[5], NULL) == NULL, "pop missing");
+    DyErr_Clear();
+    popped = DyDict_Pop(b, keys[5], Dy_False);
+    CHECK(popped == Dy_False, "pop default");
+    Dy_Release(popped);
+
+    int calls = 0;
+    DyObject *counters[2] = { DyDict_New(), DyDict_NewShared() };
+    for (int d = 0; d < 2; ++d)
+    {
+        for (int i = 0; i < 10; ++i)
+            CHECK(DyDict_Upsert(counters[d], nk, increment, &calls), "upsert");
+        CHECK(DyLong_Get(Dy_GetItemU(counters[d], nk)) == 10, "upsert count");
+
+        DyObject *v = DyDict_Pop(counters[d], nk, NULL);
+        CHECK(v && DyLong_Get(v) == 10 && Dy_Length(counters[d]) == 0, "pop upserted");
+        Dy_Release(v);
+        Dy_Release(counters[d]);
+    }
+    CHECK(calls == 20, "upsert calls");
+
+    Dy_Release(nk);
+    Dy_Release(b);
+    Dy_Release(a);
+    for (int i = 0; i < 100; ++i)
+    {
+        Dy_Release(keys[i]);
+        Dy_Release(values[i]);
+    }
+}
+
+static bool sum_values(DyObject *key, DyObject *value, void *data)
+{
+    (void)key;
+    *(long *)data += DyLong_Get(value);
+    return DyLong_Get(value) < 1000;
+}
+
+// Allocation-free iteration
+static void test_iterator(void)
+{
+    DyObject *dicts[2] = { DyDict_New(), DyDict_NewShared() };
+
+    for (int d = 0; d < 2; ++d)
+    {
+        DyDict_Iterator it;
+        CHECK(DyDict_IterInit(&it, dicts[d]) && !it.entry, "empty iterator");
+
+        for (long i = 1; i <= 10; ++i)
+        {
+            char name[8];
+            snprintf(name, sizeof(name), "k%ld", i);
+            DyObject *v = DyLong_New(i);
+            Dy_SetItemString(dicts[d], name, v);
+            Dy_Release(v);
+        }
+
+        long sum = 0, n = 0;
+        for (DyDict_IterInit(&it, dicts[d]); it.entry; DyDict_IterNext(&it.entry))
+        {
+            CHECK(DyLong_Get(it.entry->value) == ++n, "iterator order");
+            sum += DyLong_Get(it.entry->value);
+        }
+        CHECK(n == 10 && sum == 55, "iterator count");
+
+        sum = 0;
+        CHECK(DyDict_ForEach(dicts[d], sum_values, &sum) && sum == 55, "foreach");
+
+        DyObject *big = DyLong_New(5000);
+        Dy_SetItemString(dicts[d], "big", big);
+        Dy_Release(big);
+        sum = 0;
+        CHECK(!DyDict_ForEach(dicts[d], sum_values, &sum) && sum == 5055, "foreach stop");
+
+        Dy_Release(dicts[d]);
+    }
+}
+
+// Lookups on dicts with interned keys, mixed with plain strings
+static void test_interned(void)
+{
+    DyObject *interning = DyDict_New();
+    DyObject *plain = DyDict_New();
+    CHECK(DyDict_SetInternKeys(interning, true), "intern keys");
+
+    for (int i = 0; i < 200; ++i)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "field%d", i);
+        DyObject *k = DyString_FromString(name);
+        Dy_SetItem(interning, k, Dy_True);
+        Dy_SetItem(plain, k, Dy_True);
+        Dy_Release(k);
+    }
+
+    for (int i = 0; i < 220; ++i)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "field%d", i);
+        DyObject *k = DyString_FromString(name);
+        DyObject *ik = DyString_InternStringFromString(name);
+        DyObject *expect = i < 200 ? Dy_True : Dy_Undefined;
+
+        CHECK(Dy_GetItemU(interning, k) == expect, "plain key in interning dict %d", i);
+        CHECK(Dy_GetItemU(interning, ik) == expect, "interned key in interning dict %d", i);
+        CHECK(Dy_GetItemU(plain, k) == expect, "plain key in plain dict %d", i);
+        CHECK(Dy_GetItemU(plain, ik) == expect, "interned key in plain dict %d", i);
+
+        Dy_Release(ik);
+        Dy_Release(k);
+    }
+
+    // Keys added by SetDefault and Upsert are interned as well
+    DyObject *k = DyString_FromString("setdefault-key");
+    CHECK(DyDict_SetDefault(interning, k, Dy_None) == Dy_None, "setdefault interning");
+    Dy_Release(k);
+
+    int calls = 0;
+    k = DyString_FromString("upsert-key");
+    CHECK(DyDict_Upsert(interning, k, increment, &calls), "upsert interning");
+    Dy_Release(k);
+
+    DyDict_Iterator it;
+    for (DyDict_IterInit(&it, interning); it.entry; DyDict_IterNext(&it.entry))
+        CHECK(DyString_Interned(it.entry->key) == it.entry->key, "stored key interned");
+
+    Dy_Release(plain);
+    Dy_Release(interning);
+}
+
+// String hashes match the host hash function, short and long
+static void test_string_hash(void)
+{
+    char buf[256];
+    memset(buf, 'x', sizeof(buf));
+
+    for (size_t size = 0; size < sizeof(buf); size += 7)
+    {
+        DyObject *s = DyString_FromStringAndSize(buf, size);
+        DyHash expect = Dy_hash_wyhash(buf, size);
+        CHECK(Dy_Hash(s) == expect, "hash of %zu bytes", size);
+        CHECK(Dy_Hash(s) == expect, "cached hash of %zu bytes", size);
+        Dy_Release(s);
+    }
+
+    CHECK(Dy_hash_wyhash("key-1", 5) != Dy_hash_wyhash("key-2", 5), "wyhash differs");
+    CHECK(Dy_hash_fnv1("ab", 1) == Dy_hash_fnv1("ac", 1), "fnv1 stays in bounds");
+}
+
+// Integer keys hash to themselves, so keys that all land in the same index
+// group can be computed by inverting the dict's mixing function. The dict has
+// to notice and switch to keyed hashing, or inserting them takes ages.
+static uint64_t mul_inverse(uint64_t a)
+{
+    uint64_t x = a;
+    for (int i = 0; i < 6; ++i)
+        x *= 2 - a * x;
+    return x;
+}
+
+static void test_flood(void)
+{
+    const uint64_t inv = mul_inverse(UINT64_C(0x9E3779B97F4A7C15));
+    const int n = 20000;
+    DyObject *dict = DyDict_New();
+
+    for (int i = 0; i < n; ++i)
+    {
+        // Same low 40 bits after mixing: same group and control byte
+        uint64_t mixed = ((uint64_t)i << 40) | 0x1234;
+        uint64_t h = mixed ^ (mixed >> 32);
+        DyObject *key = DyLong_New((int64_t)(h * inv));
+        DyObject *value = DyLong_New(i);
+        CHECK(Dy_SetItem(dict, key, value), "flood insert %d", i);
+        Dy_Release(key);
+        Dy_Release(value);
+    }
+
+    CHECK(Dy_Length(dict) == (size_t)n, "flood size %zu", Dy_Length(dict));
+
+    for (int i = 0; i < n; ++i)
+    {
+        uint64_t mixed = ((uint64_t)i << 40) | 0x1234;
+        uint64_t h = mixed ^ (mixed >> 32);
+        DyObject *key = DyLong_New((int64_t)(h * inv));
+        if (i % 2)
+            CHECK(DyLong_Get(Dy_GetItem(dict, key)) == i, "flood lookup %d", i);
+        else
+            CHECK(Dy_SetItem(dict, key, NULL), "flood delete %d", i);
+        Dy_Release(key);
+    }
+
+    CHECK(Dy_Length(dict) == (size_t)n / 2, "flood size after delete %zu", Dy_Length(dict));
+
+    Dy_Release(dict);
+}
+
+// Integer keys: small ones are shared, lookups don't allocate keys
+static void test_long_keys(void)
+{
+    DyObject *a = DyLong_New(42), *b = DyLong_New(42);
+    CHECK(a == b, "small ints shared");
+    for (int i = 0; i < 10; ++i)
+        Dy_Release(a);
+    CHECK(DyLong_Get(b) == 42, "small int survives releases");
+    Dy_Release(b);
+
+    a = DyLong_New(1 << 20);
+    b = DyLong_New(1 << 20);
+    CHECK(a != b && Dy_Equals(a, b), "large ints");
+    Dy_Release(a);
+    Dy_Release(b);
+
+    DyObject *d = DyDict_New();
+    for (long k = -10; k < 2000; k += 7)
+    {
+        DyObject *v = DyLong_New(k * 3);
+        Dy_SetItemLong(d, k, v);
+        Dy_Release(v);
+    }
+
+    bool ok = true;
+    for (long k = -10; k < 2000; k += 7)
+        ok &= DyLong_Get(Dy_GetItemLong(d, k)) == k * 3;
+    CHECK(ok, "get long keys");
+
+    CHECK(Dy_GetItemLongU(d, -9) == Dy_Undefined, "missing long key");
+    CHECK(!Dy_GetItemLong(d, -9), "missing long key error");
+    DyErr_Clear();
+
+    Dy_Release(d);
+}
+
+int main(void)
+{
+    test_random_ops();
+    test_inheritance();
+    test_order();
+    test_shared();
+    test_lookup_cache();
+    test_keys();
+    test_cached_get();
+    test_bulk();
+    test_iterator();
+    test_interned();
+    test_string_hash();
+    test_flood();
+    test_long_keys();
+
+    return test_result("dict");
+}
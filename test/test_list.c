@@ -0,0 +1,509 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libdy/dy.h>
+#include <libdy/exceptions.h>
+#include <libdy/json.h>
+#include <libdy/runtime.h>
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_support.h"
+
+
+#define N 1000
+
+// Build a list of the integers [start, stop)
+static DyObject *range(long start, long stop)
+{
+    DyObject *list = DyList_New();
+    for (long i = start; i < stop; ++i)
+    {
+        DyObject *item = DyLong_New(i);
+        DyList_Append(list, item);
+        Dy_Release(item);
+    }
+    return list;
+}
+
+// Compare a list to a C array of integers
+static bool contents(DyObject *list, const long *expect, size_t n)
+{
+    if (Dy_Length(list) != n)
+        return false;
+    for (size_t i = 0; i < n; ++i)
+        if (DyLong_Get(Dy_GetItemLong(list, i)) != expect[i])
+            return false;
+    return true;
+}
+
+#define CONTENTS(list, ...) \
+    contents(list, (const long[]){__VA_ARGS__}, sizeof((const long[]){__VA_ARGS__}) / sizeof(long))
+
+
+static void test_insert(void)
+{
+    DyObject *list = range(0, 3);
+    DyObject *item = DyLong_New(9);
+
+    DyList_Insert(list, 0, item);
+    DyList_Insert(list, 2, item);
+    DyList_Insert(list, -1, item);
+    DyList_Insert(list, 100, item);
+    CHECK(CONTENTS(list, 9, 0, 9, 1, 9, 2, 9), "insert %s", Dy_AsRepr(list));
+
+    // Cleared lists can grow again
+    DyList_Clear(list);
+    DyList_Append(list, item);
+    CHECK(CONTENTS(list, 9), "append after clear");
+
+    Dy_Release(item);
+    Dy_Release(list);
+}
+
+static void test_extend(void)
+{
+    DyObject *list = range(0, 3);
+    DyObject *more = range(3, 5);
+
+    CHECK(DyList_Extend(list, more), "extend");
+    CHECK(CONTENTS(list, 0, 1, 2, 3, 4), "extended %s", Dy_AsRepr(list));
+
+    CHECK(DyList_Extend(list, list), "extend by itself");
+    CHECK(CONTENTS(list, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4), "doubled %s", Dy_AsRepr(list));
+
+    CHECK(!DyList_Extend(list, Dy_None), "extend by None");
+    DyErr_Clear();
+
+    Dy_Release(more);
+    Dy_Release(list);
+}
+
+static void test_slices(void)
+{
+    DyObject *list = range(0, 10);
+
+    DyObject *slice = DyList_GetSlice(list, 2, 5);
+    CHECK(CONTENTS(slice, 2, 3, 4), "slice %s", Dy_AsRepr(slice));
+    Dy_Release(slice);
+
+    slice = DyList_GetSlice(list, -3, 100);
+    CHECK(CONTENTS(slice, 7, 8, 9), "negative slice %s", Dy_AsRepr(slice));
+    Dy_Release(slice);
+
+    slice = DyList_GetSlice(list, 5, 2);
+    CHECK(slice && Dy_Length(slice) == 0, "empty slice");
+
+    // Shrink, grow and replace in place
+    DyObject *two = range(20, 22);
+    CHECK(DyList_SetSlice(list, 1, 4, two), "set shrink");
+    CHECK(CONTENTS(list, 0, 20, 21, 4, 5, 6, 7, 8, 9), "shrunk %s", Dy_AsRepr(list));
+    CHECK(DyList_SetSlice(list, 0, 0, two), "set insert");
+    CHECK(CONTENTS(list, 20, 21, 0, 20, 21, 4, 5, 6, 7, 8, 9), "inserted %s", Dy_AsRepr(list));
+    CHECK(DyList_SetSlice(list, -2, 11, slice), "set delete");
+    CHECK(CONTENTS(list, 20, 21, 0, 20, 21, 4, 5, 6, 7), "deleted %s", Dy_AsRepr(list));
+    CHECK(DyList_SetSlice(list, 0, 1, list), "set self");
+    CHECK(CONTENTS(list, 20, 21, 0, 20, 21, 4, 5, 6, 7, 21, 0, 20, 21, 4, 5, 6, 7), "self %s", Dy_AsRepr(list));
+
+    CHECK(DyList_DelSlice(list, 3, -1), "del");
+    CHECK(CONTENTS(list, 20, 21, 0, 7), "del %s", Dy_AsRepr(list));
+    CHECK(DyList_DelSlice(list, 0, 100), "del all");
+    CHECK(Dy_Length(list) == 0, "empty");
+    CHECK(DyList_Extend(list, two) && CONTENTS(list, 20, 21), "reuse");
+
+    Dy_Release(two);
+    Dy_Release(slice);
+    Dy_Release(list);
+}
+
+static void test_pop_remove_reverse(void)
+{
+    DyObject *list = range(0, 5);
+
+    DyObject *item = DyList_Pop(list, -1);
+    CHECK(item && DyLong_Get(item) == 4, "pop last");
+    Dy_Release(item);
+    item = DyList_Pop(list, 0);
+    CHECK(item && DyLong_Get(item) == 0, "pop first");
+    Dy_Release(item);
+    CHECK(CONTENTS(list, 1, 2, 3), "after pop %s", Dy_AsRepr(list));
+    CHECK(!DyList_Pop(list, 3), "pop out of range");
+    DyErr_Clear();
+
+    item = DyLong_New(2);
+    CHECK(DyList_Remove(list, item), "remove");
+    CHECK(CONTENTS(list, 1, 3), "removed %s", Dy_AsRepr(list));
+    CHECK(!DyList_Remove(list, item), "remove missing");
+    DyErr_Clear();
+    Dy_Release(item);
+
+    CHECK(DyList_Reverse(list) && CONTENTS(list, 3, 1), "reverse %s", Dy_AsRepr(list));
+
+    // A queue: append at the back, pop at the front
+    DyObject *queue = DyList_New();
+    long expect = 0, next = 0;
+    for (int round = 0; round < N; ++round)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            item = DyLong_New(next++);
+            DyList_Append(queue, item);
+            Dy_Release(item);
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            item = DyList_Pop(queue, 0);
+            if (DyLong_Get(item) != expect++)
+                CHECK(false, "queue order at %ld", expect - 1);
+            Dy_Release(item);
+        }
+    }
+    CHECK(Dy_Length(queue) == N, "queue length");
+
+    DyObject *big = range(0, N);
+    CHECK(DyList_Reverse(big) && DyLong_Get(Dy_GetItemLong(big, 0)) == N - 1
+          && DyLong_Get(Dy_GetItemLong(big, N - 1)) == 0, "reverse big");
+
+    while (Dy_Length(big))
+        Dy_Release(DyList_Pop(big, -1));
+    CHECK(DyList_Extend(big, list) && CONTENTS(big, 3, 1), "grow after popping everything");
+
+    Dy_Release(big);
+    Dy_Release(queue);
+    Dy_Release(list);
+}
+
+
+// Sort keys: the first item of a [key, sequence] pair
+static DyObject *first_item(DyObject *item, void *data)
+{
+    (void)data;
+    return Dy_Retain(Dy_GetItemLong(item, 0));
+}
+
+static int descending(DyObject *a, DyObject *b, void *data)
+{
+    (void)data;
+    int64_t x = DyLong_Get(a), y = DyLong_Get(b);
+    return (x < y) - (x > y);
+}
+
+static DyObject *failing_key(DyObject *item, void *data)
+{
+    (void)item;
+    if (!--*(int *)data)
+    {
+        DyErr_Set(DY_ERRID_VALUE_ERROR, "no key");
+        return NULL;
+    }
+    return DyLong_New(0);
+}
+
+static DyObject *meddling_key(DyObject *item, void *list)
+{
+    DyList_Append(list, item);
+    return Dy_Retain(item);
+}
+
+// Pairs of [random key, sequence number]
+static DyObject *random_pairs(size_t n, long keys, unsigned seed)
+{
+    DyObject *list = DyList_NewEx(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        DyObject *key = DyLong_New((long)(seed >> 8) % keys - keys / 2);
+        DyObject *seq = DyLong_New(i);
+        DyObject *pair = DyList_New();
+        DyList_Append(pair, key);
+        DyList_Append(pair, seq);
+        DyList_Append(list, pair);
+        Dy_Release(pair);
+        Dy_Release(seq);
+        Dy_Release(key);
+    }
+    return list;
+}
+
+// Keys in order, equal keys in their original order
+static bool sorted_pairs(DyObject *list)
+{
+    for (size_t i = 1; i < Dy_Length(list); ++i)
+    {
+        DyObject *a = Dy_GetItemLong(list, i - 1), *b = Dy_GetItemLong(list, i);
+        int64_t ka = DyLong_Get(Dy_GetItemLong(a, 0)), kb = DyLong_Get(Dy_GetItemLong(b, 0));
+        if (ka > kb || (ka == kb && DyLong_Get(Dy_GetItemLong(a, 1)) > DyLong_Get(Dy_GetItemLong(b, 1))))
+            return false;
+    }
+    return true;
+}
+
+static void test_sort(void)
+{
+    DyObject *list = DyJson_Parse("[3, -1, 2, 9223372036854775807, -9223372036854775807, 0]");
+    CHECK(DyList_Sort(list, NULL, NULL, NULL), "sort longs");
+    CHECK(!strcmp(Dy_AsRepr(list), "[-9223372036854775807, -1, 0, 2, 3, 9223372036854775807]"), "longs %s", Dy_AsRepr(list));
+    CHECK(DyList_Sort(list, NULL, descending, NULL) && CONTENTS(list, 9223372036854775807, 3, 2, 0, -1, -9223372036854775807), "comparator %s", Dy_AsRepr(list));
+    Dy_Release(list);
+
+    list = DyJson_Parse("[2.5, -0.5, 1e300, -1e300, 0.0, -3.0]");
+    CHECK(DyList_Sort(list, NULL, NULL, NULL), "sort floats");
+    static const double floats[] = {-1e300, -3.0, -0.5, 0.0, 2.5, 1e300};
+    for (size_t i = 0; i < 6; ++i)
+        CHECK(DyFloat_Get(Dy_GetItemLong(list, i)) == floats[i], "float %zu", i);
+    Dy_Release(list);
+
+    list = DyJson_Parse("[\"prefix-b\", \"prefix-a-long\", \"prefix-a\", \"b\", \"\", \"prefix\", \"a\\u0000\", \"a\"]");
+    CHECK(DyList_Sort(list, NULL, NULL, NULL), "sort strings");
+    static const char *const strings[] = {"", "a", "a\0", "b", "prefix", "prefix-a", "prefix-a-long", "prefix-b"};
+    for (size_t i = 0; i < 8; ++i)
+    {
+        size_t size;
+        const char *data = DyString_AsStringAndSize(Dy_GetItemLong(list, i), &size);
+        CHECK(size == strlen(strings[i]) + (i == 2) && !memcmp(data, strings[i], size), "string %zu", i);
+    }
+    Dy_Release(list);
+
+    list = DyJson_Parse("[2, 1.5, -1, 0.25]");
+    CHECK(DyList_Sort(list, NULL, NULL, NULL), "sort numbers");
+    CHECK(DyLong_Get(Dy_GetItemLong(list, 0)) == -1 && DyFloat_Get(Dy_GetItemLong(list, 2)) == 1.5, "numbers %s", Dy_AsRepr(list));
+    DyObject *str = DyString_FromString("x");
+    DyList_Append(list, str);
+    Dy_Release(str);
+    CHECK(!DyList_Sort(list, NULL, NULL, NULL) && Dy_Length(list) == 5, "incomparable");
+    DyErr_Clear();
+
+    int countdown = 3;
+    CHECK(!DyList_Sort(list, failing_key, NULL, &countdown), "key error");
+    DyErr_Clear();
+    CHECK(DyLong_Get(Dy_GetItemLong(list, 0)) == -1 && Dy_Length(list) == 5, "unchanged after error");
+
+    CHECK(!DyList_Sort(list, meddling_key, NULL, list) && Dy_Length(list) == 5, "modified during sort");
+    DyErr_Clear();
+    Dy_Release(list);
+
+    // Stable on each path: serial, threads with odd and even chunk counts
+    static const unsigned threads[] = {1, 3, 4, UINT_MAX};
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+    {
+        DyHost_SetSortThreads(threads[t]);
+
+        list = random_pairs(100000, 1000, threads[t]);
+        CHECK(DyList_Sort(list, first_item, NULL, NULL) && sorted_pairs(list), "random pairs, %u threads", threads[t]);
+        CHECK(DyList_Sort(list, first_item, NULL, NULL) && sorted_pairs(list), "sorted pairs, %u threads", threads[t]);
+        Dy_Release(list);
+
+        list = range(0, 100000);
+        DyList_Reverse(list);
+        CHECK(DyList_Sort(list, NULL, NULL, NULL) && DyLong_Get(Dy_GetItemLong(list, 0)) == 0
+              && DyLong_Get(Dy_GetItemLong(list, 99999)) == 99999, "reversed, %u threads", threads[t]);
+        CHECK(DyList_Sort(list, NULL, descending, NULL) && DyLong_Get(Dy_GetItemLong(list, 0)) == 99999
+              && DyLong_Get(Dy_GetItemLong(list, 50000)) == 49999, "comparator, %u threads", threads[t]);
+        Dy_Release(list);
+    }
+    DyHost_SetSortThreads(0);
+}
+
+static void *sort_thread(void *arg)
+{
+    DyObject *list = arg;
+    return (void *)(uintptr_t)(DyList_Sort(list, first_item, NULL, NULL) && sorted_pairs(list));
+}
+
+// Sorts on several threads at once share the sort workers
+static void test_sort_concurrent(void)
+{
+    enum { SORTS = 4 };
+    DyObject *lists[SORTS];
+    pthread_t ids[SORTS];
+
+    DyHost_SetSortThreads(4);
+    for (unsigned i = 0; i < SORTS; ++i)
+    {
+        lists[i] = random_pairs(100000, 1000, i + 7);
+        pthread_create(&ids[i], NULL, sort_thread, lists[i]);
+    }
+    for (unsigned i = 0; i < SORTS; ++i)
+    {
+        void *ok;
+        pthread_join(ids[i], &ok);
+        CHECK(ok, "concurrent sort %u", i);
+        Dy_Release(lists[i]);
+    }
+    DyHost_SetSortThreads(0);
+}
+
+static void test_deque(void)
+{
+    DyObject *dq = DyDeque_New();
+    DyObject *list = range(0, 3);
+
+    // Wrap around the ring buffer several times while it grows
+    for (long i = 0; i < N; ++i)
+    {
+        DyObject *item = DyLong_New(i);
+        DyDeque_Push(dq, item);
+        Dy_Release(item);
+        if (i % 3 == 0)
+            Dy_Release(DyDeque_PopFront(dq));
+    }
+    CHECK(Dy_Length(dq) == N - (N + 2) / 3, "length %zu", Dy_Length(dq));
+    CHECK(DyLong_Get(Dy_GetItemLong(dq, 0)) == (N + 2) / 3,
+          "front %s", Dy_AsRepr(Dy_GetItemLong(dq, 0)));
+    CHECK(DyLong_Get(Dy_GetItemLong(dq, -1)) == N - 1, "back");
+
+    DyDeque_Clear(dq);
+    DyDeque_Extend(dq, list);
+    DyObject *item = DyLong_New(-1);
+    DyDeque_PushFront(dq, item);
+    Dy_SetItemLong(dq, 3, item);
+    Dy_Release(item);
+    CHECK(CONTENTS(dq, -1, 0, 1, -1), "push front %s", Dy_AsRepr(dq));
+
+    item = DyDeque_Pop(dq);
+    CHECK(DyLong_Get(item) == -1, "pop");
+    Dy_Release(item);
+    item = DyDeque_PopFront(dq);
+    CHECK(DyLong_Get(item) == -1, "pop front");
+    Dy_Release(item);
+    CHECK(Dy_GetItemLongU(dq, 2) == Dy_Undefined, "out of range");
+
+    // Drain in batches, then the rest
+    for (long i = 2; i < N; ++i)
+    {
+        item = DyLong_New(i);
+        DyDeque_Push(dq, item);
+        Dy_Release(item);
+    }
+    DyObject *batch = DyDeque_Drain(dq, 10);
+    CHECK(CONTENTS(batch, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9), "drain %s", Dy_AsRepr(batch));
+    Dy_Release(batch);
+    batch = DyDeque_Drain(dq, SIZE_MAX);
+    CHECK(Dy_Length(batch) == N - 10 && DyLong_Get(Dy_GetItemLong(batch, 0)) == 10
+          && DyLong_Get(Dy_GetItemLong(batch, -1)) == N - 1, "drain all");
+    CHECK(Dy_Length(dq) == 0, "drained");
+    Dy_Release(batch);
+
+    CHECK(!DyDeque_Pop(dq) && DyErr_Occurred(), "pop from empty deque");
+    DyErr_Clear();
+
+    Dy_Release(list);
+    Dy_Release(dq);
+}
+
+static void test_deque_bounded(void)
+{
+    DyObject *dq = DyDeque_NewBounded(3);
+    DyObject *list = range(0, 5);
+
+    DyDeque_Extend(dq, list);
+    CHECK(CONTENTS(dq, 2, 3, 4), "evict oldest %s", Dy_AsRepr(dq));
+
+    DyObject *item = DyLong_New(9);
+    DyDeque_PushFront(dq, item);
+    Dy_Release(item);
+    CHECK(CONTENTS(dq, 9, 2, 3), "evict back %s", Dy_AsRepr(dq));
+    CHECK(DyDeque_MaxLen(dq) == 3, "maxlen");
+
+    // A moving window over a long stream
+    DyDeque_Clear(dq);
+    long sum = 0;
+    for (long i = 0; i < N; ++i)
+    {
+        item = DyLong_New(i);
+        DyDeque_Push(dq, item);
+        Dy_Release(item);
+    }
+    for (size_t i = 0; i < Dy_Length(dq); ++i)
+        sum += DyLong_Get(Dy_GetItemLong(dq, i));
+    CHECK(sum == 3 * N - 6, "window sum %ld", sum);
+
+    Dy_Release(list);
+    Dy_Release(dq);
+}
+
+static size_t pooled_objects(void)
+{
+    DyPoolStats stats[16];
+    size_t classes = DyHost_GetPoolStats(stats, 16);
+    size_t in_use = 0;
+    for (size_t i = 0; i < classes && i < 16; ++i)
+        in_use += stats[i].in_use;
+    return in_use;
+}
+
+static void test_pools(void)
+{
+    DyHost_SetPoolLimit(1 << 20);
+    size_t before = pooled_objects();
+
+    // A list of N lists of one number each
+    DyObject *list = DyList_New();
+    for (long i = 0; i < N; ++i)
+    {
+        DyObject *item = range(i + 100000, i + 100001);
+        DyList_Append(list, item);
+        Dy_Release(item);
+    }
+    CHECK(pooled_objects() == before + 2 * N + 1, "pooled %zu", pooled_objects() - before);
+
+    // Objects allocated past the limit still work
+    DyHost_SetPoolLimit(0);
+    DyObject *more = range(N, 2 * N);
+    DyList_Extend(list, more);
+    Dy_Release(more);
+    CHECK(Dy_Length(list) == 2 * N, "length");
+    CHECK(DyLong_Get(Dy_GetItemLong(Dy_GetItemLong(list, N - 1), 0)) == N + 99999, "item");
+
+    Dy_Release(list);
+    CHECK(pooled_objects() == before, "leaked %zu", pooled_objects() - before);
+
+    // Drained pools keep a single slab
+    DyPoolStats stats[16];
+    size_t classes = DyHost_GetPoolStats(stats, 16);
+    size_t released = 0;
+    for (size_t i = 0; i < classes && i < 16; ++i)
+    {
+        if (!stats[i].in_use)
+            CHECK(stats[i].slabs <= 1, "class %zu kept %zu slabs", i, stats[i].slabs);
+        released += stats[i].released;
+    }
+    CHECK(released, "no slabs released");
+
+    DyHost_SetPoolLimit(64 << 20);
+}
+
+
+int main(void)
+{
+    test_insert();
+    test_extend();
+    test_slices();
+    test_pop_remove_reverse();
+    test_sort();
+    test_sort_concurrent();
+    test_deque();
+    test_deque_bounded();
+    test_pools();
+
+    return test_result("list");
+}
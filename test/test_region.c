@@ -0,0 +1,260 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libdy/dy.h>
+#include <libdy/exceptions.h>
+#include <libdy/json.h>
+#include <libdy/linalloc.h>
+#include <libdy/runtime.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_support.h"
+
+
+#define N 1000
+
+static size_t pooled_objects(void)
+{
+    DyPoolStats stats[16];
+    size_t classes = DyHost_GetPoolStats(stats, 16);
+    size_t in_use = 0;
+    for (size_t i = 0; i < classes && i < 16; ++i)
+        in_use += stats[i].in_use;
+    return in_use;
+}
+
+static void test_linalloc(void)
+{
+    dy_linalloc_t *la = dy_linalloc_new(100, malloc);
+
+    // Allocations keep going past the first chunk
+    char *blocks[N];
+    for (int i = 0; i < N; ++i)
+    {
+        blocks[i] = dy_linalloc_malloc(la, i % 37 + 1);
+        CHECK(blocks[i] && !((size_t)blocks[i] % 16), "block %d at %p", i, (void*)blocks[i]);
+        memset(blocks[i], i & 0xFF, i % 37 + 1);
+    }
+    for (int i = 0; i < N; ++i)
+        CHECK(blocks[i][i % 37] == (char)(i & 0xFF), "block %d overwritten", i);
+
+    // The last allocation grows in place, others move
+    size_t used = dy_linalloc_used(la);
+    char *last = dy_linalloc_realloc(la, blocks[N - 1], N % 37, 48);
+    CHECK(last == blocks[N - 1], "grow in place");
+    CHECK(dy_linalloc_used(la) == used + 48 - 16, "used %zu", dy_linalloc_used(la) - used);
+
+    char *moved = dy_linalloc_realloc(la, blocks[0], 1, 1 << 20);
+    CHECK(moved && moved != blocks[0] && moved[0] == 0, "moved");
+    CHECK(dy_linalloc_remaining(la) < (1 << 20), "remaining %zu", dy_linalloc_remaining(la));
+
+    dy_linalloc_free(la, free);
+}
+
+static const char *document =
+    "{\"name\": \"a string that is long enough to be sliced\","
+    " \"values\": [1, 2.5, 100000, -3, \"x\"],"
+    " \"nested\": {\"a\": [true, false, null], \"b\": {\"c\": \"d\"}}}";
+
+static void test_json(void)
+{
+    size_t pooled = pooled_objects();
+    DyString_InternStats stats;
+    DyString_InternFlushCache();
+    DyString_GetInternStats(&stats);
+    size_t interned = stats.count;
+
+    DyRegion *region = DyRegion_New(0);
+    DyRegion_Enter(region);
+    CHECK(DyRegion_Current() == region, "current");
+    DyObject *doc = DyJson_Parse(document);
+    DyRegion_Leave(region);
+    CHECK(!DyRegion_Current(), "left");
+
+    CHECK(doc, "parse");
+    CHECK(pooled_objects() == pooled, "pooled %zu", pooled_objects() - pooled);
+    CHECK(DyRegion_Size(region) > 0, "size");
+
+    // Reference counting does nothing
+    Dy_Release(doc);
+    Dy_Release(doc);
+    DyObject *values = Dy_GetItemString(doc, "values");
+    CHECK(Dy_Length(values) == 5, "length");
+    CHECK(DyLong_Get(Dy_GetItemLong(values, 2)) == 100000, "long");
+    CHECK(DyFloat_Get(Dy_GetItemLong(values, 1)) == 2.5, "float");
+    DyObject *c = Dy_GetItemString(Dy_GetItemString(Dy_GetItemString(doc, "nested"), "b"), "c");
+    CHECK(!strcmp(DyString_AsString(c), "d"), "nested %s", Dy_AsRepr(c));
+
+    DyObject *name = Dy_GetItemString(doc, "name");
+    DyObject *slice = DyString_Slice(name, 2, 36);
+    CHECK(slice && Dy_Length(slice) == 36, "slice");
+    Dy_Release(slice);
+
+    DyRegion_Enter(region);
+    DyObject *dict = DyDict_New();
+    DyDict_SetInternKeys(dict, true);
+    Dy_SetItem(dict, name, Dy_True);
+    DyRegion_Leave(region);
+
+    DyRegion_Free(region);
+
+    // The region never lets go of what it references, so neither the parsed
+    // keys nor those of a dict interning its keys went into the intern table
+    DyString_InternFlushCache();
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == interned, "interned %zu", stats.count - interned);
+
+    DyObject *again = DyJson_Parse(document);
+    CHECK(again && Dy_Length(Dy_GetItemString(again, "nested")) == 2, "parse again");
+    Dy_Release(again);
+}
+
+static int buffers_destroyed = 0;
+
+static void destroy_buffer(void *buffer)
+{
+    free(buffer);
+    ++buffers_destroyed;
+}
+
+static void test_tree(void)
+{
+    DyObject *global = DyDict_New();
+    DyObject *child = DyDict_NewWithParent(global);
+
+    DyRegion *region = DyRegion_New(256);
+    DyRegion_Enter(region);
+
+    // Containers grow inside the region
+    DyObject *list = DyList_New();
+    DyObject *dict = DyDict_New();
+    DyObject *deque = DyDeque_New();
+    for (long i = 0; i < N; ++i)
+    {
+        DyObject *item = DyLong_New(i * 1000);
+        DyList_Append(list, item);
+        Dy_SetItem(dict, item, item);
+        DyDeque_Push(deque, item);
+        Dy_Release(item);
+    }
+    DyList_Sort(list, NULL, NULL, NULL);
+
+    DyStringBuilder sb;
+    DyStringBuilder_Init(&sb);
+    for (int i = 0; i < 100; ++i)
+        DyStringBuilder_Append(&sb, "0123456789", 10);
+    DyObject *str = DyStringBuilder_Finish(&sb);
+
+    // The region would never release an external buffer, so it's copied
+    char *buffer = malloc(64);
+    memset(buffer, 'x', 64);
+    DyObject *external = DyString_FromBuffer(buffer, 64, buffer, destroy_buffer);
+    CHECK(buffers_destroyed == 1, "buffer destroyed %d times", buffers_destroyed);
+    CHECK(Dy_Length(external) == 64 && DyString_AsString(external)[63] == 'x', "copied buffer");
+
+    // Objects outside aren't affected
+    Dy_SetItemString(global, "key", str);
+    Dy_SetItemString(global, "key", Dy_None);
+    DyDict_EnableLookupCache(child);
+    CHECK(Dy_GetItemString(child, "key") == Dy_None, "lookup cache");
+
+    DyRegion_Leave(region);
+
+    CHECK(Dy_Length(list) == N && Dy_Length(dict) == N && Dy_Length(deque) == N, "lengths");
+    CHECK(DyLong_Get(Dy_GetItemLong(list, N - 1)) == (N - 1) * 1000, "list");
+    CHECK(DyLong_Get(Dy_GetItemLong(dict, 999000)) == 999000, "dict");
+    CHECK(Dy_Length(str) == 1000, "string");
+
+    // Growing a container of the region needs the region
+    DyObject *item = DyLong_New(1);
+    for (int i = 0; i < N && DyList_Append(list, item); ++i);
+    CHECK(DyErr_Filter(DyErr_Occurred(), DY_ERRID_REGION_ERROR), "append outside of the region");
+    DyErr_Clear();
+
+    DyRegion_Enter(region);
+    CHECK(DyList_Append(list, item), "append inside of the region");
+    DyRegion_Leave(region);
+    Dy_Release(item);
+
+    DyRegion_Free(region);
+
+    CHECK(Dy_GetItemString(child, "key") == Dy_None, "lookup cache after free");
+    Dy_Release(child);
+    Dy_Release(global);
+}
+
+static void test_nested(void)
+{
+    DyRegion *outer = DyRegion_New(0);
+    DyRegion *inner = DyRegion_New(0);
+
+    DyRegion_Enter(outer);
+    DyObject *a = DyList_New();
+    DyRegion_Enter(inner);
+    DyObject *b = DyList_New();
+    DyRegion_Leave(inner);
+    CHECK(DyRegion_Current() == outer, "back in the outer region");
+    DyObject *c = DyList_New();
+    DyRegion_Leave(outer);
+
+    // The outer region holds two lists, the inner one a single list
+    CHECK(DyRegion_Size(outer) > DyRegion_Size(inner), "sizes %zu %zu",
+          DyRegion_Size(outer), DyRegion_Size(inner));
+    CHECK(a != b && b != c, "distinct objects");
+
+    // Containers grow in their own region, whichever one is current
+    size_t outer_size = DyRegion_Size(outer);
+    size_t inner_size = DyRegion_Size(inner);
+    DyRegion_Enter(outer);
+    DyRegion_Enter(inner);
+    for (int i = 0; i < 100; ++i)
+        CHECK(DyList_Append(a, Dy_True), "append %d", i);
+    DyRegion_Leave(inner);
+    DyRegion_Leave(outer);
+
+    CHECK(DyRegion_Size(outer) >= outer_size + 100 * sizeof(DyObject *),
+          "outer size %zu", DyRegion_Size(outer) - outer_size);
+    CHECK(DyRegion_Size(inner) == inner_size, "inner size %zu", DyRegion_Size(inner) - inner_size);
+    DyRegion_Free(inner);
+    CHECK(Dy_Length(a) == 100 && Dy_GetItemLong(a, 99) == Dy_True, "outer list after freeing the inner region");
+
+    // Without its own region entered, a container can't grow
+    inner = DyRegion_New(0);
+    DyRegion_Enter(inner);
+    for (int i = 0; i < N && DyList_Append(a, Dy_None); ++i);
+    CHECK(DyErr_Filter(DyErr_Occurred(), DY_ERRID_REGION_ERROR), "append in another region");
+    DyErr_Clear();
+    DyRegion_Leave(inner);
+
+    DyRegion_Free(inner);
+    DyRegion_Free(outer);
+}
+
+
+int main(void)
+{
+    test_linalloc();
+    test_json();
+    test_tree();
+    test_nested();
+
+    return test_result("region");
+}
@@ -0,0 +1,672 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libdy/dy.h>
+#include <libdy/exceptions.h>
+#include <libdy/json.h>
+#include <libdy/runtime.h>
+#include <libdy/string_p.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_support.h"
+
+
+#define N 50000
+
+// Strings of every size around the header boundaries keep their contents
+static void test_short_strings(void)
+{
+    char buf[48];
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        buf[i] = 'a' + i % 26;
+
+    for (size_t size = 0; size < sizeof(buf); ++size)
+    {
+        DyObject *str = DyString_FromStringAndSize(buf, size);
+        const char *data = DyString_AsString(str);
+
+        CHECK(Dy_Length(str) == size, "length %zu", size);
+        CHECK(!memcmp(data, buf, size) && !data[size], "contents %zu", size);
+        CHECK(Dy_Equals(str, str), "equals %zu", size);
+
+        Dy_Release(str);
+    }
+}
+
+// Builders grow over many appends and format numbers like printf
+static void test_string_builder(void)
+{
+    DyStringBuilder sb;
+    char expect[64];
+
+    static const int64_t longs[] = {0, 7, -7, 10, 99, 100, -12345, 1234567890123, INT64_MAX, INT64_MIN};
+    for (size_t i = 0; i < sizeof(longs) / sizeof(longs[0]); ++i)
+    {
+        DyStringBuilder_Init(&sb);
+        DyStringBuilder_AppendLong(&sb, longs[i]);
+        DyObject *str = DyStringBuilder_Finish(&sb);
+
+        snprintf(expect, sizeof(expect), "%" PRId64, longs[i]);
+        CHECK(!strcmp(DyString_AsString(str), expect), "long %s: %s", expect, DyString_AsString(str));
+        Dy_Release(str);
+    }
+
+    DyStringBuilder_Init(&sb);
+    DyStringBuilder_AppendFloat(&sb, 1e300);
+    DyObject *str = DyStringBuilder_Finish(&sb);
+    CHECK(Dy_Length(str) == 308 && !strcmp(DyString_AsString(str) + 301, ".000000"), "huge float");
+    Dy_Release(str);
+
+    // Many small parts
+    DyStringBuilder_Init(&sb);
+    for (int i = 0; i < N; ++i)
+    {
+        DyStringBuilder_AppendLong(&sb, i % 10);
+        DyStringBuilder_AppendChar(&sb, ',');
+    }
+    str = DyStringBuilder_Finish(&sb);
+
+    const char *data = DyString_AsString(str);
+    bool ok = Dy_Length(str) == 2 * N;
+    for (int i = 0; ok && i < N; ++i)
+        ok = data[2 * i] == '0' + i % 10 && data[2 * i + 1] == ',';
+    CHECK(ok && !data[2 * N], "appended contents");
+    Dy_Release(str);
+
+    // Finishing an empty builder gives an empty string, discarding frees it
+    DyStringBuilder_Init(&sb);
+    str = DyStringBuilder_Finish(&sb);
+    CHECK(str && Dy_Length(str) == 0, "empty builder");
+    Dy_Release(str);
+
+    DyStringBuilder_Init(&sb);
+    DyStringBuilder_Printf(&sb, "%s-%d", "part", 1);
+    DyStringBuilder_Discard(&sb);
+
+    DyObject *list = DyList_New();
+    str = Dy_Repr(list);
+    CHECK(!strcmp(DyString_AsString(str), "[]"), "empty list repr %s", DyString_AsString(str));
+    Dy_Release(str);
+
+    DyList_Append(list, Dy_None);
+    DyList_Append(list, Dy_True);
+    DyObject *item = DyLong_New(-42);
+    DyList_Append(list, item);
+    Dy_Release(item);
+    item = DyString_FromString("x");
+    DyList_Append(list, item);
+    Dy_Release(item);
+
+    str = Dy_Repr(list);
+    CHECK(!strcmp(DyString_AsString(str), "[None, True, -42, \"x\"]"), "list repr %s", DyString_AsString(str));
+    Dy_Release(str);
+    Dy_Release(list);
+}
+
+// Concatenation, joining and formatting
+static void test_compose(void)
+{
+    DyObject *a = DyString_FromString("key");
+    DyObject *b = DyString_FromString(":value");
+    DyObject *empty = DyString_FromString("");
+
+    DyObject *ab = DyString_Concat(a, b);
+    CHECK(!strcmp(DyString_AsString(ab), "key:value") && Dy_Length(ab) == 9, "concat");
+    DyObject *copy = DyString_FromString("key:value");
+    CHECK(Dy_Equals(ab, copy) && Dy_Hash(ab) == Dy_Hash(copy), "concat equals");
+    Dy_Release(copy);
+
+    DyObject *same = DyString_Concat(a, empty);
+    CHECK(same == a, "concat empty");
+    Dy_Release(same);
+
+    DyObject *list = DyList_New();
+    DyObject *sep = DyString_FromString(", ");
+
+    DyObject *joined = DyString_Join(sep, list);
+    CHECK(joined && Dy_Length(joined) == 0, "join empty");
+    Dy_Release(joined);
+
+    DyList_Append(list, a);
+    joined = DyString_Join(sep, list);
+    CHECK(joined == a, "join one");
+    Dy_Release(joined);
+
+    DyList_Append(list, empty);
+    DyList_Append(list, ab);
+    joined = DyString_Join(sep, list);
+    CHECK(!strcmp(DyString_AsString(joined), "key, , key:value"), "join %s", DyString_AsString(joined));
+    Dy_Release(joined);
+
+    DyList_Append(list, Dy_None);
+    CHECK(!DyString_Join(sep, list), "join non-string");
+    DyErr_Clear();
+
+    DyObject *fmt = DyString_Format("%s=%d", "answer", 42);
+    CHECK(!strcmp(DyString_AsString(fmt), "answer=42"), "format");
+    Dy_Release(fmt);
+
+    // Longer than the stack buffer
+    char big[1000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+    fmt = DyString_Format("<%s>", big);
+    CHECK(Dy_Length(fmt) == sizeof(big) + 1 && DyString_AsString(fmt)[sizeof(big)] == '>', "long format");
+    Dy_Release(fmt);
+
+    Dy_Release(list);
+    Dy_Release(sep);
+    Dy_Release(a);
+    Dy_Release(b);
+    Dy_Release(ab);
+    Dy_Release(empty);
+}
+
+// UTF-8 validation, codepoint length and indexing
+static void test_encoding(void)
+{
+    static const struct {
+        const char *data;
+        bool valid;
+    } cases[] = {
+        {"plain ascii text that is longer than one block", true},
+        {"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80", true},
+        {"\xc0\x80", false},              // overlong NUL
+        {"\xe0\x80\xaf", false},          // overlong '/'
+        {"\xed\xa0\x80", false},          // surrogate
+        {"\xf4\x90\x80\x80", false},      // above U+10FFFF
+        {"\xf4\x8f\xbf\xbf", true},       // U+10FFFF
+        {"0123456789abcdef\xe2\x82", false}, // truncated after a block
+        {"\x80", false},                  // lone continuation byte
+        {"\xff", false},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        DyObject *str = DyString_FromString(cases[i].data);
+        CHECK(DyString_IsUTF8(str) == cases[i].valid, "valid %zu", i);
+        Dy_Release(str);
+    }
+
+    DyObject *str = DyString_FromString("\xe2\x82\xac uro and caf\xc3\xa9, padded to span blocks \xf0\x9f\x98\x80!");
+    CHECK(!DyString_IsASCII(str), "not ascii");
+    CHECK(DyString_Length(str) == 40, "codepoints %zu", DyString_Length(str));
+    CHECK(DyString_CodepointAt(str, 0) == 0x20AC, "euro");
+    CHECK(DyString_CodepointAt(str, 13) == 0xE9, "e acute");
+    CHECK(DyString_CodepointAt(str, 38) == 0x1F600, "emoji");
+    CHECK(DyString_CodepointAt(str, 39) == '!', "last");
+    CHECK(DyString_CodepointAt(str, 40) == -1, "out of range");
+    DyErr_Clear();
+    Dy_Release(str);
+
+    str = DyString_FromString("ascii only");
+    CHECK(DyString_IsASCII(str) && DyString_Length(str) == 10, "ascii");
+    CHECK(DyString_CodepointAt(str, 6) == 'o', "ascii index");
+    Dy_Release(str);
+
+    DyHost_SetCheckUTF8(true);
+    CHECK(!DyString_FromString("\xc3("), "checked creation");
+    DyErr_Clear();
+    str = DyString_FromString("caf\xc3\xa9");
+    CHECK(str && DyString_IsUTF8(str), "checked valid");
+    Dy_Release(str);
+    DyHost_SetCheckUTF8(false);
+
+    // The tokenizer validates strings and knows whether they're ASCII
+    DyObject *doc = DyJson_Parse("[\"caf\xc3\xa9\", \"plain\", \"esc\\u00e9\"]");
+    CHECK(doc, "json utf-8");
+    if (doc)
+    {
+        CHECK(DyString_Length(Dy_GetItemLong(doc, 0)) == 4, "json length");
+        CHECK(DyString_IsASCII(Dy_GetItemLong(doc, 1)), "json ascii");
+        CHECK(DyString_CodepointAt(Dy_GetItemLong(doc, 2), 3) == 0xE9, "json escape");
+        Dy_Release(doc);
+    }
+    else
+        DyErr_Clear();
+
+    CHECK(!DyJson_Parse("[\"bad \xc3(\"]"), "json invalid utf-8");
+    DyErr_Clear();
+
+    // Surrogate pair escapes combine into one codepoint
+    doc = DyJson_Parse("[\"\\uD83D\\uDE00!\", \"\\ud83d\", \"\\ud83d\\u0041\"]");
+    CHECK(doc, "json surrogates");
+    if (doc)
+    {
+        DyObject *pair = Dy_GetItemLong(doc, 0);
+        CHECK(!strcmp(DyString_AsString(pair), "\xf0\x9f\x98\x80!"), "json surrogate pair");
+        CHECK(DyString_IsUTF8(pair) && DyString_Length(pair) == 2, "json astral length");
+        CHECK(!DyString_IsUTF8(Dy_GetItemLong(doc, 1)), "json lone surrogate");
+        CHECK(!DyString_IsUTF8(Dy_GetItemLong(doc, 2)), "json unpaired surrogate");
+        CHECK(Dy_Length(Dy_GetItemLong(doc, 2)) == 4, "json unpaired size");
+        Dy_Release(doc);
+    }
+    else
+        DyErr_Clear();
+}
+
+static int buffers_freed = 0;
+
+static void free_buffer(void *buffer)
+{
+    free(buffer);
+    ++buffers_freed;
+}
+
+// The size of a string has to fit its 32 bit header field
+static void test_oversized(void)
+{
+#if SIZE_MAX > UINT32_MAX
+    size_t size = (size_t)UINT32_MAX + 1;
+
+    CHECK(!string_new_ex(size) && DyErr_Filter(DyErr_Occurred(), DY_ERRID_MEMORY_ERROR), "string_new_ex");
+    DyErr_Clear();
+    CHECK(!DyString_FromBuffer("x", size, NULL, NULL) && DyErr_Occurred(), "view");
+    DyErr_Clear();
+#endif
+}
+
+// Slices and strings over external buffers share the characters
+static void test_views(void)
+{
+    const char *text = "The quick brown fox jumps over the lazy dog, again and again";
+    size_t size = strlen(text);
+
+    char *buffer = malloc(size);
+    memcpy(buffer, text, size);
+
+    DyObject *str = DyString_FromBuffer(buffer, size, buffer, free_buffer);
+    size_t view_size;
+    CHECK(DyString_AsStringAndSize(str, &view_size) == buffer && view_size == size, "buffer view");
+
+    // Not terminated, so a copy is made
+    const char *cstr = DyString_AsString(str);
+    CHECK(cstr != buffer && !strcmp(cstr, text), "terminated copy");
+
+    DyObject *slice = DyString_Slice(str, 4, 40);
+    CHECK(Dy_Length(slice) == 40, "slice length");
+    CHECK(DyString_AsStringAndSize(slice, &view_size) == buffer + 4, "slice shares buffer");
+
+    // Slices of slices refer to the buffer too
+    DyObject *inner = DyString_Slice(slice, 6, 34);
+    CHECK(DyString_AsStringAndSize(inner, &view_size) == buffer + 10, "nested slice");
+
+    DyObject *copy = DyString_FromStringAndSize(text + 10, 34);
+    CHECK(Dy_Equals(inner, copy), "slice equals copy");
+    CHECK(Dy_Hash(inner) == Dy_Hash(copy), "slice hash");
+
+    // Interning a view interns a copy
+    DyObject *interned = DyString_Intern(inner);
+    CHECK(interned && interned != inner && Dy_Equals(interned, copy), "intern view");
+
+    DyObject *dict = DyDict_New();
+    Dy_SetItem(dict, inner, Dy_True);
+    CHECK(Dy_GetItemD(dict, copy, NULL) == Dy_True, "slice as dict key");
+    Dy_Release(dict);
+
+    // Short slices are copies
+    DyObject *small = DyString_Slice(str, 4, 5);
+    CHECK(DyString_AsStringAndSize(small, &view_size) != buffer + 4, "short slice copied");
+    CHECK(!strcmp(DyString_AsString(small), "quick"), "short slice contents");
+
+    CHECK(!DyString_Slice(str, 50, 20), "out of bounds slice");
+    DyErr_Clear();
+
+    Dy_Release(str);
+    Dy_Release(slice);
+    Dy_Release(small);
+    Dy_Release(copy);
+    CHECK(!buffers_freed, "buffer freed early");
+
+    Dy_Release(inner);
+    CHECK(buffers_freed == 1, "buffer not freed");
+
+    DyString_InternFlushCache();
+}
+
+// JSON strings without escapes can refer to the source
+static void test_json_views(void)
+{
+    DyObject *json = DyString_FromString(
+        "{\"short\": \"abc\", "
+        "\"long\": \"a string that is long enough to become a view\", "
+        "\"escaped\": \"a string that needs to be unescaped: \\\"\\n\\\\\"}");
+
+    for (unsigned flags = 0; flags <= DYJ_PARSE_VIEWS; ++flags)
+    {
+        DyObject *doc = DyJson_ParseEx(json, flags);
+        CHECK(doc, "parse %u", flags);
+        if (!doc)
+        {
+            DyErr_Clear();
+            continue;
+        }
+
+        const char *data = DyString_AsString(json);
+        size_t size;
+        const char *s = DyString_AsStringAndSize(Dy_GetItemString(doc, "long"), &size);
+        CHECK((s > data && s < data + Dy_Length(json)) == (flags == DYJ_PARSE_VIEWS), "view %u", flags);
+
+        s = DyString_AsString(Dy_GetItemString(doc, "long"));
+        CHECK(!strcmp(s, "a string that is long enough to become a view"), "long %u", flags);
+
+        s = DyString_AsString(Dy_GetItemString(doc, "short"));
+        CHECK(!strcmp(s, "abc"), "short %u", flags);
+
+        s = DyString_AsString(Dy_GetItemString(doc, "escaped"));
+        CHECK(!strcmp(s, "a string that needs to be unescaped: \"\n\\"), "escaped %u", flags);
+
+        Dy_Release(doc);
+    }
+
+    Dy_Release(json);
+    DyString_InternFlushCache();
+}
+
+// Unescaping writes into a string sized for the raw text, escapes at either
+// end must neither overrun it nor leave stale bytes
+static void test_json_unescape(void)
+{
+    static const struct {
+        const char *json;
+        const char *text;
+        size_t size;
+    } cases[] = {
+        {"[\"\\n\"]", "\n", 1},
+        {"[\"\\nabc\"]", "\nabc", 4},
+        {"[\"abc\\n\"]", "abc\n", 4},
+        {"[\"\\\\\\\"\"]", "\\\"", 2},
+        {"[\"\\u00e9\"]", "\xc3\xa9", 2},
+        {"[\"x\\u20ac\"]", "x\xe2\x82\xac", 4},
+        {"[\"\\ud83d\\ude00\"]", "\xf0\x9f\x98\x80", 4},
+        {"[\"\\u0000\"]", "\0", 1},
+        {"[\"long enough to be a view, but escaped at the very end\\t\"]",
+         "long enough to be a view, but escaped at the very end\t", 54},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        DyObject *json = DyString_FromString(cases[i].json);
+
+        for (unsigned flags = 0; flags <= DYJ_PARSE_VIEWS; ++flags)
+        {
+            DyObject *doc = DyJson_ParseEx(json, flags);
+            CHECK(doc, "parse %zu/%u", i, flags);
+            if (!doc)
+            {
+                DyErr_Clear();
+                continue;
+            }
+
+            size_t size;
+            const char *s = DyString_AsStringAndSize(Dy_GetItemLong(doc, 0), &size);
+            CHECK(size == cases[i].size && !memcmp(s, cases[i].text, size), "contents %zu/%u", i, flags);
+            CHECK(!s[size], "terminated %zu/%u", i, flags);
+
+            Dy_Release(doc);
+        }
+
+        Dy_Release(json);
+    }
+}
+
+// A view keeps the JSON source alive after the caller let go of it
+static void test_json_view_lifetime(void)
+{
+    static const char *text = "a string that is long enough to become a view of the source";
+    char buf[128];
+    snprintf(buf, sizeof(buf), "{\"key\": \"%s\"}", text);
+
+    DyObject *json = DyString_FromString(buf);
+    DyObject *doc = DyJson_ParseEx(json, DYJ_PARSE_VIEWS);
+    Dy_Release(json);
+    CHECK(doc, "parse");
+    if (!doc)
+    {
+        DyErr_Clear();
+        return;
+    }
+
+    DyObject *str = Dy_Retain(Dy_GetItemString(doc, "key"));
+    Dy_Release(doc);
+
+    CHECK(!strcmp(DyString_AsString(str), text), "view contents");
+
+    DyObject *slice = DyString_Slice(str, 2, 40);
+    Dy_Release(str);
+
+    DyObject *copy = DyString_FromStringAndSize(text + 2, 40);
+    CHECK(Dy_Equals(slice, copy), "slice of view");
+    Dy_Release(copy);
+    Dy_Release(slice);
+
+    DyString_InternFlushCache();
+}
+
+// The intern table grows with the strings in it and shrinks again
+static void test_intern_table(void)
+{
+    DyObject **strings = malloc(sizeof(DyObject *) * N);
+    DyString_InternStats stats;
+    char buf[32];
+
+    DyString_GetInternStats(&stats);
+    size_t base = stats.count;
+
+    for (int i = 0; i < N; ++i)
+    {
+        snprintf(buf, sizeof(buf), "intern-%d", i);
+        strings[i] = DyString_InternStringFromString(buf);
+        CHECK(strings[i], "intern %d", i);
+    }
+
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == base + N, "count %zu", stats.count);
+    CHECK(stats.buckets >= stats.count, "buckets %zu for %zu strings", stats.buckets, stats.count);
+    CHECK(stats.longest < 16, "longest chain %zu", stats.longest);
+    CHECK(stats.capacity >= stats.count, "capacity %zu", stats.capacity);
+    CHECK(!stats.keyed, "keyed without collisions");
+    size_t grown = stats.buckets;
+
+    // Same value, same object
+    for (int i = 0; i < N; ++i)
+    {
+        snprintf(buf, sizeof(buf), "intern-%d", i);
+        CHECK(DyString_InternedString(buf) == strings[i], "lookup %d", i);
+
+        DyObject *copy = DyString_FromString(buf);
+        CHECK(DyString_Intern(copy) == strings[i], "intern copy %d", i);
+        Dy_Release(copy);
+
+        DyObject *again = DyString_InternStringFromString(buf);
+        CHECK(again == strings[i], "intern again %d", i);
+        Dy_Release(again);
+    }
+
+    // Releasing the last reference removes the string. The thread cache
+    // holds references as well.
+    for (int i = 0; i < N; i += 2)
+        Dy_Release(strings[i]);
+    DyString_InternFlushCache();
+
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == base + N / 2, "count after release %zu", stats.count);
+
+    for (int i = 0; i < N; ++i)
+    {
+        snprintf(buf, sizeof(buf), "intern-%d", i);
+        DyObject *found = DyString_InternedString(buf);
+        CHECK(i % 2 ? found == strings[i] : !found, "lookup after release %d", i);
+    }
+
+    for (int i = 1; i < N; i += 2)
+        Dy_Release(strings[i]);
+    DyString_InternFlushCache();
+
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == base, "count after release all %zu", stats.count);
+    CHECK(stats.buckets < grown, "no shrink from %zu", grown);
+
+    free(strings);
+}
+
+// Threads interning (and dropping) the same keys concurrently
+#define THREADS 8
+#define THREAD_KEYS 4000
+
+typedef struct {
+    int seed;
+    DyObject *strings[THREAD_KEYS];
+} intern_thread_t;
+
+static void *intern_thread(void *arg)
+{
+    intern_thread_t *self = arg;
+    unsigned state = self->seed;
+    char buf[32];
+
+    // Churn: intern and drop right away, racing with the others' removals
+    for (int i = 0; i < 20 * THREAD_KEYS; ++i)
+    {
+        state = state * 1103515245 + 12345;
+        snprintf(buf, sizeof(buf), "shared-%u", (state >> 8) % THREAD_KEYS);
+
+        DyObject *str = DyString_FromString(buf);
+        DyString_InternInplace(&str);
+        Dy_Release(str);
+
+        if (i % 1000 == 0)
+            DyString_InternFlushCache();
+    }
+
+    for (int i = 0; i < THREAD_KEYS; ++i)
+    {
+        snprintf(buf, sizeof(buf), "shared-%d", (i + self->seed) % THREAD_KEYS);
+        self->strings[(i + self->seed) % THREAD_KEYS] = DyString_InternStringFromString(buf);
+    }
+
+    // The thread cache is flushed on exit
+    return NULL;
+}
+
+static void test_intern_threads(void)
+{
+    static intern_thread_t threads[THREADS];
+    pthread_t ids[THREADS];
+    DyString_InternStats stats;
+
+    DyString_GetInternStats(&stats);
+    size_t base = stats.count;
+
+    for (int t = 0; t < THREADS; ++t)
+    {
+        threads[t].seed = t * 997;
+        pthread_create(&ids[t], NULL, intern_thread, &threads[t]);
+    }
+    for (int t = 0; t < THREADS; ++t)
+        pthread_join(ids[t], NULL);
+
+    // Everyone got the same objects
+    for (int i = 0; i < THREAD_KEYS; ++i)
+        for (int t = 1; t < THREADS; ++t)
+            CHECK(threads[t].strings[i] == threads[0].strings[i], "thread %d key %d", t, i);
+
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == base + THREAD_KEYS, "count %zu", stats.count);
+
+    for (int t = 0; t < THREADS; ++t)
+        for (int i = 0; i < THREAD_KEYS; ++i)
+            Dy_Release(threads[t].strings[i]);
+
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == base, "count after release %zu", stats.count);
+}
+
+// Finding out a shared string's encoding races with interning it, and
+// neither may lose the other's flag
+#define SHARED_STRINGS 20000
+
+static DyObject *shared_strings[SHARED_STRINGS];
+
+static void *encoding_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < SHARED_STRINGS; ++i)
+        DyString_IsASCII(shared_strings[i]);
+    return NULL;
+}
+
+static void test_shared_flags(void)
+{
+    DyString_InternStats stats;
+    DyString_GetInternStats(&stats);
+    size_t base = stats.count;
+
+    char buf[32];
+    for (int i = 0; i < SHARED_STRINGS; ++i)
+    {
+        snprintf(buf, sizeof(buf), "flags-%d", i);
+        shared_strings[i] = DyString_FromString(buf);
+    }
+
+    pthread_t id;
+    pthread_create(&id, NULL, encoding_thread, NULL);
+    for (int i = 0; i < SHARED_STRINGS; ++i)
+    {
+        DyObject *str = shared_strings[i];
+        CHECK(DyString_InternInplace(&str) && str == shared_strings[i], "intern %d", i);
+    }
+    pthread_join(id, NULL);
+
+    for (int i = 0; i < SHARED_STRINGS; ++i)
+        CHECK(DyString_IsASCII(shared_strings[i]), "ascii %d", i);
+
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == base + SHARED_STRINGS, "count %zu", stats.count);
+
+    // Each one leaves the table when it's destroyed
+    for (int i = 0; i < SHARED_STRINGS; ++i)
+        Dy_Release(shared_strings[i]);
+    DyString_InternFlushCache();
+
+    DyString_GetInternStats(&stats);
+    CHECK(stats.count == base, "count after release %zu", stats.count);
+}
+
+int main(void)
+{
+    test_short_strings();
+    test_string_builder();
+    test_compose();
+    test_encoding();
+    test_oversized();
+    test_views();
+    test_json_views();
+    test_json_unescape();
+    test_json_view_lifetime();
+    test_intern_table();
+    test_intern_threads();
+    test_shared_flags();
+
+    return test_result("string");
+}
@@ -0,0 +1,57 @@
+/*
+ *  Dynamic Data exchange library [libdy]
+ *  Copyright (C) 2015 Taeyeon Mori
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libdy/dy.h>
+
+#include <stdio.h>
+
+// Checks keep going after a failure, main() reports them all at the end
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do if (!(cond)) \
+    { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        putchar('\n'); \
+        ++failures; \
+    } while (0)
+
+// The exit status of a test program: fails on an uncaught error or failed checks
+static inline int test_result(const char *name)
+{
+    DY_ERR_HANDLER
+        DY_ERR_CATCH_ALL(e)
+        {
+            printf("[EE] %s: %s\n", DyErr_ErrId(e), DyErr_Message(e));
+            DY_ERR_RETURN(1);
+        }
+    DY_ERR_HANDLER_END
+
+    if (failures)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All %s tests passed\n", name);
+    return 0;
+}